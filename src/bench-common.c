@@ -0,0 +1,495 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hangul.h>
+
+#include "bench-common.h"
+
+/* the longest key sequence of a syllable which is searched for */
+#define BENCH_MAX_KEYS_PER_SYLLABLE  6
+
+/* ------------------------------------------------------------------ */
+/* jamo                                                                */
+
+/* compound jamo and the jamo they are typed with on some keyboards */
+static const gchar * const compound_jamo[][2] = {
+    { "ㄲ", "ㄱ" },   { "ㄸ", "ㄷ" },   { "ㅃ", "ㅂ" },   { "ㅆ", "ㅅ" },
+    { "ㅉ", "ㅈ" },   { "ㄳ", "ㄱㅅ" }, { "ㄵ", "ㄴㅈ" }, { "ㄶ", "ㄴㅎ" },
+    { "ㄺ", "ㄹㄱ" }, { "ㄻ", "ㄹㅁ" }, { "ㄼ", "ㄹㅂ" }, { "ㄽ", "ㄹㅅ" },
+    { "ㄾ", "ㄹㅌ" }, { "ㄿ", "ㄹㅍ" }, { "ㅀ", "ㄹㅎ" }, { "ㅄ", "ㅂㅅ" },
+    { "ㅘ", "ㅗㅏ" }, { "ㅙ", "ㅗㅐ" }, { "ㅚ", "ㅗㅣ" }, { "ㅝ", "ㅜㅓ" },
+    { "ㅞ", "ㅜㅔ" }, { "ㅟ", "ㅜㅣ" }, { "ㅢ", "ㅡㅣ" },
+};
+
+static void
+jamo_set_add (GArray *set, gunichar c)
+{
+    guint i;
+
+    if (c == 0)
+        return;
+
+    for (i = 0; i < set->len; i++) {
+        if (g_array_index (set, gunichar, i) == c)
+            return;
+    }
+    g_array_append_val (set, c);
+}
+
+static void
+jamo_set_add_cjamo (GArray *set, ucschar jamo, gboolean pieces)
+{
+    gunichar c = hangul_jamo_to_cjamo (jamo);
+    gchar buf[8];
+    guint i;
+
+    jamo_set_add (set, c);
+    if (!pieces)
+        return;
+
+    buf[g_unichar_to_utf8 (c, buf)] = '\0';
+    for (i = 0; i < G_N_ELEMENTS (compound_jamo); i++) {
+        const gchar *p;
+
+        if (strcmp (compound_jamo[i][0], buf) != 0)
+            continue;
+        for (p = compound_jamo[i][1]; *p != '\0'; p = g_utf8_next_char (p))
+            jamo_set_add (set, g_utf8_get_char (p));
+    }
+}
+
+/**
+ * Adds the compatibility jamo which make up the characters of s.
+ */
+static void
+jamo_set_add_string (GArray *set, const ucschar *s, gboolean pieces)
+{
+    for (; s != NULL && *s != 0; s++) {
+        if (hangul_is_syllable (*s)) {
+            ucschar cho, jung, jong;
+
+            hangul_syllable_to_jamo (*s, &cho, &jung, &jong);
+            jamo_set_add_cjamo (set, cho, pieces);
+            jamo_set_add_cjamo (set, jung, pieces);
+            jamo_set_add_cjamo (set, jong, pieces);
+        } else if (hangul_is_jamo (*s)) {
+            jamo_set_add_cjamo (set, *s, pieces);
+        } else if (*s >= 0x3131 && *s <= 0x318e) {
+            jamo_set_add (set, *s);
+        }
+    }
+}
+
+static gboolean
+jamo_set_intersects (GArray *a, GArray *b)
+{
+    guint i, j;
+
+    for (i = 0; i < a->len; i++) {
+        for (j = 0; j < b->len; j++) {
+            if (g_array_index (a, gunichar, i) == g_array_index (b, gunichar, j))
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* ------------------------------------------------------------------ */
+/* corpus to keys                                                      */
+
+typedef struct {
+    HangulInputContext *ic;
+    GPtrArray          *probes;    /* jamo set of each key from '!' */
+    GHashTable         *syllables; /* syllable -> GArray of keyvals */
+} BenchTyping;
+
+static BenchTyping*
+bench_typing_new (const char *keyboard)
+{
+    BenchTyping *typing = g_new0 (BenchTyping, 1);
+    guint keyval;
+
+    typing->ic = hangul_ic_new (keyboard);
+    typing->probes =
+        g_ptr_array_new_with_free_func ((GDestroyNotify) g_array_unref);
+    typing->syllables = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                    NULL, (GDestroyNotify) g_array_unref);
+
+    // What each key makes alone
+    for (keyval = '!'; keyval <= '~'; keyval++) {
+        GArray *probe = g_array_new (FALSE, FALSE, sizeof (gunichar));
+
+        hangul_ic_reset (typing->ic);
+        if (hangul_ic_process (typing->ic, keyval)) {
+            jamo_set_add_string (probe,
+                    hangul_ic_get_commit_string (typing->ic), FALSE);
+            jamo_set_add_string (probe,
+                    hangul_ic_get_preedit_string (typing->ic), FALSE);
+        }
+        g_ptr_array_add (typing->probes, probe);
+    }
+
+    return typing;
+}
+
+static void
+bench_typing_free (BenchTyping *typing)
+{
+    hangul_ic_delete (typing->ic);
+    g_ptr_array_free (typing->probes, TRUE);
+    g_hash_table_destroy (typing->syllables);
+    g_free (typing);
+}
+
+static guint16
+guess_keycode (IBusKeymap *keymap, guint keyval, guint32 modifiers)
+{
+    /* The IBusKeymap only have 256 entries here,
+       Use Brute Force method to get keycode from keyval. */
+    guint16 keycode = 0;
+    for (; keycode < 256; ++keycode) {
+        if (keyval == ibus_keymap_lookup_keysym (keymap, keycode, modifiers))
+            return keycode;
+    }
+    return 0;
+}
+
+void
+bench_key_from_keyval (IBusKeymap *keymap, guint keyval, BenchKey *key)
+{
+    key->keyval = keyval;
+    key->keycode = 0;
+    key->modifiers = 0;
+
+    if (keymap == NULL)
+        return;
+
+    key->keycode = guess_keycode (keymap, keyval, 0);
+    if (key->keycode == 0) {
+        key->keycode = guess_keycode (keymap, keyval, IBUS_SHIFT_MASK);
+        key->modifiers = IBUS_SHIFT_MASK;
+    }
+}
+
+/**
+ * Types keys into a new syllable. Returns 1 if it makes target,
+ * -1 if it can't, and 0 if more keys may make it.
+ */
+static gint
+bench_typing_try (BenchTyping *typing, const guint *keys, guint n,
+                  ucschar target)
+{
+    const ucschar *s;
+    guint i;
+
+    hangul_ic_reset (typing->ic);
+    for (i = 0; i < n; i++) {
+        if (!hangul_ic_process (typing->ic, keys[i]))
+            return -1;
+        s = hangul_ic_get_commit_string (typing->ic);
+        if (s != NULL && s[0] != 0)
+            return -1;
+    }
+
+    s = hangul_ic_get_preedit_string (typing->ic);
+    if (s != NULL && s[0] == target && s[1] == 0)
+        return 1;
+
+    return 0;
+}
+
+static gboolean
+bench_typing_search (BenchTyping *typing, GArray *candidates,
+                     guint *keys, guint depth, guint max_depth,
+                     ucschar target)
+{
+    guint i;
+
+    for (i = 0; i < candidates->len; i++) {
+        gint r;
+
+        keys[depth] = g_array_index (candidates, guint, i);
+        r = bench_typing_try (typing, keys, depth + 1, target);
+        if (r > 0 && depth + 1 == max_depth)
+            return TRUE;
+        if (r == 0 && depth + 1 < max_depth &&
+            bench_typing_search (typing, candidates, keys, depth + 1,
+                                 max_depth, target))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * Finds the shortest key sequence which makes a syllable. Only the keys
+ * which make some jamo of the syllable are tried.
+ * Returns NULL if there is none.
+ */
+static GArray*
+bench_typing_find_syllable (BenchTyping *typing, ucschar syllable)
+{
+    GArray *keys;
+    GArray *target;
+    GArray *candidates;
+    guint seq[BENCH_MAX_KEYS_PER_SYLLABLE];
+    ucschar s[2] = { syllable, 0 };
+    guint depth;
+    guint i;
+
+    if (g_hash_table_lookup_extended (typing->syllables,
+                GUINT_TO_POINTER (syllable), NULL, (gpointer*) &keys))
+        return keys;
+
+    target = g_array_new (FALSE, FALSE, sizeof (gunichar));
+    jamo_set_add_string (target, s, TRUE);
+
+    candidates = g_array_new (FALSE, FALSE, sizeof (guint));
+    for (i = 0; i < typing->probes->len; i++) {
+        if (jamo_set_intersects (g_ptr_array_index (typing->probes, i),
+                                 target)) {
+            guint keyval = '!' + i;
+            g_array_append_val (candidates, keyval);
+        }
+    }
+
+    keys = NULL;
+    for (depth = 1; depth <= BENCH_MAX_KEYS_PER_SYLLABLE; depth++) {
+        if (bench_typing_search (typing, candidates, seq, 0, depth,
+                                 syllable)) {
+            keys = g_array_new (FALSE, FALSE, sizeof (guint));
+            g_array_append_vals (keys, seq, depth);
+            break;
+        }
+    }
+
+    g_array_free (candidates, TRUE);
+    g_array_free (target, TRUE);
+
+    g_hash_table_insert (typing->syllables, GUINT_TO_POINTER (syllable), keys);
+
+    return keys;
+}
+
+/**
+ * Makes the keys of a word, and checks that libhangul makes the word from
+ * them, because the keys of a syllable may join the next syllable.
+ */
+static gboolean
+bench_typing_type_word (BenchTyping *typing, const char *word,
+                        GArray *keyvals)
+{
+    GString *out;
+    const ucschar *s;
+    const char *p;
+    gboolean ok;
+    guint i;
+
+    g_array_set_size (keyvals, 0);
+    for (p = word; *p != '\0'; p = g_utf8_next_char (p)) {
+        GArray *keys = bench_typing_find_syllable (typing,
+                                                   g_utf8_get_char (p));
+        if (keys == NULL)
+            return FALSE;
+        g_array_append_vals (keyvals, keys->data, keys->len);
+    }
+
+    out = g_string_new (NULL);
+    hangul_ic_reset (typing->ic);
+    for (i = 0; i < keyvals->len; i++) {
+        hangul_ic_process (typing->ic, g_array_index (keyvals, guint, i));
+        for (s = hangul_ic_get_commit_string (typing->ic); *s != 0; s++)
+            g_string_append_unichar (out, *s);
+    }
+    for (s = hangul_ic_flush (typing->ic); *s != 0; s++)
+        g_string_append_unichar (out, *s);
+
+    ok = strcmp (out->str, word) == 0;
+    g_string_free (out, TRUE);
+
+    return ok;
+}
+
+/**
+ * Splits the corpus into words of hangul syllables. Anything else
+ * separates words.
+ */
+gchar**
+bench_split_corpus (const char *corpus)
+{
+    GPtrArray *words = g_ptr_array_new ();
+    GString *word = g_string_new (NULL);
+    const char *p;
+
+    for (p = corpus; ; p = g_utf8_next_char (p)) {
+        gunichar c = g_utf8_get_char (p);
+
+        if (c != 0 && hangul_is_syllable (c)) {
+            g_string_append_unichar (word, c);
+            continue;
+        }
+
+        if (word->len > 0) {
+            g_ptr_array_add (words, g_strdup (word->str));
+            g_string_truncate (word, 0);
+        }
+
+        if (c == 0)
+            break;
+    }
+
+    g_string_free (word, TRUE);
+    g_ptr_array_add (words, NULL);
+
+    return (gchar**) g_ptr_array_free (words, FALSE);
+}
+
+BenchKeyboard*
+bench_keyboard_new (const char *id, gchar **words, IBusKeymap *keymap)
+{
+    BenchKeyboard *keyboard = g_new0 (BenchKeyboard, 1);
+    BenchTyping *typing = bench_typing_new (id);
+    GArray *keyvals = g_array_new (FALSE, FALSE, sizeof (guint));
+    BenchKey key;
+    guint i, j;
+
+    keyboard->id = g_strdup (id);
+    keyboard->keys = g_array_new (FALSE, FALSE, sizeof (BenchKey));
+    keyboard->expected = g_string_new (NULL);
+
+    for (i = 0; words[i] != NULL; i++) {
+        if (!bench_typing_type_word (typing, words[i], keyvals)) {
+            keyboard->n_skipped++;
+            continue;
+        }
+
+        for (j = 0; j < keyvals->len; j++) {
+            bench_key_from_keyval (keymap, g_array_index (keyvals, guint, j),
+                                   &key);
+            g_array_append_val (keyboard->keys, key);
+        }
+        bench_key_from_keyval (keymap, IBUS_space, &key);
+        g_array_append_val (keyboard->keys, key);
+
+        g_string_append (keyboard->expected, words[i]);
+        g_string_append_c (keyboard->expected, ' ');
+        keyboard->n_words++;
+    }
+
+    g_array_free (keyvals, TRUE);
+    bench_typing_free (typing);
+
+    return keyboard;
+}
+
+void
+bench_keyboard_free (BenchKeyboard *keyboard)
+{
+    g_free (keyboard->id);
+    g_array_free (keyboard->keys, TRUE);
+    g_string_free (keyboard->expected, TRUE);
+    g_free (keyboard);
+}
+
+static void
+bench_on_peer_connected (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+    GDBusConnection **peer = user_data;
+    GError *error = NULL;
+
+    *peer = g_dbus_connection_new_finish (result, &error);
+    if (*peer == NULL)
+        g_error ("Failed to connect the peer: %s", error->message);
+}
+
+GDBusConnection*
+bench_connect (GDBusConnection **peer)
+{
+    GDBusConnection *connection;
+    GSocket *sockets[2];
+    GSocketConnection *streams[2];
+    GError *error = NULL;
+    gchar *guid;
+    int fds[2];
+    guint i;
+
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        g_error ("socketpair failed");
+
+    for (i = 0; i < 2; i++) {
+        sockets[i] = g_socket_new_from_fd (fds[i], &error);
+        if (sockets[i] == NULL)
+            g_error ("%s", error->message);
+        streams[i] = g_socket_connection_factory_create_connection (sockets[i]);
+    }
+
+    // The server end authenticates on a thread while this waits for the
+    // client end.
+    *peer = NULL;
+    guid = g_dbus_generate_guid ();
+    g_dbus_connection_new (G_IO_STREAM (streams[0]), guid,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER |
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_ALLOW_ANONYMOUS,
+            NULL, NULL, bench_on_peer_connected, peer);
+    connection = g_dbus_connection_new_sync (G_IO_STREAM (streams[1]), NULL,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+            NULL, NULL, &error);
+    if (connection == NULL)
+        g_error ("Failed to connect: %s", error->message);
+
+    while (*peer == NULL)
+        g_main_context_iteration (NULL, TRUE);
+
+    g_free (guid);
+    for (i = 0; i < 2; i++) {
+        g_object_unref (streams[i]);
+        g_object_unref (sockets[i]);
+    }
+
+    return connection;
+}
+
+gsize
+bench_get_rss (void)
+{
+    FILE *file;
+    unsigned long size = 0;
+    unsigned long resident = 0;
+
+    file = fopen ("/proc/self/statm", "r");
+    if (file == NULL)
+        return 0;
+    if (fscanf (file, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose (file);
+
+    return resident * sysconf (_SC_PAGESIZE);
+}
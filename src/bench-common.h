@@ -0,0 +1,72 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+#include <ibus.h>
+
+/*
+ * The corpus of the benchmarks, made into key events.
+ */
+
+/* The burst-interval of the runs which measure the burst mode, so long
+ * that every key after the first one of an engine is a part of a burst,
+ * however fast the machine is. The other runs set it to 0, so they
+ * measure the path of each key. */
+#define BENCH_BURST_INTERVAL    60000
+
+typedef struct {
+    guint keyval;
+    guint keycode;
+    guint modifiers;
+} BenchKey;
+
+typedef struct {
+    gchar  *id;
+    GArray *keys;           /* BenchKey of all the words */
+    GString *expected;      /* the words which could be typed */
+    guint   n_words;
+    guint   n_skipped;
+} BenchKeyboard;
+
+gchar**        bench_split_corpus   (const char     *corpus);
+
+/* The keys of the words with a space after each. The keycodes are those
+ * of keymap, which may be NULL. */
+BenchKeyboard* bench_keyboard_new   (const char     *id,
+                                     gchar         **words,
+                                     IBusKeymap     *keymap);
+void           bench_keyboard_free  (BenchKeyboard  *keyboard);
+
+/* Fills key with the keycode of keyval in keymap, and the shift if the
+ * keycode needs it. */
+void           bench_key_from_keyval (IBusKeymap    *keymap,
+                                      guint          keyval,
+                                      BenchKey      *key);
+
+/* Connects two ends of a socketpair as peers. The engine is put on the
+ * returned connection, and peer only receives. */
+GDBusConnection* bench_connect      (GDBusConnection **peer);
+
+/* The resident memory of the process in bytes, or 0 if it is unknown. */
+gsize          bench_get_rss        (void);
+
+#endif
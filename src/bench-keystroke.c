@@ -0,0 +1,425 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Replays a Korean text corpus through the engine as key events, for each
+ * keyboard of libhangul, each preedit mode, and with hanja lock on and off,
+ * and once more in the syllable and word modes as bursts, where the keys
+ * of a word are sent without running the main loop between them. It
+ * reports keys per second, allocations per key and the signals which
+ * the engine sends out. The text the engine commits is checked against the
+ * corpus.
+ *
+ * The engine is driven without ibus-daemon. It is connected to a peer
+ * connection on a socketpair, and the messages it sends are seen by a
+ * filter on its connection. A client is emulated with them: CommitText
+ * and forwarded keys are appended to its text, DeleteSurroundingText
+ * deletes from it.
+ *
+ * Run it with "make bench" in src, which keeps the settings in memory and
+ * the user dictionary in the build directory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ibus.h>
+#include <hangul.h>
+
+#include "engine.h"
+#include "bench-common.h"
+
+/* options */
+static gchar *keyboard_filter = NULL;
+static gint repeat = 1;
+
+static const GOptionEntry entries[] =
+{
+    { "keyboard", 'k', 0, G_OPTION_ARG_STRING, &keyboard_filter,
+      "run only with the keyboard", "ID" },
+    { "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat,
+      "replay the corpus N times", "N" },
+    { NULL },
+};
+
+/*
+ * Allocations are counted on the main thread only, where the engine runs,
+ * so the GDBus worker thread and the filter below are not counted.
+ */
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static __thread gboolean count_allocs = FALSE;
+static __thread guint64 n_allocs = 0;
+
+void*
+malloc (size_t size)
+{
+    if (count_allocs)
+        n_allocs++;
+    return __libc_malloc (size);
+}
+
+void*
+calloc (size_t nmemb, size_t size)
+{
+    if (count_allocs)
+        n_allocs++;
+    return __libc_calloc (nmemb, size);
+}
+
+void*
+realloc (void *ptr, size_t size)
+{
+    if (count_allocs)
+        n_allocs++;
+    return __libc_realloc (ptr, size);
+}
+
+#define ALLOC_COUNTING_BEGIN()  (count_allocs = TRUE)
+#define ALLOC_COUNTING_END()    (count_allocs = FALSE)
+#define ALLOC_COUNT()           (n_allocs)
+#else
+#define ALLOC_COUNTING_BEGIN()
+#define ALLOC_COUNTING_END()
+#define ALLOC_COUNT()           ((guint64) 0)
+#endif
+
+/*
+ * The emulated client. The filter runs on the GDBus worker thread.
+ */
+static GMutex client_lock;
+static GHashTable *signal_counts = NULL;   /* member -> count */
+static GString *client_text = NULL;
+
+/* ------------------------------------------------------------------ */
+/* the emulated client                                                 */
+
+static GDBusMessage*
+bench_filter (GDBusConnection *connection,
+              GDBusMessage    *message,
+              gboolean         incoming,
+              gpointer         user_data)
+{
+    const gchar *member;
+    GVariant *body;
+    guint n;
+
+    if (incoming ||
+        g_dbus_message_get_message_type (message) !=
+        G_DBUS_MESSAGE_TYPE_SIGNAL)
+        return message;
+
+    member = g_dbus_message_get_member (message);
+    body = g_dbus_message_get_body (message);
+
+    g_mutex_lock (&client_lock);
+
+    n = GPOINTER_TO_UINT (g_hash_table_lookup (signal_counts, member));
+    g_hash_table_replace (signal_counts, g_strdup (member),
+                          GUINT_TO_POINTER (n + 1));
+
+    if (strcmp (member, "CommitText") == 0) {
+        GVariant *variant;
+        GVariant *text;
+
+        // IBusText is serialized as (sa{sv}sv)
+        g_variant_get (body, "(v)", &variant);
+        text = g_variant_get_child_value (variant, 2);
+        g_string_append (client_text, g_variant_get_string (text, NULL));
+        g_variant_unref (text);
+        g_variant_unref (variant);
+    } else if (strcmp (member, "DeleteSurroundingText") == 0) {
+        gint offset;
+        guint nchars;
+        glong len = g_utf8_strlen (client_text->str, -1);
+        glong start;
+        glong end;
+
+        g_variant_get (body, "(iu)", &offset, &nchars);
+        start = CLAMP (len + offset, 0, len);
+        end = CLAMP (start + (glong) nchars, 0, len);
+        g_string_erase (client_text,
+            g_utf8_offset_to_pointer (client_text->str, start) -
+            client_text->str,
+            g_utf8_offset_to_pointer (client_text->str, end) -
+            g_utf8_offset_to_pointer (client_text->str, start));
+    } else if (strcmp (member, "ForwardKeyEvent") == 0) {
+        guint keyval, keycode, state;
+
+        g_variant_get (body, "(uuu)", &keyval, &keycode, &state);
+        if (!(state & IBUS_RELEASE_MASK) && keyval >= 0x20 && keyval < 0x7f)
+            g_string_append_c (client_text, keyval);
+    }
+
+    g_mutex_unlock (&client_lock);
+
+    return message;
+}
+
+static void
+bench_client_reset (void)
+{
+    g_mutex_lock (&client_lock);
+    g_hash_table_remove_all (signal_counts);
+    g_string_truncate (client_text, 0);
+    g_mutex_unlock (&client_lock);
+}
+
+/* ------------------------------------------------------------------ */
+/* replay                                                              */
+
+static void
+bench_iterate (void)
+{
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+}
+
+static void
+bench_print_signals (void)
+{
+    GList *names;
+    GList *l;
+
+    g_mutex_lock (&client_lock);
+    names = g_list_sort (g_hash_table_get_keys (signal_counts),
+                         (GCompareFunc) strcmp);
+    for (l = names; l != NULL; l = l->next) {
+        g_print (" %s=%u", (const gchar*) l->data,
+                 GPOINTER_TO_UINT (g_hash_table_lookup (signal_counts,
+                                                        l->data)));
+    }
+    g_list_free (names);
+    g_mutex_unlock (&client_lock);
+}
+
+/**
+ * Replays the keys of a keyboard through a new engine.
+ * Returns FALSE if the text the client got differs from the corpus.
+ */
+static gboolean
+bench_run (GDBusConnection *connection,
+           GSettings       *settings,
+           BenchKeyboard   *keyboard,
+           const char      *preedit_mode,
+           gboolean         hanja_lock,
+           gboolean         burst)
+{
+    static guint n_engines = 0;
+    IBusEngine *engine;
+    gchar *path;
+    gint64 elapsed = 0;
+    guint64 allocs = 0;
+    guint n_keys = 0;
+    gboolean ok;
+    gint r;
+    guint i;
+
+    g_settings_set_string (settings, "hangul-keyboard", keyboard->id);
+    g_settings_set_string (settings, "preedit-mode", preedit_mode);
+    g_settings_set_uint (settings, "burst-interval",
+                         burst ? BENCH_BURST_INTERVAL : 0);
+    bench_iterate ();
+
+    path = g_strdup_printf ("/org/freedesktop/IBus/Engine/%u", ++n_engines);
+    engine = ibus_engine_new_with_type (IBUS_TYPE_HANGUL_ENGINE, "hangul",
+                                        path, connection);
+    g_object_ref_sink (engine);
+    g_free (path);
+
+    g_signal_emit_by_name (engine, "set-capabilities",
+                           IBUS_CAP_PREEDIT_TEXT | IBUS_CAP_AUXILIARY_TEXT |
+                           IBUS_CAP_LOOKUP_TABLE | IBUS_CAP_FOCUS |
+                           IBUS_CAP_SURROUNDING_TEXT);
+    g_signal_emit_by_name (engine, "enable");
+    g_signal_emit_by_name (engine, "focus-in");
+    if (hanja_lock) {
+        g_signal_emit_by_name (engine, "property-activate", "hanja_mode",
+                               PROP_STATE_CHECKED);
+    }
+    bench_iterate ();
+
+    g_dbus_connection_flush_sync (connection, NULL, NULL);
+    bench_client_reset ();
+
+    for (r = 0; r < repeat; r++) {
+        for (i = 0; i < keyboard->keys->len; i++) {
+            const BenchKey *key = &g_array_index (keyboard->keys, BenchKey, i);
+            gboolean handled = FALSE;
+            gboolean released = FALSE;
+            gint64 start;
+            guint64 allocs_start;
+
+            allocs_start = ALLOC_COUNT ();
+            start = g_get_monotonic_time ();
+            ALLOC_COUNTING_BEGIN ();
+
+            g_signal_emit_by_name (engine, "process-key-event",
+                                   key->keyval, key->keycode,
+                                   key->modifiers, &handled);
+            g_signal_emit_by_name (engine, "process-key-event",
+                                   key->keyval, key->keycode,
+                                   key->modifiers | IBUS_RELEASE_MASK,
+                                   &released);
+            // A burst is flushed from an idle source, at the end of a word.
+            if (!burst || key->keyval == IBUS_space ||
+                i + 1 == keyboard->keys->len)
+                bench_iterate ();
+
+            ALLOC_COUNTING_END ();
+            elapsed += g_get_monotonic_time () - start;
+            allocs += ALLOC_COUNT () - allocs_start;
+            n_keys++;
+
+            // A key which the engine doesn't take goes to the client, after
+            // what the engine has sent.
+            if (!handled && key->keyval >= 0x20 && key->keyval < 0x7f) {
+                g_dbus_connection_flush_sync (connection, NULL, NULL);
+                g_mutex_lock (&client_lock);
+                g_string_append_c (client_text, key->keyval);
+                g_mutex_unlock (&client_lock);
+            }
+        }
+    }
+
+    g_signal_emit_by_name (engine, "focus-out");
+    bench_iterate ();
+    g_dbus_connection_flush_sync (connection, NULL, NULL);
+
+    g_mutex_lock (&client_lock);
+    ok = TRUE;
+    for (r = 0; r < repeat && ok; r++) {
+        ok = strncmp (client_text->str + r * keyboard->expected->len,
+                      keyboard->expected->str,
+                      keyboard->expected->len) == 0;
+    }
+    ok = ok && client_text->len == repeat * keyboard->expected->len;
+    g_mutex_unlock (&client_lock);
+
+    g_print ("%-4s %-8s %-5s %8u keys %10.0f keys/s %7.2f allocs/key %s\n",
+             keyboard->id, preedit_mode,
+             hanja_lock ? "hanja" : (burst ? "burst" : ""),
+             n_keys,
+             elapsed > 0 ? n_keys * (double) G_USEC_PER_SEC / elapsed : 0.0,
+             n_keys > 0 ? (double) allocs / n_keys : 0.0,
+             ok ? "ok" : "MISMATCH");
+    g_print ("    signals:");
+    bench_print_signals ();
+    g_print ("\n");
+
+    ibus_object_destroy (IBUS_OBJECT (engine));
+    g_object_unref (engine);
+    bench_iterate ();
+
+    return ok;
+}
+
+int
+main (gint argc, gchar **argv)
+{
+    static const char * const preedit_modes[] = { "none", "syllable", "word" };
+    GOptionContext *context;
+    GError *error = NULL;
+    GDBusConnection *connection;
+    GDBusConnection *peer;
+    GSettings *settings;
+    IBusKeymap *keymap;
+    gchar *corpus;
+    gchar **words;
+    gboolean ok = TRUE;
+    guint i, j, k;
+
+    context = g_option_context_new ("CORPUS - ibus-hangul keystroke benchmark");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error) || argc < 2) {
+        g_print ("%s", g_option_context_get_help (context, TRUE, NULL));
+        return 2;
+    }
+    g_option_context_free (context);
+
+    if (!g_file_get_contents (argv[1], &corpus, NULL, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 2;
+    }
+    words = bench_split_corpus (corpus);
+    g_free (corpus);
+
+    ibus_init ();
+    ibus_hangul_init (NULL);
+
+    signal_counts = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, NULL);
+    client_text = g_string_new (NULL);
+
+    connection = bench_connect (&peer);
+    g_dbus_connection_add_filter (connection, bench_filter, NULL, NULL);
+
+    settings = g_settings_new ("org.freedesktop.ibus.engine.hangul");
+    g_settings_set_string (settings, "initial-input-mode", "hangul");
+
+    // The engine normalizes keyvals with the us keymap, so the keys are
+    // sent with the keycodes of it.
+    keymap = ibus_keymap_get ("us");
+
+    for (i = 0; i < hangul_ic_get_n_keyboards (); i++) {
+        const char *id = hangul_ic_get_keyboard_id (i);
+        BenchKeyboard *keyboard;
+
+        if (keyboard_filter != NULL && strcmp (keyboard_filter, id) != 0)
+            continue;
+
+        keyboard = bench_keyboard_new (id, words, keymap);
+        g_print ("%s: %s, %u words, %u skipped\n", id,
+                 hangul_ic_get_keyboard_name (i),
+                 keyboard->n_words, keyboard->n_skipped);
+
+        for (j = 0; j < G_N_ELEMENTS (preedit_modes); j++) {
+            for (k = 0; k < 2; k++) {
+                ok = bench_run (connection, settings, keyboard,
+                                preedit_modes[j], k == 1, FALSE) && ok;
+            }
+            // The engine doesn't merge the keys of a burst in the none mode.
+            if (strcmp (preedit_modes[j], "none") != 0) {
+                ok = bench_run (connection, settings, keyboard,
+                                preedit_modes[j], FALSE, TRUE) && ok;
+            }
+        }
+
+        bench_keyboard_free (keyboard);
+    }
+
+    g_clear_object (&keymap);
+    g_object_unref (settings);
+    g_dbus_connection_close_sync (connection, NULL, NULL);
+    g_object_unref (connection);
+    g_object_unref (peer);
+    g_strfreev (words);
+
+    ibus_hangul_exit ();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,473 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Measures the latency which clients see, from sending ProcessKeyEvent to
+ * receiving what the key made: CommitText, UpdatePreeditText or
+ * ForwardKeyEvent. If the engine makes none of them and doesn't take the
+ * key, the reply is what the client waits for.
+ *
+ * A private dbus-daemon is started with GTestDBus. The engine runs in a
+ * child process, which stands in for the engine process of ibus-daemon: it
+ * puts an engine on the bus at a well known name, and is driven over the
+ * bus with the methods of org.freedesktop.IBus.Engine, so every message
+ * takes the hops through the daemon. A child is started for each preedit
+ * mode, with event forwarding on and off, and for the syllable and word
+ * modes in the burst mode. In the burst mode the engine sends what a key
+ * made from an idle source after the reply, and the latency is to that.
+ *
+ * Run it with "make bench" in src.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ibus.h>
+
+#include "engine.h"
+#include "bench-common.h"
+
+#define BENCH_BUS_NAME      "org.freedesktop.IBus.HangulBench"
+#define BENCH_ENGINE_PATH   "/org/freedesktop/IBus/Engine/1"
+
+/* how long a key of a burst may wait for what it made after the reply */
+#define BENCH_EFFECT_WAIT   (100 * 1000)    /* us */
+
+/* options */
+static gchar *keyboard_id = "2";
+static gint max_keys = 2000;
+static gchar *serve_preedit_mode = NULL;
+static gboolean serve_forwarding = FALSE;
+static gboolean serve_burst = FALSE;
+
+static const GOptionEntry entries[] =
+{
+    { "keyboard", 'k', 0, G_OPTION_ARG_STRING, &keyboard_id,
+      "the keyboard to type with", "ID" },
+    { "keys", 'n', 0, G_OPTION_ARG_INT, &max_keys,
+      "send at most N keys in each run", "N" },
+    // for the child
+    { "serve", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING,
+      &serve_preedit_mode, NULL, NULL },
+    { "forwarding", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,
+      &serve_forwarding, NULL, NULL },
+    { "burst", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,
+      &serve_burst, NULL, NULL },
+    { NULL },
+};
+
+/* ------------------------------------------------------------------ */
+/* the engine process                                                  */
+
+static void
+bench_serve_on_destroy (IBusEngine *engine, gpointer user_data)
+{
+    g_main_loop_quit ((GMainLoop*) user_data);
+}
+
+static int
+bench_serve (void)
+{
+    GDBusConnection *connection;
+    GSettings *settings;
+    GMainLoop *loop;
+    IBusEngine *engine;
+    GError *error = NULL;
+
+    settings = g_settings_new ("org.freedesktop.ibus.engine.hangul");
+    g_settings_set_string (settings, "hangul-keyboard", keyboard_id);
+    g_settings_set_string (settings, "initial-input-mode", "hangul");
+    g_settings_set_string (settings, "preedit-mode", serve_preedit_mode);
+    g_settings_set_boolean (settings, "use-event-forwarding",
+                            serve_forwarding);
+    g_settings_set_uint (settings, "burst-interval",
+                         serve_burst ? BENCH_BURST_INTERVAL : 0);
+
+    ibus_init ();
+    ibus_hangul_init (NULL);
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+    if (connection == NULL)
+        g_error ("Failed to connect to the bus: %s", error->message);
+
+    loop = g_main_loop_new (NULL, FALSE);
+
+    engine = ibus_engine_new_with_type (IBUS_TYPE_HANGUL_ENGINE, "hangul",
+                                        BENCH_ENGINE_PATH, connection);
+    g_object_ref_sink (engine);
+    g_signal_connect (engine, "destroy",
+                      G_CALLBACK (bench_serve_on_destroy), loop);
+
+    // The name is taken after the engine is on the bus, so the client
+    // can use the engine once it sees the name.
+    g_bus_own_name_on_connection (connection, BENCH_BUS_NAME,
+                                  G_BUS_NAME_OWNER_FLAGS_NONE,
+                                  NULL, NULL, NULL, NULL);
+
+    g_main_loop_run (loop);
+
+    g_object_unref (engine);
+    g_main_loop_unref (loop);
+    g_object_unref (connection);
+    g_object_unref (settings);
+
+    ibus_hangul_exit ();
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* the client                                                          */
+
+typedef struct {
+    gint64    sent;             /* when the key was sent */
+    gint64    effect;           /* when the first effect came, or 0 */
+    gboolean  replied;
+    gboolean  handled;
+    gboolean  wait_effect;      /* the effect may come after the reply */
+    guint     n_signals;        /* for all the keys */
+} BenchClient;
+
+static void
+bench_on_signal (GDBusConnection *connection,
+                 const gchar     *sender_name,
+                 const gchar     *object_path,
+                 const gchar     *interface_name,
+                 const gchar     *signal_name,
+                 GVariant        *parameters,
+                 gpointer         user_data)
+{
+    BenchClient *client = user_data;
+
+    client->n_signals++;
+
+    if (client->effect != 0 || (client->replied && !client->wait_effect))
+        return;
+
+    if (strcmp (signal_name, "CommitText") == 0 ||
+        strcmp (signal_name, "UpdatePreeditText") == 0 ||
+        strcmp (signal_name, "ForwardKeyEvent") == 0) {
+        client->effect = g_get_monotonic_time ();
+    }
+}
+
+static void
+bench_on_reply (GObject      *source_object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+    BenchClient *client = user_data;
+    GVariant *reply;
+    GError *error = NULL;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                           result, &error);
+    if (reply == NULL)
+        g_error ("ProcessKeyEvent failed: %s", error->message);
+
+    g_variant_get (reply, "(b)", &client->handled);
+    g_variant_unref (reply);
+
+    // The signals which the engine sent while it processed the key come
+    // before the reply.
+    if (client->effect == 0 && !client->handled)
+        client->effect = g_get_monotonic_time ();
+    client->replied = TRUE;
+}
+
+static void
+bench_call (GDBusConnection *connection,
+            const gchar     *method,
+            GVariant        *parameters)
+{
+    GVariant *reply;
+    GError *error = NULL;
+
+    reply = g_dbus_connection_call_sync (connection, BENCH_BUS_NAME,
+                                         BENCH_ENGINE_PATH,
+                                         IBUS_INTERFACE_ENGINE, method,
+                                         parameters, NULL,
+                                         G_DBUS_CALL_FLAGS_NONE, -1,
+                                         NULL, &error);
+    if (reply == NULL)
+        g_error ("%s failed: %s", method, error->message);
+    g_variant_unref (reply);
+}
+
+static void
+bench_send_key (GDBusConnection *connection,
+                BenchClient     *client,
+                const BenchKey  *key,
+                guint            modifiers)
+{
+    client->effect = 0;
+    client->replied = FALSE;
+    client->sent = g_get_monotonic_time ();
+
+    g_dbus_connection_call (connection, BENCH_BUS_NAME, BENCH_ENGINE_PATH,
+                            IBUS_INTERFACE_ENGINE, "ProcessKeyEvent",
+                            g_variant_new ("(uuu)", key->keyval,
+                                           key->keycode, modifiers),
+                            G_VARIANT_TYPE ("(b)"),
+                            G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                            bench_on_reply, client);
+
+    while (!client->replied)
+        g_main_context_iteration (NULL, TRUE);
+
+    if (client->wait_effect && client->handled) {
+        gint64 end = g_get_monotonic_time () + BENCH_EFFECT_WAIT;
+
+        while (client->effect == 0 && g_get_monotonic_time () < end)
+            g_main_context_iteration (NULL, FALSE);
+    }
+}
+
+/* Waits until the engine process has taken the name or let it go. */
+static gboolean
+bench_wait_for_name (GDBusConnection *connection, gboolean owned)
+{
+    guint i;
+
+    for (i = 0; i < 1000; i++) {
+        GVariant *reply;
+        gboolean has_owner = FALSE;
+
+        reply = g_dbus_connection_call_sync (connection,
+                "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                "org.freedesktop.DBus", "NameHasOwner",
+                g_variant_new ("(s)", BENCH_BUS_NAME),
+                G_VARIANT_TYPE ("(b)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                NULL, NULL);
+        if (reply != NULL) {
+            g_variant_get (reply, "(b)", &has_owner);
+            g_variant_unref (reply);
+        }
+        if (has_owner == owned)
+            return TRUE;
+
+        g_usleep (10 * 1000);
+    }
+
+    return FALSE;
+}
+
+static gint
+bench_compare_latency (gconstpointer a, gconstpointer b)
+{
+    gint64 l1 = *(const gint64*) a;
+    gint64 l2 = *(const gint64*) b;
+
+    return l1 < l2 ? -1 : (l1 > l2 ? 1 : 0);
+}
+
+static gint64
+bench_percentile (GArray *latencies, guint percent)
+{
+    guint i;
+
+    if (latencies->len == 0)
+        return 0;
+
+    i = (latencies->len - 1) * percent / 100;
+    return g_array_index (latencies, gint64, i);
+}
+
+static gboolean
+bench_run (GDBusConnection *connection,
+           const char      *self,
+           BenchKeyboard   *keyboard,
+           const char      *preedit_mode,
+           gboolean         forwarding,
+           gboolean         burst)
+{
+    gchar *argv[] = {
+        (gchar*) self, "--keyboard", keyboard->id,
+        "--serve", (gchar*) preedit_mode,
+        NULL, NULL, NULL
+    };
+    BenchClient client = { 0, };
+    GArray *latencies;
+    GError *error = NULL;
+    guint subscription;
+    guint n_keys;
+    guint i;
+    guint n = 5;
+
+    if (forwarding)
+        argv[n++] = "--forwarding";
+    if (burst)
+        argv[n++] = "--burst";
+
+    if (!g_spawn_async (NULL, argv, NULL, G_SPAWN_DEFAULT, NULL, NULL,
+                        NULL, &error)) {
+        g_printerr ("Failed to start the engine: %s\n", error->message);
+        g_clear_error (&error);
+        return FALSE;
+    }
+
+    if (!bench_wait_for_name (connection, TRUE)) {
+        g_printerr ("The engine didn't come up\n");
+        return FALSE;
+    }
+
+    subscription = g_dbus_connection_signal_subscribe (connection,
+            BENCH_BUS_NAME, IBUS_INTERFACE_ENGINE, NULL, BENCH_ENGINE_PATH,
+            NULL, G_DBUS_SIGNAL_FLAGS_NONE, bench_on_signal, &client, NULL);
+
+    bench_call (connection, "SetCapabilities",
+                g_variant_new ("(u)", IBUS_CAP_PREEDIT_TEXT |
+                               IBUS_CAP_AUXILIARY_TEXT |
+                               IBUS_CAP_LOOKUP_TABLE | IBUS_CAP_FOCUS |
+                               IBUS_CAP_SURROUNDING_TEXT));
+    bench_call (connection, "Enable", NULL);
+    bench_call (connection, "FocusIn", NULL);
+
+    n_keys = MIN (keyboard->keys->len, (guint) max_keys);
+    latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_keys);
+
+    client.n_signals = 0;
+    for (i = 0; i < n_keys; i++) {
+        const BenchKey *key = &g_array_index (keyboard->keys, BenchKey, i);
+        gint64 latency;
+
+        client.wait_effect = burst;
+        bench_send_key (connection, &client, key, key->modifiers);
+        client.wait_effect = FALSE;
+        latency = (client.effect != 0 ? client.effect : g_get_monotonic_time ())
+                  - client.sent;
+        g_array_append_val (latencies, latency);
+
+        bench_send_key (connection, &client, key,
+                        key->modifiers | IBUS_RELEASE_MASK);
+    }
+
+    g_array_sort (latencies, bench_compare_latency);
+
+    // A press and a release are two calls and two replies for each key.
+    g_print ("%-8s %-13s %6u keys  p50 %5" G_GINT64_FORMAT
+             "us  p90 %5" G_GINT64_FORMAT "us  p99 %5" G_GINT64_FORMAT
+             "us  max %6" G_GINT64_FORMAT "us  %5.2f signals/key"
+             "  %5.2f messages/key\n",
+             preedit_mode,
+             burst ? "burst" : (forwarding ? "forwarding" : "no-forwarding"),
+             n_keys,
+             bench_percentile (latencies, 50),
+             bench_percentile (latencies, 90),
+             bench_percentile (latencies, 99),
+             bench_percentile (latencies, 100),
+             n_keys > 0 ? (double) client.n_signals / n_keys : 0.0,
+             n_keys > 0 ? (double) client.n_signals / n_keys + 4 : 0.0);
+
+    g_dbus_connection_signal_unsubscribe (connection, subscription);
+
+    // The engine process exits when the engine is destroyed.
+    g_dbus_connection_call_sync (connection, BENCH_BUS_NAME,
+                                 BENCH_ENGINE_PATH, IBUS_INTERFACE_SERVICE,
+                                 "Destroy", NULL, NULL,
+                                 G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    if (!bench_wait_for_name (connection, FALSE))
+        g_printerr ("The engine didn't exit\n");
+
+    g_array_free (latencies, TRUE);
+
+    return TRUE;
+}
+
+int
+main (gint argc, gchar **argv)
+{
+    static const char * const preedit_modes[] = { "none", "syllable", "word" };
+    GOptionContext *context;
+    GError *error = NULL;
+    GTestDBus *bus;
+    GDBusConnection *connection;
+    BenchKeyboard *keyboard;
+    IBusKeymap *keymap;
+    gchar *corpus;
+    gchar **words;
+    gboolean ok = TRUE;
+    guint i, j;
+
+    context = g_option_context_new ("CORPUS - ibus-hangul latency benchmark");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 2;
+    }
+
+    if (serve_preedit_mode != NULL)
+        return bench_serve ();
+
+    if (argc < 2) {
+        g_print ("%s", g_option_context_get_help (context, TRUE, NULL));
+        return 2;
+    }
+    g_option_context_free (context);
+
+    if (!g_file_get_contents (argv[1], &corpus, NULL, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 2;
+    }
+    words = bench_split_corpus (corpus);
+    g_free (corpus);
+
+    ibus_init ();
+
+    // The keycodes are those of the us keymap, as in the engine.
+    keymap = ibus_keymap_get ("us");
+    keyboard = bench_keyboard_new (keyboard_id, words, keymap);
+    g_strfreev (words);
+    g_clear_object (&keymap);
+
+    // The children find the bus with DBUS_SESSION_BUS_ADDRESS.
+    bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+    g_test_dbus_up (bus);
+
+    connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+    if (connection == NULL)
+        g_error ("Failed to connect to the bus: %s", error->message);
+
+    g_print ("keyboard %s, %u words, %u skipped\n", keyboard->id,
+             keyboard->n_words, keyboard->n_skipped);
+
+    for (i = 0; i < G_N_ELEMENTS (preedit_modes); i++) {
+        for (j = 0; j < 2; j++) {
+            ok = bench_run (connection, argv[0], keyboard,
+                            preedit_modes[i], j == 0, FALSE) && ok;
+        }
+        // The engine doesn't merge the keys of a burst in the none mode.
+        if (strcmp (preedit_modes[i], "none") != 0) {
+            ok = bench_run (connection, argv[0], keyboard,
+                            preedit_modes[i], FALSE, TRUE) && ok;
+        }
+    }
+
+    bench_keyboard_free (keyboard);
+    g_object_unref (connection);
+    g_test_dbus_down (bus);
+    g_object_unref (bus);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Creates many engines in one process through the factory, as a session
+ * with many text fields does, and reports for each count of engines:
+ *
+ *   - the resident memory and the heap for each engine,
+ *   - the time to create and to destroy an engine,
+ *   - the time to deliver a change of the keyboard to all the engines.
+ *
+ * The engines are created with the CreateEngine method of IBusFactory and
+ * destroyed with the Destroy method of each engine, which a peer calls on
+ * a socketpair. The calls are sent at once, so the time is the time the
+ * engine process spends, not the round trips.
+ *
+ * Run it with "make bench" in src.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <ibus.h>
+
+#include "engine.h"
+#include "memstat.h"
+#include "bench-common.h"
+
+/* The keyboard is changed this many times for each count. */
+#define BENCH_SETTINGS_CHANGES  10
+
+/* options */
+static gchar *counts_option = "10,100,1000,10000";
+
+static const GOptionEntry entries[] =
+{
+    { "counts", 'n', 0, G_OPTION_ARG_STRING, &counts_option,
+      "create the engines of each count", "N,..." },
+    { NULL },
+};
+
+typedef struct {
+    GPtrArray *paths;           /* the object paths of the engines */
+    guint      n_pending;       /* calls without a reply */
+} BenchCalls;
+
+static void
+bench_on_created (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+    BenchCalls *calls = user_data;
+    GVariant *reply;
+    GError *error = NULL;
+    gchar *path;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                           result, &error);
+    if (reply == NULL)
+        g_error ("CreateEngine failed: %s", error->message);
+
+    g_variant_get (reply, "(o)", &path);
+    g_ptr_array_add (calls->paths, path);
+    g_variant_unref (reply);
+    calls->n_pending--;
+}
+
+static void
+bench_on_destroyed (GObject      *source_object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+    BenchCalls *calls = user_data;
+    GVariant *reply;
+    GError *error = NULL;
+
+    reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                           result, &error);
+    if (reply == NULL)
+        g_error ("Destroy failed: %s", error->message);
+
+    g_variant_unref (reply);
+    calls->n_pending--;
+}
+
+static void
+bench_wait (BenchCalls *calls)
+{
+    while (calls->n_pending > 0)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+bench_run (GDBusConnection *peer, GSettings *settings, guint n)
+{
+    BenchCalls calls = { NULL, 0 };
+    gsize rss_start;
+    gsize heap_start;
+    gsize rss;
+    gsize heap;
+    gint64 start;
+    gint64 created;
+    gint64 changed;
+    gint64 destroyed;
+    guint i;
+
+    calls.paths = g_ptr_array_new_with_free_func (g_free);
+
+    rss_start = bench_get_rss ();
+    heap_start = memstat_heap_size ();
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < n; i++) {
+        g_dbus_connection_call (peer, NULL, IBUS_PATH_FACTORY,
+                                IBUS_INTERFACE_FACTORY, "CreateEngine",
+                                g_variant_new ("(s)", "hangul"),
+                                G_VARIANT_TYPE ("(o)"),
+                                G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                bench_on_created, &calls);
+        calls.n_pending++;
+    }
+    bench_wait (&calls);
+    created = g_get_monotonic_time () - start;
+
+    rss = bench_get_rss ();
+    heap = memstat_heap_size ();
+
+    // Each change goes through settings_changed to every live engine.
+    start = g_get_monotonic_time ();
+    for (i = 0; i < BENCH_SETTINGS_CHANGES; i++) {
+        g_settings_set_string (settings, "hangul-keyboard",
+                               (i % 2 == 0) ? "3f" : "2");
+        while (g_main_context_iteration (NULL, FALSE))
+            ;
+    }
+    changed = g_get_monotonic_time () - start;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < calls.paths->len; i++) {
+        g_dbus_connection_call (peer, NULL,
+                                g_ptr_array_index (calls.paths, i),
+                                IBUS_INTERFACE_SERVICE, "Destroy",
+                                NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                                bench_on_destroyed, &calls);
+        calls.n_pending++;
+    }
+    bench_wait (&calls);
+    destroyed = g_get_monotonic_time () - start;
+
+    g_print ("%6u engines  rss %7.1f KiB  heap %7.1f KiB  create %7.1f us"
+             "  destroy %7.1f us  settings change %9.1f us\n",
+             n,
+             (gssize) (rss - rss_start) / 1024.0 / n,
+             (gssize) (heap - heap_start) / 1024.0 / n,
+             (double) created / n,
+             (double) destroyed / n,
+             (double) changed / BENCH_SETTINGS_CHANGES);
+
+    g_ptr_array_free (calls.paths, TRUE);
+}
+
+int
+main (gint argc, gchar **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    GDBusConnection *connection;
+    GDBusConnection *peer;
+    IBusFactory *factory;
+    GSettings *settings;
+    gchar **counts;
+    guint i;
+
+    context = g_option_context_new ("- ibus-hangul scale benchmark");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 2;
+    }
+    g_option_context_free (context);
+
+    ibus_init ();
+    ibus_hangul_init (NULL);
+
+    settings = g_settings_new ("org.freedesktop.ibus.engine.hangul");
+    g_settings_set_string (settings, "hangul-keyboard", "2");
+    g_settings_set_uint (settings, "burst-interval", 0);
+
+    connection = bench_connect (&peer);
+    factory = ibus_factory_new (connection);
+    ibus_factory_add_engine (factory, "hangul", IBUS_TYPE_HANGUL_ENGINE);
+
+    counts = g_strsplit (counts_option, ",", -1);
+    for (i = 0; counts[i] != NULL; i++) {
+        guint n = (guint) g_ascii_strtoull (counts[i], NULL, 10);
+        if (n > 0)
+            bench_run (peer, settings, n);
+    }
+    g_strfreev (counts);
+
+    ibus_object_destroy ((IBusObject *) factory);
+    g_object_unref (settings);
+    g_dbus_connection_close_sync (connection, NULL, NULL);
+    g_object_unref (connection);
+    g_object_unref (peer);
+
+    ibus_hangul_exit ();
+
+    return 0;
+}
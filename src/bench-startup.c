@@ -0,0 +1,278 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Measures what the component costs when it is started, as ibus-daemon
+ * does at login, and when the first engines are created. A session which
+ * never types Korean only pays the first.
+ *
+ * Each run is a new child process, so the dictionaries and the settings
+ * are loaded from scratch. The child reports the time, the resident memory
+ * and the heap of each step, and the medians of the runs are printed.
+ *
+ * Run it with "make bench" in src.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <ibus.h>
+
+#include "engine.h"
+#include "memstat.h"
+#include "bench-common.h"
+
+#define BENCH_ENGINE_PATH   "/org/freedesktop/IBus/Engine/%u"
+
+/* the steps which a child measures */
+enum {
+    BENCH_STEP_INIT,
+    BENCH_STEP_FIRST_ENGINE,
+    BENCH_STEP_SECOND_ENGINE,
+    BENCH_STEP_COUNT,
+};
+
+static const gchar* step_names[BENCH_STEP_COUNT] = {
+    "init",
+    "first engine",
+    "second engine",
+};
+
+typedef struct {
+    gint64 usec;
+    gint64 rss;
+    gint64 heap;
+} BenchStep;
+
+/* options */
+static gint runs = 20;
+static gboolean child = FALSE;
+
+static const GOptionEntry entries[] =
+{
+    { "runs", 'n', 0, G_OPTION_ARG_INT, &runs,
+      "start the component N times", "N" },
+    // for the child
+    { "child", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,
+      &child, NULL, NULL },
+    { NULL },
+};
+
+/* ------------------------------------------------------------------ */
+/* the child                                                           */
+
+static void
+bench_step_begin (BenchStep *step)
+{
+    step->rss = bench_get_rss ();
+    step->heap = memstat_heap_size ();
+    step->usec = g_get_monotonic_time ();
+}
+
+static void
+bench_step_end (BenchStep *step)
+{
+    step->usec = g_get_monotonic_time () - step->usec;
+    step->rss = (gint64) bench_get_rss () - step->rss;
+    step->heap = (gint64) memstat_heap_size () - step->heap;
+}
+
+static IBusEngine*
+bench_new_engine (GDBusConnection *connection, guint id)
+{
+    IBusEngine *engine;
+    gchar *path = g_strdup_printf (BENCH_ENGINE_PATH, id);
+
+    engine = ibus_engine_new_with_type (IBUS_TYPE_HANGUL_ENGINE, "hangul",
+                                        path, connection);
+    g_object_ref_sink (engine);
+    g_free (path);
+
+    return engine;
+}
+
+static int
+bench_child (void)
+{
+    GDBusConnection *connection;
+    GDBusConnection *peer;
+    IBusEngine *engines[2];
+    BenchStep steps[BENCH_STEP_COUNT];
+    guint i;
+
+    // The types of ibus and the bus are not what this measures.
+    ibus_init ();
+    connection = bench_connect (&peer);
+
+    bench_step_begin (&steps[BENCH_STEP_INIT]);
+    ibus_hangul_init (NULL);
+    bench_step_end (&steps[BENCH_STEP_INIT]);
+
+    bench_step_begin (&steps[BENCH_STEP_FIRST_ENGINE]);
+    engines[0] = bench_new_engine (connection, 1);
+    bench_step_end (&steps[BENCH_STEP_FIRST_ENGINE]);
+
+    bench_step_begin (&steps[BENCH_STEP_SECOND_ENGINE]);
+    engines[1] = bench_new_engine (connection, 2);
+    bench_step_end (&steps[BENCH_STEP_SECOND_ENGINE]);
+
+    for (i = 0; i < BENCH_STEP_COUNT; i++) {
+        g_print ("%" G_GINT64_FORMAT " %" G_GINT64_FORMAT
+                 " %" G_GINT64_FORMAT "\n",
+                 steps[i].usec, steps[i].rss, steps[i].heap);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (engines); i++) {
+        ibus_object_destroy ((IBusObject *) engines[i]);
+        g_object_unref (engines[i]);
+    }
+
+    g_dbus_connection_close_sync (connection, NULL, NULL);
+    g_object_unref (connection);
+    g_object_unref (peer);
+
+    ibus_hangul_exit ();
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* the runs                                                            */
+
+static gboolean
+bench_run (const char *self, BenchStep *steps)
+{
+    gchar *argv[] = { (gchar*) self, "--child", NULL };
+    gchar *output = NULL;
+    gchar **lines;
+    gint status;
+    GError *error = NULL;
+    gboolean ok = TRUE;
+    guint i;
+
+    if (!g_spawn_sync (NULL, argv, NULL, G_SPAWN_DEFAULT, NULL, NULL,
+                       &output, NULL, &status, &error) ||
+        !g_spawn_check_exit_status (status, &error)) {
+        g_printerr ("The child failed: %s\n", error->message);
+        g_clear_error (&error);
+        g_free (output);
+        return FALSE;
+    }
+
+    lines = g_strsplit (output, "\n", -1);
+    for (i = 0; i < BENCH_STEP_COUNT; i++) {
+        if (g_strv_length (lines) <= i ||
+            sscanf (lines[i], "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT
+                    " %" G_GINT64_FORMAT, &steps[i].usec, &steps[i].rss,
+                    &steps[i].heap) != 3) {
+            g_printerr ("The child wrote: %s\n", output);
+            ok = FALSE;
+            break;
+        }
+    }
+
+    g_strfreev (lines);
+    g_free (output);
+
+    return ok;
+}
+
+static gint
+bench_compare_int64 (gconstpointer a, gconstpointer b)
+{
+    gint64 v1 = *(const gint64*) a;
+    gint64 v2 = *(const gint64*) b;
+
+    return v1 < v2 ? -1 : (v1 > v2 ? 1 : 0);
+}
+
+static gint64
+bench_median (GArray *values)
+{
+    if (values->len == 0)
+        return 0;
+
+    g_array_sort (values, bench_compare_int64);
+    return g_array_index (values, gint64, values->len / 2);
+}
+
+int
+main (gint argc, gchar **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    GArray *usec[BENCH_STEP_COUNT];
+    GArray *rss[BENCH_STEP_COUNT];
+    GArray *heap[BENCH_STEP_COUNT];
+    guint n = 0;
+    guint i;
+    gint r;
+
+    context = g_option_context_new ("- ibus-hangul startup benchmark");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 2;
+    }
+    g_option_context_free (context);
+
+    if (child)
+        return bench_child ();
+
+    for (i = 0; i < BENCH_STEP_COUNT; i++) {
+        usec[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+        rss[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+        heap[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+    }
+
+    for (r = 0; r < runs; r++) {
+        BenchStep steps[BENCH_STEP_COUNT];
+
+        if (!bench_run (argv[0], steps))
+            continue;
+
+        for (i = 0; i < BENCH_STEP_COUNT; i++) {
+            g_array_append_val (usec[i], steps[i].usec);
+            g_array_append_val (rss[i], steps[i].rss);
+            g_array_append_val (heap[i], steps[i].heap);
+        }
+        n++;
+    }
+
+    g_print ("median of %u runs\n", n);
+    g_print ("%-14s %10s %12s %12s\n", "step", "time(us)", "rss(KiB)",
+             "heap(KiB)");
+    for (i = 0; i < BENCH_STEP_COUNT; i++) {
+        g_print ("%-14s %10" G_GINT64_FORMAT " %12" G_GINT64_FORMAT
+                 " %12" G_GINT64_FORMAT "\n",
+                 step_names[i], bench_median (usec[i]),
+                 bench_median (rss[i]) / 1024,
+                 bench_median (heap[i]) / 1024);
+        g_array_free (usec[i], TRUE);
+        g_array_free (rss[i], TRUE);
+        g_array_free (heap[i], TRUE);
+    }
+
+    return n == (guint) runs ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "candidate.h"
+
+typedef struct {
+    const char *key;
+    const char *value;
+    const char *comment;        /* NULL until it is read from file */
+    HanjaFile  *file;
+    guint       entry;
+    gint        next;           /* the previous one with the same value */
+} Candidate;
+
+struct _CandidateList {
+    GArray       *candidates;
+    GPtrArray    *files;          /* keeps the strings of HanjaFile alive */
+    GStringChunk *strings;        /* copied strings, created on demand */
+    GHashTable   *values;         /* value -> the last one with the value */
+};
+
+CandidateList*
+candidate_list_new (void)
+{
+    CandidateList *list = g_new0 (CandidateList, 1);
+
+    list->candidates = g_array_new (FALSE, FALSE, sizeof (Candidate));
+    list->files =
+        g_ptr_array_new_with_free_func ((GDestroyNotify) hanja_file_unref);
+
+    return list;
+}
+
+void
+candidate_list_delete (CandidateList *list)
+{
+    if (list == NULL)
+        return;
+
+    g_array_free (list->candidates, TRUE);
+    g_ptr_array_free (list->files, TRUE);
+    if (list->strings != NULL)
+        g_string_chunk_free (list->strings);
+    if (list->values != NULL)
+        g_hash_table_destroy (list->values);
+    g_free (list);
+}
+
+/*
+ * The candidates with the same value are chained from the last one, and
+ * the chains are found by the value. The strings of the candidates don't
+ * move, so they are the keys of the hash table.
+ * Most lists come from one source and are never merged, so the table is
+ * made when the list is merged for the first time.
+ */
+static void
+candidate_list_index (CandidateList *list, guint n)
+{
+    Candidate *c = &g_array_index (list->candidates, Candidate, n);
+    gpointer last;
+
+    if (g_hash_table_lookup_extended (list->values, c->value, NULL, &last))
+        c->next = GPOINTER_TO_INT (last);
+    else
+        c->next = -1;
+
+    g_hash_table_replace (list->values, (gpointer) c->value,
+                          GINT_TO_POINTER (n));
+}
+
+static void
+candidate_list_build_index (CandidateList *list)
+{
+    guint i;
+
+    if (list->values != NULL)
+        return;
+
+    list->values = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < list->candidates->len; i++)
+        candidate_list_index (list, i);
+}
+
+/* looks for the pair in the first n candidates */
+static gint
+candidate_list_find (CandidateList *list,
+                     const char    *key,
+                     const char    *value,
+                     guint          n)
+{
+    gpointer last;
+    gint i;
+
+    if (n == 0)
+        return -1;
+
+    candidate_list_build_index (list);
+    if (!g_hash_table_lookup_extended (list->values, value, NULL, &last))
+        return -1;
+
+    for (i = GPOINTER_TO_INT (last); i >= 0;) {
+        const Candidate *c = &g_array_index (list->candidates, Candidate, i);
+        if (i < (gint) n && strcmp (c->key, key) == 0)
+            return i;
+        i = c->next;
+    }
+
+    return -1;
+}
+
+static void
+candidate_list_add (CandidateList *list, const Candidate *c)
+{
+    g_array_append_vals (list->candidates, c, 1);
+    if (list->values != NULL)
+        candidate_list_index (list, list->candidates->len - 1);
+}
+
+/**
+ * Copies and appends an entry. The same key and value pair is added only
+ * once, so several sources can be merged in the order of their priority.
+ * Returns FALSE if the entry is already in the list.
+ */
+gboolean
+candidate_list_append (CandidateList *list,
+                       const char    *key,
+                       const char    *value,
+                       const char    *comment)
+{
+    Candidate c;
+
+    if (candidate_list_find (list, key, value, list->candidates->len) >= 0)
+        return FALSE;
+
+    if (list->strings == NULL)
+        list->strings = g_string_chunk_new (256);
+
+    c.key = g_string_chunk_insert_const (list->strings, key);
+    c.value = g_string_chunk_insert_const (list->strings, value);
+    if (comment != NULL && comment[0] != '\0')
+        c.comment = g_string_chunk_insert_const (list->strings, comment);
+    else
+        c.comment = "";
+    c.file = NULL;
+    c.entry = 0;
+    c.next = -1;
+
+    candidate_list_add (list, &c);
+    return TRUE;
+}
+
+/**
+ * Appends the entries [first, first + n) of file and keeps a reference to
+ * file. Entries already in the list keep their place, but get the comment
+ * from file when they had none.
+ */
+void
+candidate_list_append_hanja_file (CandidateList *list,
+                                  HanjaFile     *file,
+                                  guint          first,
+                                  guint          n)
+{
+    guint n_merged;
+    guint i;
+
+    if (n == 0)
+        return;
+
+    n_merged = list->candidates->len;
+    for (i = first; i < first + n; i++) {
+        Candidate c;
+        gint pos;
+
+        c.key = hanja_file_get_key (file, i);
+        c.value = hanja_file_get_value (file, i);
+        c.comment = NULL;
+        c.file = file;
+        c.entry = i;
+        c.next = -1;
+
+        // A key of HanjaFile has no duplicate values, so we only have to
+        // look at the entries which were in the list before.
+        pos = candidate_list_find (list, c.key, c.value, n_merged);
+        if (pos >= 0) {
+            Candidate *dup = &g_array_index (list->candidates, Candidate, pos);
+            if (dup->comment != NULL && dup->comment[0] == '\0') {
+                dup->comment = NULL;
+                dup->file = file;
+                dup->entry = i;
+            }
+        } else {
+            candidate_list_add (list, &c);
+        }
+    }
+
+    g_ptr_array_add (list->files, hanja_file_ref (file));
+}
+
+guint
+candidate_list_get_size (const CandidateList *list)
+{
+    if (list == NULL)
+        return 0;
+    return list->candidates->len;
+}
+
+const char*
+candidate_list_get_nth_key (const CandidateList *list, guint n)
+{
+    if (list == NULL || n >= list->candidates->len)
+        return NULL;
+    return g_array_index (list->candidates, Candidate, n).key;
+}
+
+const char*
+candidate_list_get_nth_value (const CandidateList *list, guint n)
+{
+    if (list == NULL || n >= list->candidates->len)
+        return NULL;
+    return g_array_index (list->candidates, Candidate, n).value;
+}
+
+/**
+ * Reads the comment from the file the first time, and keeps it in the list
+ * while the list lives.
+ */
+const char*
+candidate_list_get_nth_comment (CandidateList *list, guint n)
+{
+    Candidate *c;
+    gchar *comment;
+
+    if (list == NULL || n >= list->candidates->len)
+        return NULL;
+
+    c = &g_array_index (list->candidates, Candidate, n);
+    if (c->comment != NULL)
+        return c->comment;
+
+    comment = hanja_file_get_comment (c->file, c->entry);
+    if (comment != NULL) {
+        if (list->strings == NULL)
+            list->strings = g_string_chunk_new (256);
+        c->comment = g_string_chunk_insert (list->strings, comment);
+        g_free (comment);
+    } else {
+        c->comment = "";
+    }
+
+    return c->comment;
+}
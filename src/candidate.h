@@ -0,0 +1,55 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CANDIDATE_H__
+#define __CANDIDATE_H__
+
+#include <glib.h>
+
+#include "hanjafile.h"
+
+/**
+ * A list of hanja candidates which can be made from several sources.
+ * The entries of a HanjaFile are referred to, and the file is kept alive
+ * with the list. Their comments are read when they are asked for.
+ * Entries which don't come from a HanjaFile are copied into the list.
+ */
+typedef struct _CandidateList CandidateList;
+
+CandidateList* candidate_list_new          (void);
+void           candidate_list_delete       (CandidateList *list);
+
+gboolean       candidate_list_append       (CandidateList *list,
+                                            const char    *key,
+                                            const char    *value,
+                                            const char    *comment);
+void           candidate_list_append_hanja_file (CandidateList *list,
+                                                 HanjaFile     *file,
+                                                 guint          first,
+                                                 guint          n);
+
+guint          candidate_list_get_size     (const CandidateList *list);
+const char*    candidate_list_get_nth_key  (const CandidateList *list,
+                                            guint                n);
+const char*    candidate_list_get_nth_value (const CandidateList *list,
+                                             guint                n);
+const char*    candidate_list_get_nth_comment (CandidateList *list,
+                                               guint          n);
+
+#endif
@@ -0,0 +1,963 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2008-2009 Peng Huang <shawn.p.huang@gmail.com>
+ * Copyright (C) 2009-2011 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <ibus.h>
+
+#include "composer.h"
+#include "trace.h"
+
+struct _Composer {
+    HangulInputContext *context;
+    /* ibus-hangul's preedit string is made up of this internal preedit
+     * string and libhangul's preedit string. libhangul only supports one
+     * syllable preedit string. In order to make longer preedit string,
+     * ibus-hangul maintains internal preedit string. */
+    UString            *preedit;
+    /* Every instance's preedit_mode may be different from global settings.
+     * So we need a value for each instance. */
+    ComposerPreeditMode preedit_mode;
+    gboolean            hanja_mode;
+
+    ComposerSurroundingFunc surrounding_func;
+    gpointer                surrounding_data;
+};
+
+struct KeyEvent {
+    guint keyval;
+    guint modifiers;
+};
+
+typedef struct {
+    guint   all_modifiers;
+    GArray *keys;           /* KeyEvent, NULL if there is none */
+} HotkeyList;
+
+static gboolean auto_reorder = TRUE;
+static HotkeyList hotkeys[COMPOSER_N_HOTKEYS];
+
+static glong
+ucschar_strlen (const ucschar* str)
+{
+    const ucschar* p = str;
+    while (*p != 0)
+        p++;
+    return p - str;
+}
+
+/* ------------------------------------------------------------------ */
+/* actions                                                             */
+
+ComposerActions*
+composer_actions_new (void)
+{
+    ComposerActions *actions = g_slice_new (ComposerActions);
+
+    actions->actions = g_array_sized_new (FALSE, FALSE,
+                                          sizeof (ComposerAction), 4);
+    actions->text = ustring_new ();
+
+    return actions;
+}
+
+void
+composer_actions_free (ComposerActions *actions)
+{
+    if (actions == NULL)
+        return;
+
+    g_array_free (actions->actions, TRUE);
+    ustring_delete (actions->text);
+    g_slice_free (ComposerActions, actions);
+}
+
+void
+composer_actions_clear (ComposerActions *actions)
+{
+    g_array_set_size (actions->actions, 0);
+    ustring_clear (actions->text);
+}
+
+const ucschar*
+composer_actions_get_text (ComposerActions      *actions,
+                           const ComposerAction *action)
+{
+    return ustring_begin (actions->text) + action->offset;
+}
+
+/* Appends an action with the text of str and more, of which the first
+ * composed characters are composed. */
+static void
+composer_actions_append (ComposerActions    *actions,
+                         ComposerActionType  type,
+                         const UString      *str,
+                         const ucschar      *more,
+                         guint               composed)
+{
+    static const ucschar nul = 0;
+    ComposerAction action;
+
+    action.type = type;
+    action.offset = ustring_length (actions->text);
+    action.composed = composed;
+
+    if (str != NULL)
+        ustring_append (actions->text, str);
+    if (more != NULL)
+        ustring_append_ucs4 (actions->text, more, -1);
+    action.length = ustring_length (actions->text) - action.offset;
+    ustring_append_ucs4 (actions->text, &nul, 1);
+
+    g_array_append_val (actions->actions, action);
+}
+
+static void
+composer_actions_delete (ComposerActions *actions, guint length)
+{
+    ComposerAction action;
+
+    if (length == 0)
+        return;
+
+    action.type = COMPOSER_ACTION_DELETE_BEFORE_CURSOR;
+    action.offset = 0;
+    action.length = length;
+    action.composed = 0;
+    g_array_append_val (actions->actions, action);
+}
+
+static void
+composer_actions_clear_preedit (ComposerActions *actions)
+{
+    composer_actions_append (actions, COMPOSER_ACTION_UPDATE_PREEDIT,
+                             NULL, NULL, 0);
+}
+
+/* Removes the last action and its text. */
+static void
+composer_actions_drop_last (ComposerActions *actions)
+{
+    ComposerAction *last;
+    guint len;
+
+    last = &g_array_index (actions->actions, ComposerAction,
+                           actions->actions->len - 1);
+    if (last->type != COMPOSER_ACTION_DELETE_BEFORE_CURSOR) {
+        len = ustring_length (actions->text);
+        ustring_erase (actions->text, last->offset, len - last->offset);
+    }
+    g_array_set_size (actions->actions, actions->actions->len - 1);
+}
+
+static ComposerAction*
+composer_actions_last (ComposerActions *actions)
+{
+    if (actions->actions->len == 0)
+        return NULL;
+    return &g_array_index (actions->actions, ComposerAction,
+                           actions->actions->len - 1);
+}
+
+/* Whether the preedit is hidden after the actions, as far as they tell. */
+static gboolean
+composer_actions_hide_preedit (ComposerActions *actions)
+{
+    guint i;
+
+    for (i = actions->actions->len; i > 0; i--) {
+        ComposerAction *action;
+
+        action = &g_array_index (actions->actions, ComposerAction, i - 1);
+        if (action->type == COMPOSER_ACTION_UPDATE_PREEDIT)
+            return action->length == 0;
+    }
+
+    return FALSE;
+}
+
+void
+composer_actions_merge (ComposerActions *dest, ComposerActions *src)
+{
+    static const ucschar nul = 0;
+    guint i;
+
+    for (i = 0; i < src->actions->len; i++) {
+        const ComposerAction *action;
+        ComposerAction *last;
+        ComposerAction copy;
+
+        action = &g_array_index (src->actions, ComposerAction, i);
+        last = composer_actions_last (dest);
+
+        switch (action->type) {
+        case COMPOSER_ACTION_COMMIT:
+            if (last != NULL && last->type == COMPOSER_ACTION_COMMIT) {
+                /* the text of the last action is at the end of the buffer */
+                ustring_erase (dest->text, ustring_length (dest->text) - 1, 1);
+                ustring_append_ucs4 (dest->text,
+                                     composer_actions_get_text (src, action),
+                                     action->length);
+                ustring_append_ucs4 (dest->text, &nul, 1);
+                last->length += action->length;
+                continue;
+            }
+            break;
+        case COMPOSER_ACTION_UPDATE_PREEDIT:
+            /* the client never sees a preedit which is replaced before
+             * anything else happens */
+            while (last != NULL &&
+                   last->type == COMPOSER_ACTION_UPDATE_PREEDIT) {
+                composer_actions_drop_last (dest);
+                last = composer_actions_last (dest);
+            }
+            if (action->length == 0 && composer_actions_hide_preedit (dest))
+                continue;
+            break;
+        case COMPOSER_ACTION_DELETE_BEFORE_CURSOR:
+            if (last != NULL &&
+                last->type == COMPOSER_ACTION_DELETE_BEFORE_CURSOR) {
+                last->length += action->length;
+                continue;
+            }
+            g_array_append_val (dest->actions, *action);
+            continue;
+        }
+
+        copy = *action;
+        copy.offset = ustring_length (dest->text);
+        ustring_append_ucs4 (dest->text,
+                             composer_actions_get_text (src, action),
+                             action->length);
+        ustring_append_ucs4 (dest->text, &nul, 1);
+        g_array_append_val (dest->actions, copy);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* composer                                                            */
+
+static bool
+composer_on_transition (HangulInputContext     *hic,
+                        ucschar                 c,
+                        const ucschar          *preedit,
+                        void                   *data)
+{
+    if (!auto_reorder) {
+        if (hangul_is_choseong (c)) {
+            if (hangul_ic_has_jungseong (hic) || hangul_ic_has_jongseong (hic))
+                return false;
+        }
+
+        if (hangul_is_jungseong (c)) {
+            if (hangul_ic_has_jongseong (hic))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+Composer*
+composer_new (const char *keyboard)
+{
+    Composer *composer = g_slice_new0 (Composer);
+
+    composer->context = hangul_ic_new (keyboard);
+    composer->preedit = ustring_new ();
+    composer->preedit_mode = PREEDIT_MODE_SYLLABLE;
+
+    hangul_ic_connect_callback (composer->context, "transition",
+                                composer_on_transition, composer);
+
+    return composer;
+}
+
+void
+composer_delete (Composer *composer)
+{
+    if (composer == NULL)
+        return;
+
+    hangul_ic_delete (composer->context);
+    ustring_delete (composer->preedit);
+    g_slice_free (Composer, composer);
+}
+
+void
+composer_set_surrounding_func (Composer               *composer,
+                               ComposerSurroundingFunc func,
+                               gpointer                user_data)
+{
+    composer->surrounding_func = func;
+    composer->surrounding_data = user_data;
+}
+
+void
+composer_select_keyboard (Composer *composer, const char *keyboard)
+{
+    hangul_ic_select_keyboard (composer->context, keyboard);
+}
+
+void
+composer_set_preedit_mode (Composer *composer, ComposerPreeditMode mode)
+{
+    composer->preedit_mode = mode;
+}
+
+ComposerPreeditMode
+composer_get_preedit_mode (Composer *composer)
+{
+    return composer->preedit_mode;
+}
+
+void
+composer_set_hanja_mode (Composer *composer, gboolean hanja_mode)
+{
+    composer->hanja_mode = hanja_mode;
+}
+
+gboolean
+composer_get_hanja_mode (Composer *composer)
+{
+    return composer->hanja_mode;
+}
+
+gboolean
+composer_is_transliteration (Composer *composer)
+{
+    return hangul_ic_is_transliteration (composer->context);
+}
+
+gboolean
+composer_has_preedit (Composer *composer)
+{
+    const ucschar *hic_preedit;
+
+    hic_preedit = hangul_ic_get_preedit_string (composer->context);
+    if (hic_preedit[0] != 0)
+        return TRUE;
+
+    return ustring_length (composer->preedit) > 0;
+}
+
+guint
+composer_get_preedit_length (Composer *composer)
+{
+    return ustring_length (composer->preedit);
+}
+
+void
+composer_reset (Composer *composer)
+{
+    hangul_ic_reset (composer->context);
+    ustring_clear (composer->preedit);
+}
+
+void
+composer_set_auto_reorder (gboolean value)
+{
+    auto_reorder = value;
+}
+
+static const gchar*
+composer_get_surrounding_text (Composer *composer,
+                               guint    *cursor_pos,
+                               guint    *anchor_pos)
+{
+    *cursor_pos = 0;
+    *anchor_pos = 0;
+
+    if (composer->surrounding_func == NULL)
+        return NULL;
+
+    return composer->surrounding_func (composer->surrounding_data,
+                                       cursor_pos, anchor_pos);
+}
+
+static gchar*
+composer_get_substring (const gchar* text, glong p1, glong p2)
+{
+    const gchar* begin;
+    const gchar* end;
+    glong limit;
+    glong pos;
+    glong n;
+
+    if (text == NULL)
+        return NULL;
+
+    limit = g_utf8_strlen (text, -1) + 1;
+
+    p1 = MAX(0, p1);
+    p2 = MAX(0, p2);
+
+    pos = MIN(p1, p2);
+    n = ABS(p2 - p1);
+
+    if (pos + n > limit)
+        n = limit - pos;
+
+    begin = g_utf8_offset_to_pointer (text, pos);
+    end = g_utf8_offset_to_pointer (begin, n);
+
+    return g_strndup (begin, end - begin);
+}
+
+/**
+ * The preedit text is committed in PREEDIT_MODE_NONE, so the text before
+ * the cursor should be the same as it. If not, the user may have moved
+ * the cursor, and the context is reset.
+ *
+ * Usually we don't need this function. Only when the preedit mode is
+ * PREEDIT_MODE_NONE, it is critical to have same surrounding text and
+ * internal cached preedit text.
+ */
+static void
+composer_check_caret_pos_sanity (Composer *composer)
+{
+    const gchar* text;
+    const gchar* text_on_cursor;
+    gchar* preedit_utf8;
+    guint cursor_pos;
+    guint anchor_pos;
+
+    if (ustring_length (composer->preedit) == 0)
+        return;
+
+    text = composer_get_surrounding_text (composer, &cursor_pos, &anchor_pos);
+    if (text == NULL || cursor_pos == 0)
+        return;
+
+    text_on_cursor = g_utf8_offset_to_pointer (text, cursor_pos - 1);
+    preedit_utf8 = ustring_to_utf8 (composer->preedit, -1);
+    if (preedit_utf8 == NULL)
+        return;
+
+    // Ok, Just comparing text value is not perfect. But any other idea?
+    if (strncmp (preedit_utf8, text_on_cursor, strlen (preedit_utf8)) != 0) {
+        // If the text_on_cursor is different from preedit cache, there's a
+        // possibility that the cursor was moved by the user. Then we need
+        // to reset the context.
+        composer_reset (composer);
+    }
+    g_free (preedit_utf8);
+}
+
+void
+composer_update_preedit (Composer *composer, ComposerActions *actions)
+{
+    const ucschar *hic_preedit;
+
+    if (composer->preedit_mode == PREEDIT_MODE_NONE)
+        return;
+
+    hic_preedit = hangul_ic_get_preedit_string (composer->context);
+    composer_actions_append (actions, COMPOSER_ACTION_UPDATE_PREEDIT,
+                             composer->preedit, hic_preedit,
+                             ustring_length (composer->preedit));
+}
+
+/* PREEDIT_MODE_NONE: the text being composed is committed with each key,
+ * and replaced by deleting it before the cursor. */
+static void
+composer_commit_and_edit (Composer *composer, ComposerActions *actions)
+{
+    // commit current commit_text + preedit_text
+    const ucschar *hic_commit_text = hangul_ic_get_commit_string (composer->context);
+    const ucschar *hic_preedit_text = hangul_ic_get_preedit_string (composer->context);
+
+    UString *commit_text = ustring_new ();
+    ustring_append_ucs4 (commit_text, hic_commit_text, -1);
+    ustring_append_ucs4 (commit_text, hic_preedit_text, -1);
+
+    // commit only when the final result is different from preedit text cache
+    if (ustring_compare (commit_text, composer->preedit) != 0) {
+        guint n;
+
+        // The client keeps the characters which didn't change, so its
+        // undo history and layout aren't touched for them.
+        n = ustring_common_prefix (commit_text, composer->preedit);
+
+        // remove composing text
+        composer_actions_delete (actions,
+                                 ustring_length (composer->preedit) - n);
+        if (ustring_length (commit_text) > n) {
+            composer_actions_append (actions, COMPOSER_ACTION_COMMIT,
+                                     NULL, ustring_begin (commit_text) + n, 0);
+        }
+    }
+
+    ustring_delete (commit_text);
+
+    // update preedit_text cache
+    ustring_clear (composer->preedit);
+    ustring_append_ucs4 (composer->preedit, hic_preedit_text, -1);
+}
+
+static void
+composer_edit_and_commit (Composer *composer, ComposerActions *actions)
+{
+    const ucschar *hic_commit_text = hangul_ic_get_commit_string (composer->context);
+    const ucschar *hic_preedit_text = hangul_ic_get_preedit_string (composer->context);
+
+    if (composer->preedit_mode == PREEDIT_MODE_WORD || composer->hanja_mode) {
+        ustring_append_ucs4 (composer->preedit, hic_commit_text, -1);
+
+        if (hic_preedit_text == NULL || hic_preedit_text[0] == 0) {
+            if (ustring_length (composer->preedit) > 0) {
+                /* clear preedit text before commit */
+                composer_actions_clear_preedit (actions);
+                composer_actions_append (actions, COMPOSER_ACTION_COMMIT,
+                                         composer->preedit, NULL, 0);
+                ustring_clear (composer->preedit);
+            }
+        }
+    } else {
+        if (hic_commit_text != NULL && hic_commit_text[0] != 0) {
+            /* clear preedit text before commit */
+            composer_actions_clear_preedit (actions);
+            composer_actions_append (actions, COMPOSER_ACTION_COMMIT,
+                                     NULL, hic_commit_text, 0);
+        }
+    }
+
+    composer_update_preedit (composer, actions);
+}
+
+gboolean
+composer_process_key (Composer        *composer,
+                      guint            keyval,
+                      ComposerActions *actions)
+{
+    gboolean retval;
+
+    if (composer->preedit_mode == PREEDIT_MODE_NONE)
+        composer_check_caret_pos_sanity (composer);
+
+    retval = hangul_ic_process (composer->context, keyval);
+    TRACE2 (hangul_ic_process, keyval, retval);
+
+    if (composer->preedit_mode == PREEDIT_MODE_NONE) {
+        composer_commit_and_edit (composer, actions);
+    } else {
+        composer_edit_and_commit (composer, actions);
+    }
+
+    return retval;
+}
+
+gboolean
+composer_backspace (Composer *composer, ComposerActions *actions)
+{
+    gboolean retval;
+
+    if (composer->preedit_mode == PREEDIT_MODE_NONE)
+        composer_check_caret_pos_sanity (composer);
+
+    retval = hangul_ic_backspace (composer->context);
+    if (!retval) {
+        guint preedit_len = ustring_length (composer->preedit);
+        if (preedit_len > 0) {
+            ustring_erase (composer->preedit, preedit_len - 1, 1);
+            retval = TRUE;
+        }
+    }
+
+    if (composer->preedit_mode == PREEDIT_MODE_NONE) {
+        composer_commit_and_edit (composer, actions);
+    } else {
+        composer_update_preedit (composer, actions);
+    }
+
+    return retval;
+}
+
+void
+composer_flush (Composer *composer, ComposerActions *actions)
+{
+    const ucschar *str;
+
+    str = hangul_ic_flush (composer->context);
+
+    ustring_append_ucs4 (composer->preedit, str, -1);
+
+    if (ustring_length (composer->preedit) != 0) {
+        /* clear preedit text before commit */
+        composer_actions_clear_preedit (actions);
+        composer_actions_append (actions, COMPOSER_ACTION_COMMIT,
+                                 composer->preedit, NULL, 0);
+        ustring_clear (composer->preedit);
+    }
+
+    composer_update_preedit (composer, actions);
+}
+
+ComposerCandidateKey
+composer_get_candidate_key (Composer *composer,
+                            guint     keyval,
+                            gboolean  vertical,
+                            guint    *nth)
+{
+    *nth = 0;
+
+    switch (keyval) {
+    case IBUS_Escape:
+        return COMPOSER_CANDIDATE_KEY_CLOSE;
+    case IBUS_Return:
+        return COMPOSER_CANDIDATE_KEY_COMMIT;
+    case IBUS_Page_Up:
+        return COMPOSER_CANDIDATE_KEY_PAGE_UP;
+    case IBUS_Page_Down:
+        return COMPOSER_CANDIDATE_KEY_PAGE_DOWN;
+    }
+
+    if (keyval >= IBUS_1 && keyval <= IBUS_9) {
+        *nth = keyval - IBUS_1;
+        return COMPOSER_CANDIDATE_KEY_SELECT;
+    }
+
+    // The vi keys are text in hanja mode.
+    if (!composer->hanja_mode) {
+        switch (keyval) {
+        case IBUS_h:
+            keyval = IBUS_Left;
+            break;
+        case IBUS_l:
+            keyval = IBUS_Right;
+            break;
+        case IBUS_k:
+            keyval = IBUS_Up;
+            break;
+        case IBUS_j:
+            keyval = IBUS_Down;
+            break;
+        }
+    }
+
+    // The cursor moves along the table, and the page across it.
+    switch (keyval) {
+    case IBUS_Left:
+        return vertical ? COMPOSER_CANDIDATE_KEY_PAGE_UP :
+                          COMPOSER_CANDIDATE_KEY_CURSOR_UP;
+    case IBUS_Right:
+        return vertical ? COMPOSER_CANDIDATE_KEY_PAGE_DOWN :
+                          COMPOSER_CANDIDATE_KEY_CURSOR_DOWN;
+    case IBUS_Up:
+        return vertical ? COMPOSER_CANDIDATE_KEY_CURSOR_UP :
+                          COMPOSER_CANDIDATE_KEY_PAGE_UP;
+    case IBUS_Down:
+        return vertical ? COMPOSER_CANDIDATE_KEY_CURSOR_DOWN :
+                          COMPOSER_CANDIDATE_KEY_PAGE_DOWN;
+    }
+
+    return COMPOSER_CANDIDATE_KEY_NONE;
+}
+
+void
+composer_commit_candidate (Composer        *composer,
+                           const char      *key,
+                           const char      *value,
+                           LookupMethod     method,
+                           ComposerActions *actions)
+{
+    const ucschar* hic_preedit;
+    glong key_len;
+    glong hic_preedit_len;
+    glong preedit_len;
+    UString* text;
+
+    hic_preedit = hangul_ic_get_preedit_string (composer->context);
+
+    key_len = g_utf8_strlen (key, -1);
+    preedit_len = ustring_length (composer->preedit);
+    hic_preedit_len = ucschar_strlen (hic_preedit);
+
+    if (method == LOOKUP_METHOD_PREFIX) {
+        if (preedit_len == 0 && hic_preedit_len == 0) {
+            /* remove surrounding_text */
+            if (key_len > 0)
+                composer_actions_delete (actions, key_len);
+        } else {
+            /* remove ibus preedit text */
+            if (key_len > 0) {
+                glong n = MIN(key_len, preedit_len);
+                ustring_erase (composer->preedit, 0, n);
+                key_len -= preedit_len;
+            }
+
+            /* remove hic preedit text */
+            if (key_len > 0) {
+                hangul_ic_reset (composer->context);
+                key_len -= hic_preedit_len;
+            }
+        }
+    } else {
+        /* remove hic preedit text */
+        if (hic_preedit_len > 0) {
+            hangul_ic_reset (composer->context);
+            if (composer->preedit_mode == PREEDIT_MODE_NONE) {
+                if (preedit_len > hic_preedit_len) {
+                    guint pos = preedit_len - hic_preedit_len;
+                    ustring_erase (composer->preedit, pos, hic_preedit_len);
+                } else {
+                    ustring_clear (composer->preedit);
+                }
+                preedit_len = ustring_length (composer->preedit);
+            } else {
+                key_len -= hic_preedit_len;
+            }
+        }
+
+        /* remove ibus preedit text */
+        if (key_len > preedit_len) {
+            ustring_erase (composer->preedit, 0, preedit_len);
+            key_len -= preedit_len;
+        } else if (key_len > 0) {
+            ustring_erase (composer->preedit, 0, key_len);
+            key_len = 0;
+        }
+
+        /* remove surrounding_text */
+        if (key_len > 0)
+            composer_actions_delete (actions, key_len);
+    }
+
+    /* clear preedit text before commit */
+    composer_actions_clear_preedit (actions);
+
+    text = ustring_new ();
+    ustring_append_utf8 (text, value);
+    composer_actions_append (actions, COMPOSER_ACTION_COMMIT, text, NULL, 0);
+    ustring_delete (text);
+
+    composer_update_preedit (composer, actions);
+}
+
+gchar*
+composer_get_hanja_key (Composer *composer,
+                        guint     max_key_length,
+                        LookupMethod *lookup_method_ret)
+{
+    gchar* hanja_key;
+    gchar* preedit_utf8;
+    const ucschar* hic_preedit;
+    const gchar* text;
+    UString* preedit = NULL;
+    LookupMethod lookup_method;
+    guint cursor_pos = 0;
+    guint anchor_pos = 0;
+
+    hic_preedit = hangul_ic_get_preedit_string (composer->context);
+
+    hanja_key = NULL;
+    lookup_method = LOOKUP_METHOD_PREFIX;
+
+    if (composer->preedit_mode != PREEDIT_MODE_NONE) {
+        preedit = ustring_dup (composer->preedit);
+        ustring_append_ucs4 (preedit, hic_preedit, -1);
+    }
+
+    if (preedit != NULL && ustring_length(preedit) > 0) {
+        preedit_utf8 = ustring_to_utf8 (preedit, -1);
+        if (composer->preedit_mode == PREEDIT_MODE_WORD ||
+            composer->hanja_mode) {
+            hanja_key = preedit_utf8;
+            lookup_method = LOOKUP_METHOD_PREFIX;
+        } else {
+            gchar* substr;
+            glong window;
+
+            text = composer_get_surrounding_text (composer, &cursor_pos,
+                                                  &anchor_pos);
+
+            window = MAX (0, (glong) max_key_length -
+                             (glong) ustring_length (preedit));
+            substr = composer_get_substring (text,
+                    (glong)cursor_pos - window, cursor_pos);
+
+            if (substr != NULL) {
+                hanja_key = g_strconcat (substr, preedit_utf8, NULL);
+                g_free (preedit_utf8);
+                g_free (substr);
+            } else {
+                hanja_key = preedit_utf8;
+            }
+            lookup_method = LOOKUP_METHOD_SUFFIX;
+        }
+    } else {
+        text = composer_get_surrounding_text (composer, &cursor_pos,
+                                              &anchor_pos);
+        if (cursor_pos != anchor_pos) {
+            // If we have selection in surrounding text, we use that.
+            hanja_key = composer_get_substring (text, cursor_pos, anchor_pos);
+            lookup_method = LOOKUP_METHOD_EXACT;
+        } else {
+            hanja_key = composer_get_substring (text,
+                    (glong)cursor_pos - (glong) max_key_length, cursor_pos);
+            lookup_method = LOOKUP_METHOD_SUFFIX;
+        }
+    }
+
+    if (preedit != NULL)
+        ustring_delete (preedit);
+
+    *lookup_method_ret = lookup_method;
+    return hanja_key;
+}
+
+/* ------------------------------------------------------------------ */
+/* hotkeys                                                             */
+
+static void
+key_event_list_append(GArray* list, guint keyval, guint modifiers)
+{
+    struct KeyEvent ev = { keyval, modifiers};
+    g_array_append_val(list, ev);
+}
+
+static gboolean
+key_event_list_match(GArray* list, guint keyval, guint modifiers)
+{
+    guint i;
+    guint mask;
+
+    if (list == NULL)
+        return FALSE;
+
+    /* ignore capslock and numlock */
+    mask = IBUS_SHIFT_MASK |
+           IBUS_CONTROL_MASK |
+           IBUS_MOD1_MASK |
+           IBUS_MOD3_MASK |
+           IBUS_MOD4_MASK |
+           IBUS_MOD5_MASK;
+
+    modifiers &= mask;
+    for (i = 0; i < list->len; ++i) {
+        struct KeyEvent* ev = &g_array_index(list, struct KeyEvent, i);
+        if (ev->keyval == keyval && ev->modifiers == modifiers) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+hotkey_list_append(HotkeyList *list, guint keyval, guint modifiers)
+{
+    if (list->keys == NULL)
+        list->keys = g_array_sized_new(FALSE, TRUE, sizeof(struct KeyEvent), 4);
+
+    list->all_modifiers |= modifiers;
+    key_event_list_append(list->keys, keyval, modifiers);
+}
+
+static void
+hotkey_list_append_from_string(HotkeyList *list, const char* str)
+{
+    guint keyval = 0;
+    guint modifiers = 0;
+    gboolean res;
+
+    res = ibus_key_event_from_string(str, &keyval, &modifiers);
+    if (res) {
+	hotkey_list_append(list, keyval, modifiers);
+    }
+}
+
+static void
+hotkey_list_clear(HotkeyList *list)
+{
+    list->all_modifiers = 0;
+    if (list->keys != NULL) {
+        g_array_free(list->keys, TRUE);
+        list->keys = NULL;
+    }
+}
+
+void
+composer_set_hotkeys (ComposerHotkey hotkey, const char *keys)
+{
+    HotkeyList *list = &hotkeys[hotkey];
+    gchar** items = g_strsplit(keys, ",", 0);
+
+    hotkey_list_clear(list);
+
+    if (items != NULL) {
+        int i;
+        for (i = 0; items[i] != NULL; ++i) {
+	    hotkey_list_append_from_string(list, items[i]);
+        }
+        g_strfreev(items);
+    }
+}
+
+void
+composer_clear_hotkeys (void)
+{
+    guint i;
+
+    for (i = 0; i < COMPOSER_N_HOTKEYS; i++)
+        hotkey_list_clear (&hotkeys[i]);
+}
+
+gboolean
+composer_match_hotkey (ComposerHotkey hotkey, guint keyval, guint modifiers)
+{
+    return key_event_list_match(hotkeys[hotkey].keys, keyval, modifiers);
+}
+
+gboolean
+composer_is_hotkey_modifier (ComposerHotkey hotkey, guint keyval)
+{
+    HotkeyList *list = &hotkeys[hotkey];
+
+    if (list->all_modifiers & IBUS_CONTROL_MASK) {
+	if (keyval == IBUS_Control_L || keyval == IBUS_Control_R)
+	    return TRUE;
+    }
+
+    if (list->all_modifiers & IBUS_MOD1_MASK) {
+	if (keyval == IBUS_Alt_L || keyval == IBUS_Alt_R)
+	    return TRUE;
+    }
+
+    if (list->all_modifiers & IBUS_SUPER_MASK) {
+	if (keyval == IBUS_Super_L || keyval == IBUS_Super_R)
+	    return TRUE;
+    }
+
+    if (list->all_modifiers & IBUS_HYPER_MASK) {
+	if (keyval == IBUS_Hyper_L || keyval == IBUS_Hyper_R)
+	    return TRUE;
+    }
+
+    if (list->all_modifiers & IBUS_META_MASK) {
+	if (keyval == IBUS_Meta_L || keyval == IBUS_Meta_R)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
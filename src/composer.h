@@ -0,0 +1,216 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2008-2009 Peng Huang <shawn.p.huang@gmail.com>
+ * Copyright (C) 2009-2011 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __COMPOSER_H__
+#define __COMPOSER_H__
+
+#include <glib.h>
+#include <hangul.h>
+
+#include "lookupmethod.h"
+#include "ustring.h"
+
+/**
+ * ibus-hangul supports 3 preedit modes.
+ */
+typedef enum {
+    /**
+     * @brief zero length preedit mode
+     * An option to use zero length preedit text.
+     * ibus-hangul will utilize surrounding text feature to draw "composing text".
+     * So the "composing text" will not be shown in preedit style but normal text.
+     */
+    PREEDIT_MODE_NONE,
+    /**
+     * @brief syllable preedit mode
+     * An option to use syllable length preedit text.
+     * This option utilizes preedit text feature.
+     */
+    PREEDIT_MODE_SYLLABLE,
+    /**
+     * @brief word preedit mode
+     * An option to use word length preedit text.
+     */
+    PREEDIT_MODE_WORD,
+} ComposerPreeditMode;
+
+/**
+ * What the client should do with the result of a key, in order.
+ */
+typedef enum {
+    /* insert the text at the cursor */
+    COMPOSER_ACTION_COMMIT,
+    /* show the text as preedit, or hide the preedit if it is empty */
+    COMPOSER_ACTION_UPDATE_PREEDIT,
+    /* delete length characters before the cursor */
+    COMPOSER_ACTION_DELETE_BEFORE_CURSOR,
+} ComposerActionType;
+
+typedef struct {
+    ComposerActionType type;
+    guint              offset;      /* of the text in ComposerActions.text */
+    guint              length;      /* of the text, in characters */
+    /* UPDATE_PREEDIT: the characters at the start of the text which are
+     * composed, the rest is the syllable being composed */
+    guint              composed;
+} ComposerAction;
+
+/**
+ * A list of actions. The texts of all the actions are kept in one buffer,
+ * each terminated by 0, so a list can be cleared and used again without
+ * allocating.
+ */
+typedef struct {
+    GArray  *actions;       /* ComposerAction */
+    UString *text;
+} ComposerActions;
+
+ComposerActions* composer_actions_new      (void);
+void             composer_actions_free     (ComposerActions *actions);
+void             composer_actions_clear    (ComposerActions *actions);
+const ucschar*   composer_actions_get_text (ComposerActions      *actions,
+                                            const ComposerAction *action);
+/* Appends the actions of src to dest, merging consecutive commits and
+ * dropping the preedit updates which a later one replaces. Applying dest
+ * leaves the client in the same state as applying both lists in turn. */
+void             composer_actions_merge    (ComposerActions *dest,
+                                            ComposerActions *src);
+
+/**
+ * Returns the text around the cursor, or NULL if the client doesn't
+ * tell it. The text must stay valid until the composer returns.
+ */
+typedef const gchar* (*ComposerSurroundingFunc) (gpointer  user_data,
+                                                 guint    *cursor_pos,
+                                                 guint    *anchor_pos);
+
+/**
+ * The hotkeys which the settings define. They are the same for all
+ * composers.
+ */
+typedef enum {
+    COMPOSER_HOTKEY_SWITCH,
+    COMPOSER_HOTKEY_HANJA,
+    COMPOSER_HOTKEY_ON,
+    COMPOSER_HOTKEY_OFF,
+    COMPOSER_N_HOTKEYS
+} ComposerHotkey;
+
+/**
+ * What a key does to the candidates while they are shown.
+ */
+typedef enum {
+    /* the key is not for the candidates */
+    COMPOSER_CANDIDATE_KEY_NONE,
+    /* close the candidates */
+    COMPOSER_CANDIDATE_KEY_CLOSE,
+    /* commit the candidate at the cursor */
+    COMPOSER_CANDIDATE_KEY_COMMIT,
+    /* commit the nth candidate of the current page */
+    COMPOSER_CANDIDATE_KEY_SELECT,
+    COMPOSER_CANDIDATE_KEY_CURSOR_UP,
+    COMPOSER_CANDIDATE_KEY_CURSOR_DOWN,
+    COMPOSER_CANDIDATE_KEY_PAGE_UP,
+    COMPOSER_CANDIDATE_KEY_PAGE_DOWN,
+} ComposerCandidateKey;
+
+/**
+ * The state machine of composing Hangul: the libhangul context, the
+ * composed text which is not committed yet, the preedit modes, the
+ * hotkeys, and the keys and the commit of hanja candidates. It doesn't
+ * talk to IBus, it only knows its key symbols. Each call which changes
+ * the text appends what the client should do to a list of actions.
+ */
+typedef struct _Composer Composer;
+
+Composer*  composer_new                 (const char          *keyboard);
+void       composer_delete              (Composer            *composer);
+
+void       composer_set_surrounding_func (Composer               *composer,
+                                          ComposerSurroundingFunc func,
+                                          gpointer                user_data);
+
+void       composer_select_keyboard     (Composer            *composer,
+                                         const char          *keyboard);
+void       composer_set_preedit_mode    (Composer            *composer,
+                                         ComposerPreeditMode  mode);
+ComposerPreeditMode
+           composer_get_preedit_mode    (Composer            *composer);
+void       composer_set_hanja_mode      (Composer            *composer,
+                                         gboolean             hanja_mode);
+gboolean   composer_get_hanja_mode      (Composer            *composer);
+gboolean   composer_is_transliteration  (Composer            *composer);
+gboolean   composer_has_preedit         (Composer            *composer);
+guint      composer_get_preedit_length  (Composer            *composer);
+
+/* Drops the text being composed without telling the client. */
+void       composer_reset               (Composer            *composer);
+
+/* Composes a key, which is a keyval of the us qwerty layout. Returns
+ * FALSE if the key is not used, and the client should handle it after
+ * composer_flush(). */
+gboolean   composer_process_key         (Composer            *composer,
+                                         guint                keyval,
+                                         ComposerActions     *actions);
+/* Returns FALSE if there is nothing to delete. */
+gboolean   composer_backspace           (Composer            *composer,
+                                         ComposerActions     *actions);
+void       composer_flush               (Composer            *composer,
+                                         ComposerActions     *actions);
+void       composer_update_preedit      (Composer            *composer,
+                                         ComposerActions     *actions);
+
+/* Tells what keyval does to the candidates, and in nth which candidate
+ * of the page it selects. vertical is the orientation of the table. */
+ComposerCandidateKey
+           composer_get_candidate_key   (Composer            *composer,
+                                         guint                keyval,
+                                         gboolean             vertical,
+                                         guint               *nth);
+/* Replaces key, which was looked up with method, with value. */
+void       composer_commit_candidate    (Composer            *composer,
+                                         const char          *key,
+                                         const char          *value,
+                                         LookupMethod         method,
+                                         ComposerActions     *actions);
+/* Returns the key to look up for the current text, at most
+ * max_key_length characters, and the method in method. */
+gchar*     composer_get_hanja_key       (Composer            *composer,
+                                         guint                max_key_length,
+                                         LookupMethod        *method);
+
+/* Whether libhangul may reorder the jamo of a syllable, for all composers. */
+void       composer_set_auto_reorder    (gboolean             auto_reorder);
+
+/* Sets the keys of hotkey from a comma separated list of key names like
+ * "Hangul,Shift+space", for all composers. */
+void       composer_set_hotkeys         (ComposerHotkey       hotkey,
+                                         const char          *keys);
+void       composer_clear_hotkeys       (void);
+gboolean   composer_match_hotkey        (ComposerHotkey       hotkey,
+                                         guint                keyval,
+                                         guint                modifiers);
+/* Whether keyval is a modifier key which a key of hotkey is used with.
+ * Such a key alone must not flush the preedit, or the hotkey would have
+ * no text to work on. */
+gboolean   composer_is_hotkey_modifier  (ComposerHotkey       hotkey,
+                                         guint                keyval);
+
+#endif /* __COMPOSER_H__ */
@@ -0,0 +1,1136 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "dictionary.h"
+
+/* the index has a bit for each table layer */
+#define DICTIONARY_MAX_INDEXED_LAYERS  32
+/* keys longer than this share the last bucket of the histogram */
+#define DICTIONARY_HISTOGRAM_SIZE      64
+/* a bit for each character of the BMP */
+#define DICTIONARY_FIRST_CHARS_SIZE    (0x10000 / 8)
+/* a file is reloaded when it has not changed for this long */
+#define DICTIONARY_RELOAD_DELAY        500 /* ms */
+
+/**
+ * What the keys of a table look like. Substrings which can't be a key
+ * are rejected with these before they reach the index or the tables.
+ */
+typedef struct {
+    guint       max_key_length;     /* in characters */
+    guint       key_lengths[DICTIONARY_HISTOGRAM_SIZE];
+    guint8      first_chars[DICTIONARY_FIRST_CHARS_SIZE];
+} DictionaryStats;
+
+/**
+ * A layer is shared by the states which have it, and the table is deleted
+ * when the last of them is dropped, which may happen on a worker thread.
+ */
+typedef struct {
+    gint        ref_count;
+    gchar      *path;           /* NULL for the user dictionary */
+    gint        priority;
+    HanjaFile  *table;
+    UserDict   *user_dict;      /* not owned */
+    guint32     bit;            /* 0 if the layer is not in the index */
+    DictionaryStats *stats;     /* NULL if the keys are not known */
+    GArray     *hashes;         /* of the keys, until it is indexed */
+} DictionaryLayer;
+
+typedef struct {
+    guint32     hash;
+    guint32     layers;
+} DictionaryIndexEntry;
+
+/**
+ * A state is never changed once it is published. A change makes a new
+ * state and swaps it in, so a lookup which holds the old one finishes
+ * with it, and the old one is freed when the last lookup drops it.
+ */
+typedef struct {
+    gint        ref_count;
+    GPtrArray  *layers;         /* ordered by priority */
+    GArray     *index;          /* DictionaryIndexEntry sorted by hash */
+    guint32     used_bits;
+    DictionaryStats *stats;     /* of all the tables, NULL if unknown */
+} DictionaryState;
+
+/* A file may be the table of several layers, which share its monitor. */
+typedef struct {
+    Dictionary   *dict;
+    gchar        *path;
+    guint         n_layers;
+    GFileMonitor *monitor;
+    guint         timeout_id;
+} DictionaryMonitor;
+
+/* a table which is loaded by dictionary_load_table(), or reloaded */
+typedef struct {
+    gchar        *path;
+    gint          priority;
+} DictionaryLoad;
+
+struct _Dictionary {
+    GMutex           lock;      /* guards current, not what it points to */
+    DictionaryState *current;
+    GHashTable      *monitors;  /* path -> DictionaryMonitor */
+    GHashTable      *loads;     /* "priority:path" -> GCancellable */
+    GCancellable    *cancellable;
+};
+
+static void dictionary_monitor_start (Dictionary *dict, const char *path);
+static void dictionary_monitor_stop  (Dictionary *dict, const char *path);
+
+/**
+ * The same function as g_str_hash(), for keys which are not nul terminated.
+ * A hash collision only costs a table lookup which finds nothing.
+ */
+static guint32
+dictionary_hash_key (const char *key, gsize len)
+{
+    guint32 h = 5381;
+    gsize i;
+
+    for (i = 0; i < len; i++)
+        h = (h << 5) + h + (guchar) key[i];
+
+    return h;
+}
+
+static gint
+dictionary_compare_hash (gconstpointer a, gconstpointer b)
+{
+    guint32 h1 = *(const guint32*) a;
+    guint32 h2 = *(const guint32*) b;
+
+    return h1 < h2 ? -1 : (h1 > h2 ? 1 : 0);
+}
+
+static DictionaryLayer*
+dictionary_layer_ref (DictionaryLayer *layer)
+{
+    g_atomic_int_inc (&layer->ref_count);
+    return layer;
+}
+
+static void
+dictionary_layer_unref (gpointer data)
+{
+    DictionaryLayer *layer = data;
+
+    if (!g_atomic_int_dec_and_test (&layer->ref_count))
+        return;
+
+    hanja_file_unref (layer->table);
+    if (layer->hashes != NULL)
+        g_array_free (layer->hashes, TRUE);
+    g_free (layer->stats);
+    g_free (layer->path);
+    g_free (layer);
+}
+
+static DictionaryState*
+dictionary_state_new (void)
+{
+    DictionaryState *state = g_new0 (DictionaryState, 1);
+
+    state->ref_count = 1;
+    state->layers = g_ptr_array_new_with_free_func (dictionary_layer_unref);
+    state->index = g_array_new (FALSE, FALSE, sizeof (DictionaryIndexEntry));
+
+    return state;
+}
+
+/**
+ * Makes a state to be changed from the current one. The layers are shared,
+ * the index is copied. The stats are made again when it is published.
+ */
+static DictionaryState*
+dictionary_state_copy (DictionaryState *state)
+{
+    DictionaryState *copy = dictionary_state_new ();
+    guint i;
+
+    for (i = 0; i < state->layers->len; i++) {
+        g_ptr_array_add (copy->layers,
+                dictionary_layer_ref (g_ptr_array_index (state->layers, i)));
+    }
+    g_array_append_vals (copy->index, state->index->data, state->index->len);
+    copy->used_bits = state->used_bits;
+
+    return copy;
+}
+
+static DictionaryState*
+dictionary_state_ref (DictionaryState *state)
+{
+    g_atomic_int_inc (&state->ref_count);
+    return state;
+}
+
+static void
+dictionary_state_unref (DictionaryState *state)
+{
+    if (!g_atomic_int_dec_and_test (&state->ref_count))
+        return;
+
+    g_ptr_array_free (state->layers, TRUE);
+    g_array_free (state->index, TRUE);
+    g_free (state->stats);
+    g_free (state);
+}
+
+static void
+dictionary_monitor_free (gpointer data)
+{
+    DictionaryMonitor *monitor = data;
+
+    if (monitor->timeout_id != 0)
+        g_source_remove (monitor->timeout_id);
+    if (monitor->monitor != NULL) {
+        g_file_monitor_cancel (monitor->monitor);
+        g_object_unref (monitor->monitor);
+    }
+    g_free (monitor->path);
+    g_free (monitor);
+}
+
+Dictionary*
+dictionary_new (void)
+{
+    Dictionary *dict = g_new0 (Dictionary, 1);
+
+    g_mutex_init (&dict->lock);
+    dict->current = dictionary_state_new ();
+    dict->monitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            NULL, dictionary_monitor_free);
+    dict->loads = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, g_object_unref);
+    dict->cancellable = g_cancellable_new ();
+
+    return dict;
+}
+
+void
+dictionary_free (Dictionary *dict)
+{
+    GHashTableIter iter;
+    gpointer cancellable;
+
+    if (dict == NULL)
+        return;
+
+    // The loads and the reloads which are still running see this and drop
+    // what they have loaded.
+    g_cancellable_cancel (dict->cancellable);
+    g_object_unref (dict->cancellable);
+    g_hash_table_iter_init (&iter, dict->loads);
+    while (g_hash_table_iter_next (&iter, NULL, &cancellable))
+        g_cancellable_cancel (cancellable);
+    g_hash_table_destroy (dict->loads);
+
+    g_hash_table_destroy (dict->monitors);
+    dictionary_state_unref (dict->current);
+    g_mutex_clear (&dict->lock);
+    g_free (dict);
+}
+
+/**
+ * Returns the current state with a reference, which the caller drops
+ * when it is done with the state.
+ */
+static DictionaryState*
+dictionary_get_state (Dictionary *dict)
+{
+    DictionaryState *state;
+
+    g_mutex_lock (&dict->lock);
+    state = dictionary_state_ref (dict->current);
+    g_mutex_unlock (&dict->lock);
+
+    return state;
+}
+
+static void dictionary_update_stats (DictionaryState *state);
+
+/**
+ * Swaps state in for the current one, and takes the ownership of it.
+ */
+static void
+dictionary_publish (Dictionary *dict, DictionaryState *state)
+{
+    DictionaryState *old;
+
+    dictionary_update_stats (state);
+
+    g_mutex_lock (&dict->lock);
+    old = dict->current;
+    dict->current = state;
+    g_mutex_unlock (&dict->lock);
+
+    dictionary_state_unref (old);
+}
+
+static void
+dictionary_stats_add_key (DictionaryStats *stats, const gchar *key, gsize len)
+{
+    guint n = g_utf8_strlen (key, len);
+    gunichar c = g_utf8_get_char (key);
+
+    stats->max_key_length = MAX (stats->max_key_length, n);
+    stats->key_lengths[MIN (n, DICTIONARY_HISTOGRAM_SIZE - 1)]++;
+    if (c < 0x10000)
+        stats->first_chars[c / 8] |= 1 << (c % 8);
+}
+
+static void
+dictionary_stats_merge (DictionaryStats *stats, const DictionaryStats *other)
+{
+    guint i;
+
+    stats->max_key_length = MAX (stats->max_key_length,
+                                 other->max_key_length);
+    for (i = 0; i < DICTIONARY_HISTOGRAM_SIZE; i++)
+        stats->key_lengths[i] += other->key_lengths[i];
+    for (i = 0; i < DICTIONARY_FIRST_CHARS_SIZE; i++)
+        stats->first_chars[i] |= other->first_chars[i];
+}
+
+/**
+ * Tells whether any table may have key, which is n characters long.
+ */
+static gboolean
+dictionary_stats_may_have (const DictionaryStats *stats,
+                           const char *key, guint n)
+{
+    gunichar c;
+
+    if (n > stats->max_key_length)
+        return FALSE;
+
+    if (stats->key_lengths[MIN (n, DICTIONARY_HISTOGRAM_SIZE - 1)] == 0)
+        return FALSE;
+
+    c = g_utf8_get_char (key);
+    if (c < 0x10000 && (stats->first_chars[c / 8] & (1 << (c % 8))) == 0)
+        return FALSE;
+
+    return TRUE;
+}
+
+/**
+ * Makes the stats of all the tables again. If the keys of a table are not
+ * known, there are no stats and nothing is rejected.
+ */
+static void
+dictionary_update_stats (DictionaryState *state)
+{
+    guint i;
+
+    g_free (state->stats);
+    state->stats = g_new0 (DictionaryStats, 1);
+
+    for (i = 0; i < state->layers->len; i++) {
+        DictionaryLayer *layer = g_ptr_array_index (state->layers, i);
+
+        if (layer->table == NULL)
+            continue;
+
+        if (layer->stats == NULL) {
+            g_free (state->stats);
+            state->stats = NULL;
+            return;
+        }
+
+        dictionary_stats_merge (state->stats, layer->stats);
+    }
+}
+
+/**
+ * Returns the hashes of the keys of table sorted and unique.
+ * The lengths and the first characters of the keys are counted in stats.
+ */
+static GArray*
+dictionary_scan_keys (HanjaFile *table, DictionaryStats *stats)
+{
+    const char *prev_key = NULL;
+    GArray *hashes;
+    guint size;
+    guint i, n;
+
+    size = hanja_file_get_size (table);
+    hashes = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+    for (i = 0; i < size; i++) {
+        const char *key = hanja_file_get_key (table, i);
+        gsize len;
+        guint32 h;
+
+        // The entries are sorted, so the same keys come together.
+        if (prev_key != NULL && strcmp (key, prev_key) == 0)
+            continue;
+
+        len = strlen (key);
+        h = dictionary_hash_key (key, len);
+        g_array_append_val (hashes, h);
+        dictionary_stats_add_key (stats, key, len);
+        prev_key = key;
+    }
+
+    g_array_sort (hashes, dictionary_compare_hash);
+    for (i = 0, n = 0; i < hashes->len; i++) {
+        guint32 h = g_array_index (hashes, guint32, i);
+        if (n == 0 || g_array_index (hashes, guint32, n - 1) != h)
+            g_array_index (hashes, guint32, n++) = h;
+    }
+    g_array_set_size (hashes, n);
+
+    return hashes;
+}
+
+/**
+ * Merges the sorted hashes of a layer into the index.
+ */
+static void
+dictionary_index_add (DictionaryState *state, GArray *hashes, guint32 bit)
+{
+    GArray *index = state->index;
+    GArray *merged;
+    guint i = 0;
+    guint j = 0;
+
+    merged = g_array_sized_new (FALSE, FALSE, sizeof (DictionaryIndexEntry),
+                                index->len + hashes->len);
+
+    while (i < index->len || j < hashes->len) {
+        DictionaryIndexEntry entry;
+
+        if (j >= hashes->len ||
+            (i < index->len &&
+             g_array_index (index, DictionaryIndexEntry, i).hash <
+             g_array_index (hashes, guint32, j))) {
+            entry = g_array_index (index, DictionaryIndexEntry, i++);
+        } else if (i >= index->len ||
+                   g_array_index (index, DictionaryIndexEntry, i).hash >
+                   g_array_index (hashes, guint32, j)) {
+            entry.hash = g_array_index (hashes, guint32, j++);
+            entry.layers = bit;
+        } else {
+            entry = g_array_index (index, DictionaryIndexEntry, i++);
+            entry.layers |= bit;
+            j++;
+        }
+
+        g_array_append_val (merged, entry);
+    }
+
+    g_array_free (state->index, TRUE);
+    state->index = merged;
+}
+
+static void
+dictionary_index_remove (DictionaryState *state, guint32 bit)
+{
+    GArray *index = state->index;
+    guint i, n;
+
+    for (i = 0, n = 0; i < index->len; i++) {
+        DictionaryIndexEntry entry = g_array_index (index,
+                DictionaryIndexEntry, i);
+        entry.layers &= ~bit;
+        if (entry.layers != 0)
+            g_array_index (index, DictionaryIndexEntry, n++) = entry;
+    }
+    g_array_set_size (index, n);
+}
+
+static guint32
+dictionary_index_lookup (DictionaryState *state, const char *key, gsize len)
+{
+    GArray *index = state->index;
+    guint32 h = dictionary_hash_key (key, len);
+    guint lo = 0;
+    guint hi = index->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        guint32 mid_hash = g_array_index (index, DictionaryIndexEntry, mid).hash;
+
+        if (mid_hash < h)
+            lo = mid + 1;
+        else if (mid_hash > h)
+            hi = mid;
+        else
+            return g_array_index (index, DictionaryIndexEntry, mid).layers;
+    }
+
+    return 0;
+}
+
+static void
+dictionary_insert_layer (DictionaryState *state, DictionaryLayer *layer)
+{
+    guint i;
+
+    for (i = 0; i < state->layers->len; i++) {
+        DictionaryLayer *l = g_ptr_array_index (state->layers, i);
+        if (l->priority > layer->priority)
+            break;
+    }
+
+    g_ptr_array_add (state->layers, NULL);
+    memmove (&state->layers->pdata[i + 1], &state->layers->pdata[i],
+             (state->layers->len - 1 - i) * sizeof (gpointer));
+    state->layers->pdata[i] = layer;
+}
+
+/**
+ * The same file may be added with two priorities, e.g. an extra
+ * dictionary which is also a builtin one, so a layer is found by both.
+ */
+static gint
+dictionary_find_layer (DictionaryState *state,
+                       const char      *path,
+                       gint             priority)
+{
+    guint i;
+
+    for (i = 0; i < state->layers->len; i++) {
+        DictionaryLayer *layer = g_ptr_array_index (state->layers, i);
+        if (layer->path != NULL && layer->priority == priority &&
+            strcmp (layer->path, path) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Makes a table layer and hashes the keys of the table for the index.
+ * It doesn't touch the dictionary, so it may run on any thread.
+ */
+static DictionaryLayer*
+dictionary_layer_new (HanjaFile *table, const char *path, gint priority)
+{
+    DictionaryLayer *layer = g_new0 (DictionaryLayer, 1);
+
+    layer->ref_count = 1;
+    layer->path = g_strdup (path);
+    layer->priority = priority;
+    layer->table = table;
+
+    if (table != NULL) {
+        layer->stats = g_new0 (DictionaryStats, 1);
+        layer->hashes = dictionary_scan_keys (table, layer->stats);
+    }
+
+    return layer;
+}
+
+/**
+ * Puts the keys of a new layer in the index of state. bit is the bit which
+ * the layer had before it was reloaded, or 0 to take a free one.
+ */
+static void
+dictionary_index_layer (DictionaryState *state,
+                        DictionaryLayer *layer,
+                        guint32          bit)
+{
+    if (layer->hashes != NULL && bit == 0 && state->used_bits != G_MAXUINT32) {
+        guint n;
+
+        for (n = 0; n < DICTIONARY_MAX_INDEXED_LAYERS; n++) {
+            if ((state->used_bits & (1u << n)) == 0)
+                break;
+        }
+        bit = 1u << n;
+    }
+
+    if (layer->hashes != NULL && bit != 0) {
+        layer->bit = bit;
+        state->used_bits |= bit;
+        dictionary_index_add (state, layer->hashes, bit);
+    } else {
+        if (bit != 0)
+            state->used_bits &= ~bit;
+        g_debug ("dictionary is not indexed: %s", layer->path);
+    }
+
+    if (layer->hashes != NULL) {
+        g_array_free (layer->hashes, TRUE);
+        layer->hashes = NULL;
+    }
+}
+
+static void
+dictionary_remove_layer (DictionaryState *state, guint i)
+{
+    DictionaryLayer *layer = g_ptr_array_index (state->layers, i);
+
+    if (layer->bit != 0) {
+        dictionary_index_remove (state, layer->bit);
+        state->used_bits &= ~layer->bit;
+    }
+    g_ptr_array_remove_index (state->layers, i);
+}
+
+static void
+dictionary_add_layer (Dictionary *dict, DictionaryLayer *layer)
+{
+    DictionaryState *state;
+
+    state = dictionary_state_copy (dict->current);
+    dictionary_index_layer (state, layer, 0);
+    dictionary_insert_layer (state, layer);
+    dictionary_publish (dict, state);
+
+    if (layer->path != NULL)
+        dictionary_monitor_start (dict, layer->path);
+}
+
+/**
+ * Adds a table layer and takes the ownership of table.
+ * The keys of table are hashed for the index. If the index has no room,
+ * the table is looked up for every substring. The file is watched, and
+ * reloaded when it changes.
+ */
+void
+dictionary_add_table (Dictionary *dict,
+                      HanjaFile  *table,
+                      const char *path,
+                      gint        priority)
+{
+    g_return_if_fail (dict != NULL && table != NULL);
+
+    dictionary_add_layer (dict, dictionary_layer_new (table, path, priority));
+}
+
+static gchar*
+dictionary_load_key (const char *path, gint priority)
+{
+    return g_strdup_printf ("%d:%s", priority, path);
+}
+
+static void
+dictionary_load_thread (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+    DictionaryLoad *load = task_data;
+    HanjaFile *table;
+
+    table = hanja_file_load (load->path);
+    if (table == NULL) {
+        g_task_return_pointer (task, NULL, NULL);
+        return;
+    }
+
+    g_task_return_pointer (task,
+                           dictionary_layer_new (table, load->path,
+                                                 load->priority),
+                           dictionary_layer_unref);
+}
+
+static void
+dictionary_load_done (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+    GTask *task = G_TASK (result);
+    DictionaryLoad *load = g_task_get_task_data (task);
+    Dictionary *dict = user_data;
+    DictionaryLayer *layer;
+    gchar *key;
+
+    // The table was removed, or the dictionary is gone.
+    if (g_cancellable_is_cancelled (g_task_get_cancellable (task)))
+        return;
+
+    key = dictionary_load_key (load->path, load->priority);
+    g_hash_table_remove (dict->loads, key);
+    g_free (key);
+
+    layer = g_task_propagate_pointer (task, NULL);
+    if (layer == NULL) {
+        g_warning ("Can't load dictionary: %s", load->path);
+        return;
+    }
+
+    dictionary_add_layer (dict, layer);
+}
+
+static void
+dictionary_load_free (gpointer data)
+{
+    DictionaryLoad *load = data;
+
+    g_free (load->path);
+    g_free (load);
+}
+
+/**
+ * Loads the table at path on a worker thread, and adds it as
+ * dictionary_add_table() does when it is loaded. The lookups until then
+ * go without it. A warning is printed if it can't be loaded.
+ */
+void
+dictionary_load_table (Dictionary *dict,
+                       const char *path,
+                       gint        priority)
+{
+    DictionaryLoad *load;
+    GCancellable *cancellable;
+    GTask *task;
+    gchar *key;
+
+    g_return_if_fail (dict != NULL && path != NULL);
+
+    // A table which is still loaded is loaded again, it may have changed.
+    key = dictionary_load_key (path, priority);
+    cancellable = g_hash_table_lookup (dict->loads, key);
+    if (cancellable != NULL)
+        g_cancellable_cancel (cancellable);
+
+    load = g_new0 (DictionaryLoad, 1);
+    load->path = g_strdup (path);
+    load->priority = priority;
+
+    cancellable = g_cancellable_new ();
+    g_hash_table_replace (dict->loads, key, cancellable);
+
+    task = g_task_new (NULL, cancellable, dictionary_load_done, dict);
+    g_task_set_task_data (task, load, dictionary_load_free);
+    g_task_run_in_thread (task, dictionary_load_thread);
+    g_object_unref (task);
+}
+
+/**
+ * Removes the table which was added with path and priority, or cancels
+ * its load. Returns FALSE if there is no such table.
+ */
+gboolean
+dictionary_remove_table (Dictionary *dict, const char *path, gint priority)
+{
+    DictionaryState *state;
+    GCancellable *cancellable;
+    gchar *key;
+    gint i;
+
+    g_return_val_if_fail (dict != NULL && path != NULL, FALSE);
+
+    key = dictionary_load_key (path, priority);
+    cancellable = g_hash_table_lookup (dict->loads, key);
+    if (cancellable != NULL) {
+        g_cancellable_cancel (cancellable);
+        g_hash_table_remove (dict->loads, key);
+        g_free (key);
+        return TRUE;
+    }
+    g_free (key);
+
+    i = dictionary_find_layer (dict->current, path, priority);
+    if (i < 0)
+        return FALSE;
+
+    dictionary_monitor_stop (dict, path);
+
+    state = dictionary_state_copy (dict->current);
+    dictionary_remove_layer (state, i);
+    dictionary_publish (dict, state);
+
+    return TRUE;
+}
+
+/**
+ * Replaces the layer of the same path and priority with the one which is
+ * loaded on the worker thread. The lookups which hold the old state keep
+ * the old table.
+ */
+static void
+dictionary_reload_done (GObject      *source_object,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+    GTask *task = G_TASK (result);
+    Dictionary *dict = user_data;
+    DictionaryLayer *layer;
+    DictionaryLayer *old;
+    DictionaryState *state;
+    gint i;
+
+    // The dictionary is gone if the task is cancelled.
+    if (g_cancellable_is_cancelled (g_task_get_cancellable (task)))
+        return;
+
+    layer = g_task_propagate_pointer (task, NULL);
+    if (layer == NULL) {
+        DictionaryLoad *load = g_task_get_task_data (task);
+        g_warning ("Failed to reload dictionary: %s", load->path);
+        return;
+    }
+
+    // It may have been removed while it was loaded.
+    i = dictionary_find_layer (dict->current, layer->path, layer->priority);
+    if (i < 0) {
+        dictionary_layer_unref (layer);
+        return;
+    }
+
+    old = g_ptr_array_index (dict->current->layers, i);
+
+    state = dictionary_state_copy (dict->current);
+    if (old->bit != 0)
+        dictionary_index_remove (state, old->bit);
+    g_ptr_array_remove_index (state->layers, i);
+    dictionary_index_layer (state, layer, old->bit);
+    dictionary_insert_layer (state, layer);
+    dictionary_publish (dict, state);
+
+    g_debug ("dictionary is reloaded: %s", layer->path);
+}
+
+static gboolean
+dictionary_monitor_on_timeout (gpointer user_data)
+{
+    DictionaryMonitor *monitor = user_data;
+    DictionaryState *state = monitor->dict->current;
+    guint i;
+
+    monitor->timeout_id = 0;
+
+    // Each layer of the file has its own table.
+    for (i = 0; i < state->layers->len; i++) {
+        DictionaryLayer *layer = g_ptr_array_index (state->layers, i);
+        DictionaryLoad *load;
+        GTask *task;
+
+        if (layer->path == NULL || strcmp (layer->path, monitor->path) != 0)
+            continue;
+
+        load = g_new0 (DictionaryLoad, 1);
+        load->path = g_strdup (layer->path);
+        load->priority = layer->priority;
+
+        task = g_task_new (NULL, monitor->dict->cancellable,
+                           dictionary_reload_done, monitor->dict);
+        g_task_set_task_data (task, load, dictionary_load_free);
+        g_task_run_in_thread (task, dictionary_load_thread);
+        g_object_unref (task);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+dictionary_monitor_on_changed (GFileMonitor      *file_monitor,
+                               GFile             *file,
+                               GFile             *other_file,
+                               GFileMonitorEvent  event_type,
+                               gpointer           user_data)
+{
+    DictionaryMonitor *monitor = user_data;
+
+    // A file which is rewritten in place ends with CHANGES_DONE_HINT, and
+    // one which is replaced by a rename shows up as CREATED. A deleted
+    // file is not reloaded, the table in memory is kept.
+    if (event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+        event_type != G_FILE_MONITOR_EVENT_CREATED)
+        return;
+
+    // Package managers and editors write a file in several steps, so it is
+    // loaded once after they are done.
+    if (monitor->timeout_id != 0)
+        g_source_remove (monitor->timeout_id);
+    monitor->timeout_id = g_timeout_add (DICTIONARY_RELOAD_DELAY,
+                                         dictionary_monitor_on_timeout,
+                                         monitor);
+}
+
+static void
+dictionary_monitor_start (Dictionary *dict, const char *path)
+{
+    DictionaryMonitor *monitor;
+    GFile *file;
+    GError *error = NULL;
+
+    monitor = g_hash_table_lookup (dict->monitors, path);
+    if (monitor != NULL) {
+        monitor->n_layers++;
+        return;
+    }
+
+    monitor = g_new0 (DictionaryMonitor, 1);
+    monitor->dict = dict;
+    monitor->path = g_strdup (path);
+    monitor->n_layers = 1;
+
+    file = g_file_new_for_path (path);
+    monitor->monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE,
+                                            NULL, &error);
+    g_object_unref (file);
+
+    if (monitor->monitor == NULL) {
+        g_debug ("Failed to watch dictionary %s: %s", path, error->message);
+        g_clear_error (&error);
+    } else {
+        g_signal_connect (monitor->monitor, "changed",
+                          G_CALLBACK (dictionary_monitor_on_changed), monitor);
+    }
+
+    g_hash_table_insert (dict->monitors, monitor->path, monitor);
+}
+
+/* The file is not watched any more when its last layer is removed. */
+static void
+dictionary_monitor_stop (Dictionary *dict, const char *path)
+{
+    DictionaryMonitor *monitor;
+
+    monitor = g_hash_table_lookup (dict->monitors, path);
+    if (monitor != NULL && --monitor->n_layers == 0)
+        g_hash_table_remove (dict->monitors, path);
+}
+
+/**
+ * Sets the user dictionary layer. The dictionary doesn't own user_dict.
+ */
+void
+dictionary_set_user_dict (Dictionary *dict,
+                          UserDict   *user_dict,
+                          gint        priority)
+{
+    DictionaryState *state;
+    DictionaryLayer *layer;
+    guint i;
+
+    g_return_if_fail (dict != NULL);
+
+    state = dictionary_state_copy (dict->current);
+
+    for (i = 0; i < state->layers->len; i++) {
+        layer = g_ptr_array_index (state->layers, i);
+        if (layer->user_dict != NULL) {
+            g_ptr_array_remove_index (state->layers, i);
+            break;
+        }
+    }
+
+    if (user_dict != NULL) {
+        layer = g_new0 (DictionaryLayer, 1);
+        layer->ref_count = 1;
+        layer->priority = priority;
+        layer->user_dict = user_dict;
+        dictionary_insert_layer (state, layer);
+    }
+
+    dictionary_publish (dict, state);
+}
+
+static guint
+dictionary_state_get_max_key_length (DictionaryState *state)
+{
+    guint i;
+    guint n;
+
+    if (state->stats == NULL)
+        return G_MAXUINT;
+
+    n = state->stats->max_key_length;
+    for (i = 0; i < state->layers->len; i++) {
+        DictionaryLayer *layer = g_ptr_array_index (state->layers, i);
+        if (layer->user_dict != NULL)
+            n = MAX (n, user_dict_get_max_key_length (layer->user_dict));
+    }
+
+    return n;
+}
+
+/**
+ * Returns the length of the longest key of all the layers in characters,
+ * or G_MAXUINT if it is not known.
+ */
+guint
+dictionary_get_max_key_length (Dictionary *dict)
+{
+    DictionaryState *state;
+    guint n;
+
+    if (dict == NULL)
+        return 0;
+
+    state = dictionary_get_state (dict);
+    n = dictionary_state_get_max_key_length (state);
+    dictionary_state_unref (state);
+
+    return n;
+}
+
+/**
+ * Makes the substrings of key which the method matches, in the same order
+ * as libhangul does: the longest first. The substrings share one buffer.
+ * Those longer than max_len characters are left out.
+ */
+static GPtrArray*
+dictionary_get_substrings (const char *key, LookupMethod method,
+                           guint max_len, gchar **buffer)
+{
+    GPtrArray *substrings = g_ptr_array_new ();
+    glong len = g_utf8_strlen (key, -1);
+    gchar *end;
+    gchar *p;
+
+    switch (method) {
+    case LOOKUP_METHOD_EXACT:
+        *buffer = g_strdup (key);
+        if (len <= max_len)
+            g_ptr_array_add (substrings, *buffer);
+        break;
+    case LOOKUP_METHOD_PREFIX:
+        // "abc" -> "abc\0ab\0a\0"
+        *buffer = g_malloc (strlen (key) * (strlen (key) + 3) / 2 + 1);
+        p = *buffer;
+        if (len > max_len)
+            end = g_utf8_offset_to_pointer (key, max_len);
+        else
+            end = (gchar*) key + strlen (key);
+        while (end > key) {
+            memcpy (p, key, end - key);
+            p[end - key] = '\0';
+            g_ptr_array_add (substrings, p);
+            p += end - key + 1;
+            end = g_utf8_prev_char (end);
+        }
+        break;
+    case LOOKUP_METHOD_SUFFIX:
+        *buffer = g_strdup (key);
+        p = *buffer;
+        if (len > max_len)
+            p = g_utf8_offset_to_pointer (p, len - max_len);
+        for (; *p != '\0'; p = g_utf8_next_char (p))
+            g_ptr_array_add (substrings, p);
+        break;
+    default:
+        *buffer = NULL;
+        break;
+    }
+
+    return substrings;
+}
+
+static void
+dictionary_append_user_entry (const char *key,
+                              const char *value,
+                              guint       count,
+                              gpointer    user_data)
+{
+    candidate_list_append ((CandidateList*) user_data, key, value, NULL);
+}
+
+/**
+ * Looks up all the layers. The candidates are ordered by the priority of
+ * the layers, then by the length of the matched key like libhangul does,
+ * and the same key and value pair is shown only once.
+ * Returns NULL if nothing is found.
+ */
+CandidateList*
+dictionary_lookup (Dictionary *dict, const char *key, LookupMethod method)
+{
+    DictionaryState *state;
+    CandidateList *candidates;
+    GPtrArray *substrings;
+    gchar *buffer = NULL;
+    guint32 *masks;
+    gboolean *rejected;
+    guint i, j;
+
+    if (dict == NULL || key == NULL || key[0] == '\0')
+        return NULL;
+
+    // The state may be swapped while this runs, the one taken here is used
+    // until the end.
+    state = dictionary_get_state (dict);
+
+    substrings = dictionary_get_substrings (key, method,
+            dictionary_state_get_max_key_length (state), &buffer);
+
+    // One probe of the index tells which tables have each substring.
+    // The lengths and the first characters of the keys reject most of
+    // the substrings before that.
+    masks = g_new (guint32, substrings->len);
+    rejected = g_new0 (gboolean, substrings->len);
+    for (j = 0; j < substrings->len; j++) {
+        const char *s = g_ptr_array_index (substrings, j);
+
+        if (state->stats != NULL &&
+            !dictionary_stats_may_have (state->stats, s,
+                                        g_utf8_strlen (s, -1))) {
+            masks[j] = 0;
+            rejected[j] = TRUE;
+            continue;
+        }
+
+        masks[j] = dictionary_index_lookup (state, s, strlen (s));
+    }
+
+    candidates = candidate_list_new ();
+    for (i = 0; i < state->layers->len; i++) {
+        DictionaryLayer *layer = g_ptr_array_index (state->layers, i);
+
+        for (j = 0; j < substrings->len; j++) {
+            const char *s = g_ptr_array_index (substrings, j);
+
+            if (layer->user_dict != NULL) {
+                user_dict_match_exact (layer->user_dict, s,
+                        dictionary_append_user_entry, candidates);
+            } else if (rejected[j]) {
+                continue;
+            } else if (layer->bit == 0 || (masks[j] & layer->bit) != 0) {
+                guint first, n;
+
+                if (hanja_file_match_exact (layer->table, s, &first, &n))
+                    candidate_list_append_hanja_file (candidates,
+                            layer->table, first, n);
+            }
+        }
+    }
+
+    dictionary_state_unref (state);
+
+    g_free (masks);
+    g_free (rejected);
+    g_free (buffer);
+    g_ptr_array_free (substrings, TRUE);
+
+    if (candidate_list_get_size (candidates) == 0) {
+        candidate_list_delete (candidates);
+        return NULL;
+    }
+
+    return candidates;
+}
@@ -0,0 +1,75 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __DICTIONARY_H__
+#define __DICTIONARY_H__
+
+#include <glib.h>
+
+#include "candidate.h"
+#include "hanjafile.h"
+#include "lookupmethod.h"
+#include "userdict.h"
+
+/**
+ * Priorities of the dictionary layers. A layer with a smaller value is
+ * looked up first, and its candidates are shown first.
+ */
+enum {
+    DICTIONARY_PRIORITY_USER    = 0,
+    DICTIONARY_PRIORITY_EXTRA   = 100,
+    DICTIONARY_PRIORITY_SYMBOL  = 200,
+    DICTIONARY_PRIORITY_HANJA   = 300,
+};
+
+/**
+ * An ordered stack of dictionaries which is looked up as one.
+ * The keys of all the table layers are kept in one index, so a lookup
+ * probes the index once for each substring of the key, and goes to the
+ * tables which actually have the substring.
+ * A lookup may run on any thread while the layers are changed.
+ * The files of the table layers are watched, and a file which changes is
+ * loaded again on a worker thread and swapped in for the old table.
+ */
+typedef struct _Dictionary Dictionary;
+
+Dictionary*    dictionary_new           (void);
+void           dictionary_free          (Dictionary  *dict);
+
+void           dictionary_add_table     (Dictionary  *dict,
+                                         HanjaFile   *table,
+                                         const char  *path,
+                                         gint         priority);
+void           dictionary_load_table    (Dictionary  *dict,
+                                         const char  *path,
+                                         gint         priority);
+gboolean       dictionary_remove_table  (Dictionary  *dict,
+                                         const char  *path,
+                                         gint         priority);
+void           dictionary_set_user_dict (Dictionary  *dict,
+                                         UserDict    *user_dict,
+                                         gint         priority);
+
+guint          dictionary_get_max_key_length (Dictionary *dict);
+
+CandidateList* dictionary_lookup        (Dictionary  *dict,
+                                         const char  *key,
+                                         LookupMethod method);
+
+#endif
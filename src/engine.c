@@ -32,12 +32,20 @@
 #include "i18n.h"
 #include "engine.h"
 #include "ustring.h"
+#include "memstat.h"
+#include "candidate.h"
+#include "userdict.h"
+#include "dictionary.h"
+#include "composer.h"
+#include "trace.h"
+#include "stats.h"
 
 
 typedef struct _IBusHangulEngine IBusHangulEngine;
 typedef struct _IBusHangulEngineClass IBusHangulEngineClass;
 
-typedef struct _HotkeyList HotkeyList;
+typedef struct _SettingsEntry SettingsEntry;
+typedef struct _SettingsSchema SettingsSchema;
 
 enum {
     INPUT_MODE_HANGUL,
@@ -45,30 +53,6 @@ enum {
     INPUT_MODE_COUNT,
 };
 
-/**
- * ibus-hangul supports 3 preedit modes.
- */
-typedef enum {
-    /**
-     * @brief zero length preedit mode
-     * An option to use zero length preedit text.
-     * ibus-hangul will utilize surrounding text feature to draw "composing text".
-     * So the "composing text" will not be shown in preedit style but normal text.
-     */
-    PREEDIT_MODE_NONE,
-    /**
-     * @brief syllable preedit mode
-     * An option to use syllable length preedit text.
-     * This option utilizes preedit text feature.
-     */
-    PREEDIT_MODE_SYLLABLE,
-    /**
-     * @brief word preedit mode
-     * An option to use word length preedit text.
-     */
-    PREEDIT_MODE_WORD,
-} IBusHangulPreeditMode;
-
 struct _IBusHangulEngine {
     IBusEngineSimple parent;
 
@@ -76,45 +60,103 @@ struct _IBusHangulEngine {
     /* unique context id */
     guint id;
 
-    HangulInputContext *context;
-    UString* preedit;
-    /* Every instance's preedit_mode may be different from global settings.
-     * So we need a value for each instance. */
-    IBusHangulPreeditMode preedit_mode;
+    /* the composition, with the preedit mode and the hanja mode */
+    Composer *composer;
+    /* the last surrounding text given to the composer */
+    gchar *surrounding;
     int input_mode;
     unsigned int input_purpose;
-    gboolean hanja_mode;
-    HanjaList* hanja_list;
-    int last_lookup_method;
+    CandidateList* hanja_list;
+    LookupMethod last_lookup_method;
+    /* increased by every lookup request and cancel, see
+     * ibus_hangul_engine_update_lookup_table() */
+    gint lookup_generation;
+    /* a lookup was started and neither done nor canceled yet */
+    gboolean lookup_pending;
+    /* the shown candidates were released, see focus_in() */
+    gboolean restore_lookup;
 
     guint caps;
+    /* created on the first hanja lookup, see
+     * ibus_hangul_engine_get_lookup_table() */
     IBusLookupTable *table;
+    /* releases the table and the candidates of an unfocused instance */
+    guint            idle_release_id;
+
+    /* when the last key was pressed, in monotonic microseconds */
+    gint64           last_key_time;
+    /* the key came within burst_interval of the one before */
+    gboolean         in_burst;
+    /* the actions of the keys of a burst, merged and applied at once from
+     * burst_flush_id, see ibus_hangul_engine_defer_actions() */
+    ComposerActions *burst;
+    guint            burst_flush_id;
 
     IBusProperty    *prop_hangul_mode;
     IBusProperty    *prop_hanja_mode;
     IBusPropList    *prop_list;
 
-    IBusText        *input_mode_symbols[INPUT_MODE_COUNT];
+    /* bytes accounted to memstat by this instance */
+    gsize            mem_preedit;
+    gsize            mem_hanja_list;
+    gsize            mem_lookup_table;
 };
 
 struct _IBusHangulEngineClass {
     IBusEngineSimpleClass parent;
 };
 
-struct KeyEvent {
-    guint keyval;
-    guint modifiers;
+/**
+ * A hanja lookup which runs on lookup_pool.
+ * The result is used only if no other lookup was requested or canceled
+ * in the meantime, and the key is still the same.
+ */
+typedef struct {
+    IBusHangulEngine *hangul;
+    gchar            *key;
+    LookupMethod      method;
+    gint              generation;
+    /* the dictionary was looked up, the lookup was not superseded */
+    gboolean          searched;
+    CandidateList    *result;
+} HanjaLookup;
+
+/**
+ * Per instance resources which are expensive to create.
+ * When an engine instance is destroyed, its resources are kept in
+ * engine_pool and handed to the next instance after a cheap reset.
+ * IBus clients like web browsers and terminals create and destroy
+ * input contexts very frequently.
+ */
+typedef struct _EngineResources EngineResources;
+
+struct _EngineResources {
+    Composer           *composer;
+    IBusLookupTable    *table;      /* may be NULL */
+    IBusProperty       *prop_hangul_mode;
+    IBusProperty       *prop_hanja_mode;
+    IBusPropList       *prop_list;
 };
 
-struct _HotkeyList {
-    guint   all_modifiers;
-    GArray *keys;
+typedef void (*SettingsHandler) (GVariant *value);
+
+struct _SettingsEntry {
+    const gchar     *key;
+    SettingsHandler  handler;
 };
 
-enum {
-    LOOKUP_METHOD_EXACT,
-    LOOKUP_METHOD_PREFIX,
-    LOOKUP_METHOD_SUFFIX,
+/**
+ * Settings of a schema which ibus-hangul watches.
+ * There is one "changed" handler for each schema in the process.
+ * It finds the setter of the changed key with the key's quark and
+ * runs it once, whatever the number of engine instances.
+ */
+struct _SettingsSchema {
+    const gchar         *schema_id;
+    const SettingsEntry *entries;
+    guint                n_entries;
+    GSettings           *settings;
+    GHashTable          *handlers;
 };
 
 /* functions prototype */
@@ -176,16 +218,29 @@ static void ibus_hangul_engine_set_content_type
                                              guint                   hints);
 
 static void ibus_hangul_engine_flush        (IBusHangulEngine       *hangul);
-static void ibus_hangul_engine_clear_preedit_text
+static void ibus_hangul_engine_update_memstat
                                             (IBusHangulEngine       *hangul);
 static void ibus_hangul_engine_update_preedit_text
                                             (IBusHangulEngine       *hangul);
-static void ibus_hangul_engine_process_commit_and_edit
+static void ibus_hangul_engine_apply_actions
                                             (IBusHangulEngine       *hangul);
+static void ibus_hangul_engine_flush_burst  (IBusHangulEngine       *hangul);
+static const gchar* ibus_hangul_engine_get_surrounding
+                                            (gpointer                user_data,
+                                             guint                  *cursor_pos,
+                                             guint                  *anchor_pos);
 
+static void ibus_hangul_engine_cancel_lookup
+                                            (IBusHangulEngine       *hangul);
 static void ibus_hangul_engine_update_lookup_table
                                             (IBusHangulEngine       *hangul);
-static gboolean ibus_hangul_engine_has_preedit
+static void ibus_hangul_lookup_thread      (gpointer                data,
+                                             gpointer                user_data);
+static void ibus_hangul_engine_lookup_done (HanjaLookup            *lookup);
+static gboolean ibus_hangul_engine_lookups_done
+                                            (gpointer                data);
+static void ibus_hangul_lookup_free        (HanjaLookup            *lookup);
+static void ibus_hangul_engine_finish_lookup
                                             (IBusHangulEngine       *hangul);
 static void ibus_hangul_engine_switch_input_mode
                                             (IBusHangulEngine       *hangul);
@@ -193,61 +248,47 @@ static void ibus_hangul_engine_set_input_mode
                                             (IBusHangulEngine       *hangul,
                                              int                     input_mode);
 static IBusText*
-            ibus_hangul_engine_get_input_mode_symbol
-                                            (IBusHangulEngine       *hangul,
-                                             int                     input_mode);
-
-static bool ibus_hangul_engine_on_transition
-                                            (HangulInputContext     *hic,
-                                             ucschar                 c,
-                                             const ucschar          *preedit,
-                                             void                   *data);
+            ibus_hangul_get_input_mode_symbol
+                                            (int                     input_mode);
 
 static void        settings_changed         (GSettings              *settings,
                                              const gchar            *key,
                                              gpointer                user_data);
+static void        settings_schema_init     (SettingsSchema *schema);
+static void        settings_schema_fini     (SettingsSchema *schema);
 
 static void        lookup_table_set_visible (IBusLookupTable        *table,
                                              gboolean                flag);
 static gboolean        lookup_table_is_visible
                                             (IBusLookupTable        *table);
+static void        lookup_table_set_candidates
+                                            (IBusLookupTable        *table,
+                                             CandidateList          *list);
+static void        lookup_table_drop_candidates
+                                            (IBusLookupTable        *table);
 
-static gboolean key_event_list_match        (GArray                 *list,
-                                             guint                   keyval,
-                                             guint                   modifiers);
-
-static void     hotkey_list_init            (HotkeyList           *list);
-static void     hotkey_list_fini            (HotkeyList           *list);
-static void     hotkey_list_set_from_string (HotkeyList         *list,
-                                             const char             *str);
-static void     hotkey_list_append          (HotkeyList           *list,
-                                             guint                   keyval,
-                                             guint                   modifiers);
-static gboolean hotkey_list_match           (HotkeyList           *list,
-                                             guint                   keyval,
-                                             guint                   modifiers);
-static gboolean hotkey_list_has_modifier    (HotkeyList           *list,
-                                             guint                   keyval);
-
-static glong ucschar_strlen (const ucschar* str);
+static void     engine_resources_free       (EngineResources        *res);
 
 static gint ibus_version[3] = { IBUS_MAJOR_VERSION, IBUS_MINOR_VERSION, IBUS_MICRO_VERSION };
 
 static IBusEngineSimpleClass *parent_class = NULL;
 static guint last_context_id = 0;
-static HanjaTable *hanja_table = NULL;
-static HanjaTable *symbol_table = NULL;
-static GSettings *settings_hangul = NULL;
-static GSettings *settings_panel = NULL;
+static Dictionary *dictionary = NULL;
+static UserDict   *user_dict = NULL;
+static GThreadPool *lookup_pool = NULL;
+// The lookups which are done, and the idle source which applies them.
+// The lookup threads add to the queue, so both are under the mutex.
+static GMutex       lookups_done_mutex;
+static GQueue       lookups_done = G_QUEUE_INIT;
+static guint        lookups_done_id = 0;
+// The actions of the composer, shared by all engines. They are applied
+// before the composer returns to the main loop.
+static ComposerActions *actions = NULL;
+static gchar     **extra_dictionaries = NULL;
 static GString    *hangul_keyboard = NULL;
-static HotkeyList hanja_keys;
-static HotkeyList switch_keys;
-static HotkeyList on_keys;
-static HotkeyList off_keys;
 static int lookup_table_orientation = 0;
 static IBusKeymap *keymap = NULL;
 static gboolean word_commit = FALSE;
-static gboolean auto_reorder = TRUE;
 static gboolean disable_latin_mode = FALSE;
 static int initial_input_mode = INPUT_MODE_LATIN;
 /**
@@ -263,20 +304,80 @@ static gboolean use_client_commit = FALSE;
 
 /**
  * global preedit mode
- * This option may have a value, one of the IBusHangulPreeditMode.
+ * This option may have a value, one of the ComposerPreeditMode.
  * See: https://github.com/libhangul/ibus-hangul/issues/69
  */
-static IBusHangulPreeditMode global_preedit_mode = PREEDIT_MODE_SYLLABLE;
+static ComposerPreeditMode global_preedit_mode = PREEDIT_MODE_SYLLABLE;
 
+/**
+ * The most characters before the cursor which are looked up in the
+ * dictionaries for the suffix lookup. It is less if no key is that long.
+ */
+#define HANJA_SUFFIX_MAX_WINDOW  32
+
+/* Counts a key event by the path it takes, and tells the tracer. */
+#define KEY_PATH(path) G_STMT_START {                           \
+    stats_count_key (path);                                     \
+    TRACE1 (key_event_path, stats_key_path_name (path));        \
+} G_STMT_END
+
+/**
+ * Seconds after which an unfocused instance releases its lookup table
+ * and candidate list. 0 disables it.
+ */
+static guint idle_release_timeout = 300;
+
+/**
+ * Milliseconds between two key presses under which the second one is
+ * taken as a part of a burst: a script, a barcode reader or a replay of
+ * a remote desktop. 0 disables it.
+ */
+static guint burst_interval = 8;
+
+/* estimated sizes of the opaque objects for memory accounting */
+#define HANJA_LIST_BASE_SIZE    (4 * sizeof (gpointer))
+#define LOOKUP_TABLE_BASE_SIZE  (8 * sizeof (gpointer))
+
+/* IBusEngineSimple class, which owns the compose tables */
+static gpointer engine_simple_class = NULL;
+
+/* ibus_hangul_load() was called */
+static gboolean loaded = FALSE;
+
+/**
+ * live engine registry
+ * Engines add themselves on init and remove themselves on destroy.
+ * The registry does not hold references, so it never keeps an engine
+ * alive and never contains a destroyed one.
+ */
+static GHashTable *live_engines = NULL;
+
+static SettingsSchema hangul_settings;
+static SettingsSchema panel_settings;
+
+/**
+ * engine resource pool
+ * The resources of destroyed engines are recycled through this queue.
+ * The counters show how often a new engine could reuse pooled resources.
+ */
+#define ENGINE_POOL_MAX_SIZE 16
+static GQueue  engine_pool = G_QUEUE_INIT;
+static guint64 engine_pool_hits = 0;
+static guint64 engine_pool_misses = 0;
+static guint64 engine_pool_drops = 0;
+
+/**
+ * Immutable property texts and symbols.
+ * These are created once per process in ibus_hangul_init() and shared by
+ * all engine instances. Only the property state is per instance.
+ */
+static IBusText     *input_mode_symbols[INPUT_MODE_COUNT];
+static IBusText     *hangul_mode_label = NULL;
+static IBusText     *hangul_mode_tooltip = NULL;
+static IBusText     *hanja_mode_label = NULL;
+static IBusText     *hanja_mode_tooltip = NULL;
+static IBusProperty *prop_setup = NULL;
 
-static glong
-ucschar_strlen (const ucschar* str)
-{
-    const ucschar* p = str;
-    while (*p != 0)
-        p++;
-    return p - str;
-}
 
 static void
 check_ibus_version ()
@@ -385,126 +486,203 @@ ibus_hangul_engine_get_type (void)
     return type;
 }
 
-void
-ibus_hangul_init (IBusBus *bus)
+static IBusText*
+shared_text_new (const gchar *str)
 {
-    GVariant* value = NULL;
+    IBusText *text = ibus_text_new_from_string (str);
+    g_object_ref_sink (text);
+    return text;
+}
 
-    last_context_id = 0;
+static void
+ibus_hangul_init_shared_properties (void)
+{
+    IBusText* label;
+    IBusText* tooltip;
 
-    hanja_table = hanja_table_load (NULL);
+    input_mode_symbols[INPUT_MODE_HANGUL] = shared_text_new ("한");
+    input_mode_symbols[INPUT_MODE_LATIN] = shared_text_new ("EN");
 
-    symbol_table = hanja_table_load (IBUSHANGUL_DATADIR "/data/symbol.txt");
+    hangul_mode_label = shared_text_new (_("Hangul mode"));
+    hangul_mode_tooltip = shared_text_new (_("Enable/Disable Hangul mode"));
+    hanja_mode_label = shared_text_new (_("Hanja lock"));
+    hanja_mode_tooltip = shared_text_new (_("Enable/Disable Hanja mode"));
 
-    check_ibus_version ();
+    // The setup property has no state, so every engine can register
+    // the same object.
+    label = ibus_text_new_from_string (_("Setup"));
+    tooltip = ibus_text_new_from_string (_("Configure hangul engine"));
+    prop_setup = ibus_property_new ("setup",
+                                    PROP_TYPE_NORMAL,
+                                    label,
+                                    "gtk-preferences",
+                                    tooltip,
+                                    TRUE, TRUE, PROP_STATE_UNCHECKED, NULL);
+    g_object_ref_sink (prop_setup);
+}
 
-    settings_hangul = g_settings_new ("org.freedesktop.ibus.engine.hangul");
-    settings_panel = g_settings_new ("org.freedesktop.ibus.panel");
+static void
+ibus_hangul_fini_shared_properties (void)
+{
+    int i;
 
-    hangul_keyboard = g_string_new_len (NULL, 8);
-    value = g_settings_get_value (settings_hangul, "hangul-keyboard");
-    if (value != NULL) {
-        const gchar* str = g_variant_get_string (value, NULL);
-        g_string_assign (hangul_keyboard, str);
-        g_clear_pointer (&value, g_variant_unref);
+    for (i = 0; i < INPUT_MODE_COUNT; ++i) {
+        g_clear_object (&input_mode_symbols[i]);
     }
 
-    hotkey_list_init(&switch_keys);
+    g_clear_object (&hangul_mode_label);
+    g_clear_object (&hangul_mode_tooltip);
+    g_clear_object (&hanja_mode_label);
+    g_clear_object (&hanja_mode_tooltip);
+    g_clear_object (&prop_setup);
+}
 
-    value = g_settings_get_value (settings_hangul, "switch-keys");
-    if (value != NULL) {
-        const gchar* str = g_variant_get_string (value, NULL);
-        hotkey_list_set_from_string(&switch_keys, str);
-        g_clear_pointer (&value, g_variant_unref);
-    } else {
-        hotkey_list_append(&switch_keys, IBUS_Hangul, 0);
-        hotkey_list_append(&switch_keys, IBUS_space, IBUS_SHIFT_MASK);
+/**
+ * Loads the hanja dictionary which libhangul loads by default. The comments
+ * stay in the file until they are shown.
+ * libhangul doesn't tell where the file is, so it is looked for where
+ * pkg-config said libhangul keeps its data, and then in the system data
+ * directories, in case libhangul was installed elsewhere after we were
+ * built.
+ */
+static HanjaFile*
+ibus_hangul_load_hanja_table (gchar **path)
+{
+    const gchar* const* dirs;
+    HanjaFile* table;
+    guint i;
+
+    table = hanja_file_load (LIBHANGUL_HANJA_PATH);
+    if (table != NULL) {
+        *path = g_strdup (LIBHANGUL_HANJA_PATH);
+        return table;
+    }
+
+    dirs = g_get_system_data_dirs ();
+    for (i = 0; dirs[i] != NULL; i++) {
+        gchar* filename = g_build_filename (dirs[i], "libhangul", "hanja",
+                                            "hanja.txt", NULL);
+        if (strcmp (filename, LIBHANGUL_HANJA_PATH) != 0) {
+            table = hanja_file_load (filename);
+            if (table != NULL) {
+                *path = filename;
+                return table;
+            }
+        }
+        g_free (filename);
     }
 
-    hotkey_list_init(&hanja_keys);
+    return NULL;
+}
 
-    value = g_settings_get_value (settings_hangul, "hanja-keys");
-    if (value != NULL) {
-        const gchar* str = g_variant_get_string (value, NULL);
-        hotkey_list_set_from_string(&hanja_keys, str);
-        g_clear_pointer (&value, g_variant_unref);
-    } else {
-        hotkey_list_append(&hanja_keys, IBUS_Hangul_Hanja, 0);
-        hotkey_list_append(&hanja_keys, IBUS_F9, 0);
-    }
+/**
+ * Loads the user dictionary into the dictionary. The fuzzer goes without
+ * one: what an input selects would change the candidates of the next
+ * inputs, and a crash could not be replayed alone.
+ */
+static void
+ibus_hangul_load_user_dict (void)
+{
+#ifndef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+    gchar* user_dir;
 
-    hotkey_list_init (&on_keys);
-    value = g_settings_get_value (settings_hangul, "on-keys");
-    if (value != NULL) {
-        const gchar* str = g_variant_get_string (value, NULL);
-        hotkey_list_set_from_string (&on_keys, str);
-        g_clear_pointer (&value, g_variant_unref);
-    }
+    user_dir = g_build_filename (g_get_user_data_dir (), "ibus-hangul", NULL);
+    user_dict = user_dict_new (user_dir);
+    dictionary_set_user_dict (dictionary, user_dict, DICTIONARY_PRIORITY_USER);
+    g_free (user_dir);
+#endif
+}
 
-    hotkey_list_init (&off_keys);
-    value = g_settings_get_value (settings_hangul, "off-keys");
-    if (value != NULL) {
-        const gchar* str = g_variant_get_string (value, NULL);
-        hotkey_list_set_from_string (&off_keys, str);
-        g_clear_pointer (&value, g_variant_unref);
-    }
+/**
+ * Loads what only the engines use: the dictionaries, the compose tables,
+ * the settings and the keymap. Many sessions start the component and
+ * never type Korean, so it is done when the first engine is created,
+ * not in ibus_hangul_init(). The factory calls it before it creates the
+ * first engine; the engines call it too, for the tests.
+ */
+void
+ibus_hangul_load (void)
+{
+    gsize heap_size;
+    HanjaFile* hanja_table;
+    gchar* hanja_path = NULL;
+    HanjaFile* symbol_table;
+    gint64 start;
 
-    value = g_settings_get_value (settings_hangul, "word-commit");
-    if (value != NULL) {
-        word_commit = g_variant_get_boolean (value);
-        g_clear_pointer (&value, g_variant_unref);
-    }
+    if (loaded)
+        return;
+    loaded = TRUE;
 
-    value = g_settings_get_value (settings_hangul, "auto-reorder");
-    if (value != NULL) {
-        auto_reorder = g_variant_get_boolean (value);
-        g_clear_pointer (&value, g_variant_unref);
-    }
+    start = g_get_monotonic_time ();
 
-    value = g_settings_get_value (settings_hangul, "disable-latin-mode");
-    if (value != NULL) {
-        disable_latin_mode = g_variant_get_boolean (value);
-        g_clear_pointer (&value, g_variant_unref);
-    }
+    hanja_table = ibus_hangul_load_hanja_table (&hanja_path);
 
-    value = g_settings_get_value (settings_hangul, "initial-input-mode");
-    if (value != NULL) {
-        const gchar* str = g_variant_get_string (value, NULL);
-        if (strcmp(str, "latin") == 0) {
-            initial_input_mode = INPUT_MODE_LATIN;
-        } else if (strcmp(str, "hangul") == 0) {
-            initial_input_mode = INPUT_MODE_HANGUL;
-        }
-        g_clear_pointer (&value, g_variant_unref);
+    dictionary = dictionary_new ();
+    if (hanja_table != NULL) {
+        memstat_add (MEMSTAT_HANJA_TABLE,
+                     hanja_file_get_memory_size (hanja_table), 1);
+        dictionary_add_table (dictionary, hanja_table, hanja_path,
+                              DICTIONARY_PRIORITY_HANJA);
+        g_free (hanja_path);
+    } else {
+        g_warning ("Can't load the hanja dictionary of libhangul: %s",
+                   LIBHANGUL_HANJA_PATH);
+    }
+
+    symbol_table = hanja_file_load (IBUSHANGUL_DATADIR "/data/symbol.txt");
+    if (symbol_table != NULL) {
+        memstat_add (MEMSTAT_SYMBOL_TABLE,
+                     hanja_file_get_memory_size (symbol_table), 1);
+        dictionary_add_table (dictionary, symbol_table,
+                              IBUSHANGUL_DATADIR "/data/symbol.txt",
+                              DICTIONARY_PRIORITY_SYMBOL);
+    }
+
+    // IBusEngineSimple loads its builtin compose table when its class
+    // is initialized. The heap delta is its size only if no engine has
+    // been created yet: once an engine exists, the class is already
+    // there and the table isn't counted.
+    if (g_type_class_peek (IBUS_TYPE_ENGINE_SIMPLE) == NULL) {
+        heap_size = memstat_heap_size ();
+        engine_simple_class = g_type_class_ref (IBUS_TYPE_ENGINE_SIMPLE);
+        memstat_add (MEMSTAT_COMPOSE_TABLE,
+                     (gssize) (memstat_heap_size () - heap_size), 1);
+    } else {
+        engine_simple_class = g_type_class_ref (IBUS_TYPE_ENGINE_SIMPLE);
     }
 
-    value = g_settings_get_value (settings_hangul, "use-event-forwarding");
-    if (value != NULL) {
-        use_event_forwarding = g_variant_get_boolean (value);
-        g_clear_pointer (&value, g_variant_unref);
-    }
+    ibus_hangul_load_user_dict ();
 
-    value = g_settings_get_value (settings_hangul, "preedit-mode");
-    if (value != NULL) {
-        const gchar* str = g_variant_get_string (value, NULL);
-        if (strcmp(str, "none") == 0) {
-            global_preedit_mode = PREEDIT_MODE_NONE;
-        } else if (strcmp(str, "word") == 0) {
-            global_preedit_mode = PREEDIT_MODE_WORD;
-        } else {
-            global_preedit_mode = PREEDIT_MODE_SYLLABLE;
-        }
-        g_clear_pointer (&value, g_variant_unref);
-    }
+    check_ibus_version ();
+    use_client_commit = check_client_commit ();
 
-    value = g_settings_get_value (settings_panel, "lookup-table-orientation");
-    if (value != NULL) {
-        lookup_table_orientation = g_variant_get_int32(value);
-        g_clear_pointer (&value, g_variant_unref);
-    }
+    ibus_hangul_init_shared_properties ();
+
+    // The extra dictionaries of the settings go to the dictionary.
+    settings_schema_init (&hangul_settings);
+    settings_schema_init (&panel_settings);
 
     keymap = ibus_keymap_get("us");
-    use_client_commit = check_client_commit ();
+
+    g_debug ("load: %" G_GINT64_FORMAT " us",
+             g_get_monotonic_time () - start);
+}
+
+void
+ibus_hangul_init (IBusBus *bus)
+{
+    last_context_id = 0;
+    loaded = FALSE;
+
+    // One thread is enough; a new request makes the queued ones stale.
+    // It doesn't start a thread before the first lookup.
+    lookup_pool = g_thread_pool_new (ibus_hangul_lookup_thread, NULL,
+                                     1, FALSE, NULL);
+
+    live_engines = g_hash_table_new (g_direct_hash, g_direct_equal);
+    actions = composer_actions_new ();
+
+    hangul_keyboard = g_string_new_len (NULL, 8);
 
     g_debug ("init");
 }
@@ -519,22 +697,60 @@ ibus_hangul_exit (void)
 	keymap = NULL;
     }
 
-    hotkey_list_fini (&switch_keys);
-    hotkey_list_fini (&hanja_keys);
-    hotkey_list_fini (&on_keys);
-    hotkey_list_fini (&off_keys);
+    composer_clear_hotkeys ();
+
+    // Let the queued lookups finish before the dictionary goes away.
+    if (lookup_pool != NULL) {
+        g_thread_pool_free (lookup_pool, FALSE, TRUE);
+        lookup_pool = NULL;
+    }
+
+    // The main loop has stopped, so the results which came after it
+    // won't be applied. They hold a reference to their engine.
+    g_mutex_lock (&lookups_done_mutex);
+    if (lookups_done_id != 0) {
+        g_source_remove (lookups_done_id);
+        lookups_done_id = 0;
+    }
+    g_queue_clear_full (&lookups_done, (GDestroyNotify) ibus_hangul_lookup_free);
+    g_mutex_unlock (&lookups_done_mutex);
+
+    dictionary_free (dictionary);
+    dictionary = NULL;
+
+    g_strfreev (extra_dictionaries);
+    extra_dictionaries = NULL;
+
+    user_dict_free (user_dict);
+    user_dict = NULL;
+
+    memstat_add (MEMSTAT_HANJA_TABLE,
+                 -(gssize) memstat_get_bytes (MEMSTAT_HANJA_TABLE), -1);
+    memstat_add (MEMSTAT_SYMBOL_TABLE,
+                 -(gssize) memstat_get_bytes (MEMSTAT_SYMBOL_TABLE), -1);
+
+    if (engine_simple_class != NULL) {
+        g_type_class_unref (engine_simple_class);
+        engine_simple_class = NULL;
+    }
+
+    g_debug ("engine pool: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT
+             " misses, %" G_GUINT64_FORMAT " drops",
+             engine_pool_hits, engine_pool_misses, engine_pool_drops);
+    g_queue_clear_full (&engine_pool, (GDestroyNotify) engine_resources_free);
 
-    hanja_table_delete (hanja_table);
-    hanja_table = NULL;
+    ibus_hangul_fini_shared_properties ();
 
-    hanja_table_delete (symbol_table);
-    symbol_table = NULL;
+    settings_schema_fini (&hangul_settings);
+    settings_schema_fini (&panel_settings);
 
-    g_clear_object (&settings_hangul);
-    g_clear_object (&settings_panel);
+    g_clear_pointer (&live_engines, g_hash_table_destroy);
+    g_clear_pointer (&actions, composer_actions_free);
 
     g_string_free (hangul_keyboard, TRUE);
     hangul_keyboard = NULL;
+
+    loaded = FALSE;
 }
 
 /*
@@ -586,82 +802,137 @@ ibus_hangul_engine_class_init (IBusHangulEngineClass *klass)
 }
 
 static void
-ibus_hangul_engine_init (IBusHangulEngine *hangul)
+engine_resources_free (EngineResources *res)
+{
+    g_object_unref (res->prop_hangul_mode);
+    g_object_unref (res->prop_hanja_mode);
+    g_object_unref (res->prop_list);
+    if (res->table != NULL)
+        g_object_unref (res->table);
+    composer_delete (res->composer);
+    g_slice_free (EngineResources, res);
+}
+
+static void
+ibus_hangul_engine_create_resources (IBusHangulEngine *hangul)
 {
     IBusProperty* prop;
-    IBusText* label;
-    IBusText* tooltip;
     IBusText* symbol;
 
-    hangul->id = last_context_id;
-    ++last_context_id;
-
-    hangul->context = hangul_ic_new (hangul_keyboard->str);
-    hangul_ic_connect_callback (hangul->context, "transition",
-                                ibus_hangul_engine_on_transition, hangul);
-
-    hangul->preedit = ustring_new();
-    hangul->preedit_mode = global_preedit_mode;
-    hangul->hanja_list = NULL;
-    hangul->input_mode = initial_input_mode;
-    hangul->input_purpose = IBUS_INPUT_PURPOSE_FREE_FORM;
-    hangul->hanja_mode = FALSE;
-    hangul->last_lookup_method = LOOKUP_METHOD_PREFIX;
-    hangul->caps = 0;
-
-    if (disable_latin_mode) {
-        hangul->input_mode = INPUT_MODE_HANGUL;
-    }
+    hangul->composer = composer_new (hangul_keyboard->str);
+    composer_set_surrounding_func (hangul->composer,
+                                   ibus_hangul_engine_get_surrounding, hangul);
 
     hangul->prop_list = ibus_prop_list_new ();
     g_object_ref_sink (hangul->prop_list);
 
-    label = ibus_text_new_from_string (_("Hangul mode"));
-    tooltip = ibus_text_new_from_string (_("Enable/Disable Hangul mode"));
     prop = ibus_property_new ("InputMode",
                               PROP_TYPE_TOGGLE,
-                              label,
+                              hangul_mode_label,
                               NULL,
-                              tooltip,
+                              hangul_mode_tooltip,
                               TRUE, TRUE, PROP_STATE_UNCHECKED, NULL);
-    symbol = ibus_hangul_engine_get_input_mode_symbol (hangul,
-                                                       hangul->input_mode);
+    symbol = ibus_hangul_get_input_mode_symbol (hangul->input_mode);
     ibus_property_set_symbol(prop, symbol);
     g_object_ref_sink (prop);
     ibus_prop_list_append (hangul->prop_list, prop);
     hangul->prop_hangul_mode = prop;
 
-    label = ibus_text_new_from_string (_("Hanja lock"));
-    tooltip = ibus_text_new_from_string (_("Enable/Disable Hanja mode"));
     prop = ibus_property_new ("hanja_mode",
                               PROP_TYPE_TOGGLE,
-                              label,
+                              hanja_mode_label,
                               NULL,
-                              tooltip,
+                              hanja_mode_tooltip,
                               TRUE, TRUE, PROP_STATE_UNCHECKED, NULL);
     g_object_ref_sink (prop);
     ibus_prop_list_append (hangul->prop_list, prop);
     hangul->prop_hanja_mode = prop;
 
-    label = ibus_text_new_from_string (_("Setup"));
-    tooltip = ibus_text_new_from_string (_("Configure hangul engine"));
-    prop = ibus_property_new ("setup",
-                              PROP_TYPE_NORMAL,
-                              label,
-                              "gtk-preferences",
-                              tooltip,
-                              TRUE, TRUE, PROP_STATE_UNCHECKED, NULL);
-    ibus_prop_list_append (hangul->prop_list, prop);
+    ibus_prop_list_append (hangul->prop_list, prop_setup);
+}
 
-    hangul->table = ibus_lookup_table_new (9, 0, TRUE, FALSE);
-    g_object_ref_sink (hangul->table);
+/**
+ * Takes over the resources of a destroyed engine and resets them to
+ * the state which ibus_hangul_engine_create_resources() would make.
+ */
+static void
+ibus_hangul_engine_reuse_resources (IBusHangulEngine *hangul,
+                                    EngineResources  *res)
+{
+    IBusText* symbol;
 
-    g_signal_connect (settings_hangul, "changed",
-                      G_CALLBACK (settings_changed), hangul);
-    g_signal_connect (settings_panel, "changed",
-                      G_CALLBACK (settings_changed), hangul);
+    hangul->composer = res->composer;
+    hangul->table = res->table;
+    hangul->prop_hangul_mode = res->prop_hangul_mode;
+    hangul->prop_hanja_mode = res->prop_hanja_mode;
+    hangul->prop_list = res->prop_list;
+    g_slice_free (EngineResources, res);
+
+    composer_reset (hangul->composer);
+    composer_select_keyboard (hangul->composer, hangul_keyboard->str);
+    composer_set_surrounding_func (hangul->composer,
+                                   ibus_hangul_engine_get_surrounding, hangul);
+
+    if (hangul->table != NULL) {
+        ibus_lookup_table_clear (hangul->table);
+        ibus_lookup_table_set_cursor_pos (hangul->table, 0);
+        lookup_table_set_visible (hangul->table, FALSE);
+    }
 
-    g_debug ("context new:%u", hangul->id);
+    symbol = ibus_hangul_get_input_mode_symbol (hangul->input_mode);
+    ibus_property_set_symbol (hangul->prop_hangul_mode, symbol);
+    ibus_property_set_state (hangul->prop_hangul_mode, PROP_STATE_UNCHECKED);
+    ibus_property_set_state (hangul->prop_hanja_mode, PROP_STATE_UNCHECKED);
+}
+
+static void
+ibus_hangul_engine_init (IBusHangulEngine *hangul)
+{
+    EngineResources *res;
+
+    ibus_hangul_load ();
+
+    hangul->id = last_context_id;
+    ++last_context_id;
+
+    hangul->hanja_list = NULL;
+    hangul->input_mode = initial_input_mode;
+    hangul->input_purpose = IBUS_INPUT_PURPOSE_FREE_FORM;
+    hangul->last_lookup_method = LOOKUP_METHOD_PREFIX;
+    hangul->caps = 0;
+    hangul->last_key_time = 0;
+    hangul->in_burst = FALSE;
+
+    if (disable_latin_mode) {
+        hangul->input_mode = INPUT_MODE_HANGUL;
+    }
+
+    res = g_queue_pop_head (&engine_pool);
+    if (res != NULL) {
+        ibus_hangul_engine_reuse_resources (hangul, res);
+        engine_pool_hits++;
+    } else {
+        ibus_hangul_engine_create_resources (hangul);
+        engine_pool_misses++;
+    }
+
+    composer_set_preedit_mode (hangul->composer, global_preedit_mode);
+    composer_set_hanja_mode (hangul->composer, FALSE);
+
+    g_hash_table_add (live_engines, hangul);
+    stats_set_live_contexts (g_hash_table_size (live_engines));
+
+    memstat_add (MEMSTAT_ENGINE, sizeof (IBusHangulEngine), 1);
+    if (hangul->table != NULL) {
+        memstat_update (MEMSTAT_LOOKUP_TABLE, &hangul->mem_lookup_table,
+                        LOOKUP_TABLE_BASE_SIZE);
+    }
+    ibus_hangul_engine_update_memstat (hangul);
+
+    g_debug ("context new:%u (pool %s, hits:%" G_GUINT64_FORMAT
+             " misses:%" G_GUINT64_FORMAT ")",
+             hangul->id, res != NULL ? "hit" : "miss",
+             engine_pool_hits, engine_pool_misses);
 }
 
 static GObject*
@@ -682,11 +953,64 @@ ibus_hangul_engine_constructor (GType                   type,
 static void
 ibus_hangul_engine_destroy (IBusHangulEngine *hangul)
 {
-    int i;
-    IBusText **symbols;
-
     g_debug ("context delete:%u", hangul->id);
 
+    if (live_engines != NULL) {
+        g_hash_table_remove (live_engines, hangul);
+        stats_set_live_contexts (g_hash_table_size (live_engines));
+    }
+
+    // Drop the result of the pending lookup.
+    ibus_hangul_engine_cancel_lookup (hangul);
+
+    if (hangul->idle_release_id != 0) {
+        g_source_remove (hangul->idle_release_id);
+        hangul->idle_release_id = 0;
+    }
+
+    // The client is gone, so is the text the burst would go to.
+    if (hangul->burst_flush_id != 0) {
+        g_source_remove (hangul->burst_flush_id);
+        hangul->burst_flush_id = 0;
+    }
+    g_clear_pointer (&hangul->burst, composer_actions_free);
+    g_clear_pointer (&hangul->surrounding, g_free);
+
+    memstat_add (MEMSTAT_ENGINE, -(gssize) sizeof (IBusHangulEngine), -1);
+    memstat_update (MEMSTAT_PREEDIT, &hangul->mem_preedit, 0);
+    memstat_update (MEMSTAT_HANJA_LIST, &hangul->mem_hanja_list, 0);
+    memstat_update (MEMSTAT_LOOKUP_TABLE, &hangul->mem_lookup_table, 0);
+
+    if (hangul->hanja_list != NULL) {
+        candidate_list_delete (hangul->hanja_list);
+        hangul->hanja_list = NULL;
+    }
+
+    if (hangul->composer != NULL && hangul->prop_list != NULL) {
+        if (g_queue_get_length (&engine_pool) < ENGINE_POOL_MAX_SIZE) {
+            EngineResources *res = g_slice_new (EngineResources);
+
+            // Don't keep the candidates of a dead context.
+            if (hangul->table != NULL)
+                lookup_table_drop_candidates (hangul->table);
+
+            res->composer = hangul->composer;
+            res->table = hangul->table;
+            res->prop_hangul_mode = hangul->prop_hangul_mode;
+            res->prop_hanja_mode = hangul->prop_hanja_mode;
+            res->prop_list = hangul->prop_list;
+            g_queue_push_head (&engine_pool, res);
+
+            hangul->composer = NULL;
+            hangul->table = NULL;
+            hangul->prop_hangul_mode = NULL;
+            hangul->prop_hanja_mode = NULL;
+            hangul->prop_list = NULL;
+        } else {
+            engine_pool_drops++;
+        }
+    }
+
     if (hangul->prop_hangul_mode) {
         g_object_unref (hangul->prop_hangul_mode);
         hangul->prop_hangul_mode = NULL;
@@ -702,79 +1026,71 @@ ibus_hangul_engine_destroy (IBusHangulEngine *hangul)
         hangul->prop_list = NULL;
     }
 
-    if (hangul->preedit != NULL) {
-        ustring_delete (hangul->preedit);
-        hangul->preedit = NULL;
-    }
-
     if (hangul->table) {
         g_object_unref (hangul->table);
         hangul->table = NULL;
     }
 
-    if (hangul->context) {
-        hangul_ic_delete (hangul->context);
-        hangul->context = NULL;
-    }
-
-    symbols = hangul->input_mode_symbols;
-    for (i = 0; i < INPUT_MODE_COUNT; ++i) {
-        if (symbols[i] != NULL) {
-            g_object_unref(symbols[i]);
-            symbols[i] = NULL;
-        }
+    if (hangul->composer) {
+        composer_delete (hangul->composer);
+        hangul->composer = NULL;
     }
 
     IBUS_OBJECT_CLASS (parent_class)->destroy ((IBusObject *)hangul);
 }
 
 /**
- * @brief a function to check whether the caret has moved
- *
- * An ibus client should inform to the engine that the caret has moved
- * by calling reset method. But many implementations don't follow this rule.
- * So we need to check whether the caret pos is changed.
- * If so, we will reset the context.
- *
- * Usually we don't need this function. Only when the preedit mode is
- * PREEDIT_MODE_NONE, it is critical to have same surrounding text and
- * internal cached preedit text.
+ * Updates the memory accounting of the per context data
+ * which changes while the user types.
  */
 static void
-ibus_hangul_engine_check_caret_pos_sanity (IBusHangulEngine *hangul)
+ibus_hangul_engine_update_memstat (IBusHangulEngine *hangul)
 {
-    size_t preedit_len = ustring_length (hangul->preedit);
-    if (preedit_len == 0)
-        return;
+    gsize bytes;
 
-    IBusText* ibus_text = NULL;
-    guint cursor_pos = 0;
-    guint anchor_pos = 0;
-    ibus_engine_get_surrounding_text ((IBusEngine *)hangul,
-            &ibus_text, &cursor_pos, &anchor_pos);
-
-    const gchar* text = ibus_text_get_text (ibus_text);
-    if (text == NULL || cursor_pos == 0)
-        return;
+    bytes = 0;
+    if (hangul->composer != NULL) {
+        bytes = sizeof (UString) +
+            (composer_get_preedit_length (hangul->composer) + 1) *
+            sizeof (ucschar);
+    }
+    memstat_update (MEMSTAT_PREEDIT, &hangul->mem_preedit, bytes);
 
-    const gchar* text_on_cursor = g_utf8_offset_to_pointer (text, cursor_pos - 1);
-    gchar* preedit_utf8 = ustring_to_utf8 (hangul->preedit, -1);
-    if (preedit_utf8 == NULL) {
-        g_object_unref (ibus_text);
-        return;
+    bytes = 0;
+    if (hangul->hanja_list != NULL) {
+        bytes = HANJA_LIST_BASE_SIZE +
+            candidate_list_get_size (hangul->hanja_list) * sizeof (gpointer);
     }
+    memstat_update (MEMSTAT_HANJA_LIST, &hangul->mem_hanja_list, bytes);
+}
 
-    size_t n = strlen(preedit_utf8);
-    // Ok, Just comparing text value is not perfect. But any other idea?
-    if (strncmp(preedit_utf8, text_on_cursor, n) != 0) {
-        // If the text_on_cursor is different from preedit cache, there's a possibility
-        // that the cursor was moved by the user. Then we need to reset the context.
-        hangul_ic_reset (hangul->context);
-        ustring_clear (hangul->preedit);
+gchar*
+ibus_hangul_get_memory_report (void)
+{
+    GString* report = g_string_new (NULL);
+    GHashTableIter iter;
+    gpointer key;
+
+    memstat_report (report);
+
+    if (live_engines != NULL) {
+        g_string_append_printf (report, "%u live contexts, %u pooled\n",
+                                g_hash_table_size (live_engines),
+                                g_queue_get_length (&engine_pool));
+
+        g_hash_table_iter_init (&iter, live_engines);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+            IBusHangulEngine *hangul = (IBusHangulEngine *) key;
+            g_string_append_printf (report,
+                    "context %u: preedit %" G_GSIZE_FORMAT
+                    " hanja list %" G_GSIZE_FORMAT
+                    " lookup table %" G_GSIZE_FORMAT "\n",
+                    hangul->id, hangul->mem_preedit,
+                    hangul->mem_hanja_list, hangul->mem_lookup_table);
+        }
     }
-    g_free (preedit_utf8);
 
-    g_object_unref (ibus_text);
+    return g_string_free (report, FALSE);
 }
 
 static void
@@ -786,142 +1102,209 @@ ibus_hangul_engine_update_preedit_mode (IBusHangulEngine *hangul)
         // preedit mode of this instance to PREEDIT_MODE_SYLLABLE.
         // Because without surrounding text feature, users cannot see "composing text".
         // This is pretty inconvenient for korean users.
-        hangul->preedit_mode = PREEDIT_MODE_SYLLABLE;
+        composer_set_preedit_mode (hangul->composer, PREEDIT_MODE_SYLLABLE);
     } else {
-        hangul->preedit_mode = global_preedit_mode;
+        composer_set_preedit_mode (hangul->composer, global_preedit_mode);
     }
 }
 
-static void
-ibus_hangul_engine_clear_preedit_text (IBusHangulEngine *hangul)
+static const gchar*
+ibus_hangul_engine_get_surrounding (gpointer  user_data,
+                                    guint    *cursor_pos,
+                                    guint    *anchor_pos)
 {
-    IBusText *text;
+    IBusHangulEngine *hangul = (IBusHangulEngine *) user_data;
+    IBusText* ibus_text = NULL;
+
+    ibus_engine_get_surrounding_text ((IBusEngine *) hangul, &ibus_text,
+            cursor_pos, anchor_pos);
+    if (ibus_text == NULL)
+        return NULL;
 
-    text = ibus_text_new_from_static_string ("");
-    ibus_engine_update_preedit_text ((IBusEngine *)hangul, text, 0, FALSE);
+    // The client may replace the text of the engine while the composer
+    // still uses it, so the composer gets a copy which lives until the
+    // next call.
+    g_free (hangul->surrounding);
+    hangul->surrounding = g_strdup (ibus_text_get_text (ibus_text));
+    g_object_unref (ibus_text);
+
+    return hangul->surrounding;
 }
 
+/**
+ * Sends what the composer asked for to the client, in order, and
+ * empties the list.
+ */
 static void
-ibus_hangul_engine_update_preedit_text (IBusHangulEngine *hangul)
+ibus_hangul_engine_emit_actions (IBusHangulEngine *hangul,
+                                 ComposerActions  *list)
 {
-    const ucschar *hic_preedit;
-    IBusText *text;
-    UString *preedit;
-    gint preedit_len;
+    IBusEngine *engine = (IBusEngine *)hangul;
+    guint i;
 
-    if (hangul->preedit_mode == PREEDIT_MODE_NONE) {
-        return;
-    }
+    for (i = 0; i < list->actions->len; i++) {
+        const ComposerAction *action;
+        const ucschar *str;
+        IBusText *text;
 
-    // ibus-hangul's preedit string is made up of ibus context's
-    // internal preedit string and libhangul's preedit string.
-    // libhangul only supports one syllable preedit string.
-    // In order to make longer preedit string, ibus-hangul maintains
-    // internal preedit string.
-    hic_preedit = hangul_ic_get_preedit_string (hangul->context);
-
-    preedit = ustring_dup (hangul->preedit);
-    preedit_len = ustring_length(preedit);
-    ustring_append_ucs4 (preedit, hic_preedit, -1);
-
-    if (ustring_length(preedit) > 0) {
-	IBusPreeditFocusMode preedit_option = IBUS_ENGINE_PREEDIT_COMMIT;
-
-	if (hangul->hanja_list != NULL)
-	    preedit_option = IBUS_ENGINE_PREEDIT_CLEAR;
-
-        text = ibus_text_new_from_ucs4 ((gunichar*)preedit->data);
-        // ibus-hangul's internal preedit string
-        ibus_text_append_attribute (text, IBUS_ATTR_TYPE_UNDERLINE,
-                IBUS_ATTR_UNDERLINE_SINGLE, 0, preedit_len);
-        // Preedit string from libhangul context.
-        // This is currently composing syllable.
-        ibus_text_append_attribute (text, IBUS_ATTR_TYPE_FOREGROUND,
-                0x00ffffff, preedit_len, -1);
-        ibus_text_append_attribute (text, IBUS_ATTR_TYPE_BACKGROUND,
-                0x00000000, preedit_len, -1);
-        ibus_engine_update_preedit_text_with_mode ((IBusEngine *)hangul,
-                                                   text,
-                                                   ibus_text_get_length (text),
-                                                   TRUE,
-                                                   preedit_option);
-    } else {
-        text = ibus_text_new_from_static_string ("");
-        ibus_engine_update_preedit_text ((IBusEngine *)hangul, text, 0, FALSE);
+        action = &g_array_index (list->actions, ComposerAction, i);
+        str = composer_actions_get_text (list, action);
+
+        switch (action->type) {
+        case COMPOSER_ACTION_COMMIT:
+            TRACE1 (commit, action->length);
+            stats_add (STATS_COMMITS, 1);
+            text = ibus_text_new_from_ucs4 ((gunichar*)str);
+            ibus_engine_commit_text (engine, text);
+            break;
+        case COMPOSER_ACTION_DELETE_BEFORE_CURSOR:
+            TRACE1 (delete_surrounding, action->length);
+            ibus_engine_delete_surrounding_text (engine,
+                    -(gint)action->length, action->length);
+            break;
+        case COMPOSER_ACTION_UPDATE_PREEDIT:
+            TRACE2 (preedit_update, action->length, action->composed);
+            stats_add (STATS_PREEDIT_UPDATES, 1);
+            if (action->length > 0) {
+                IBusPreeditFocusMode preedit_option = IBUS_ENGINE_PREEDIT_COMMIT;
+
+                if (hangul->hanja_list != NULL)
+                    preedit_option = IBUS_ENGINE_PREEDIT_CLEAR;
+
+                text = ibus_text_new_from_ucs4 ((gunichar*)str);
+                // ibus-hangul's internal preedit string
+                ibus_text_append_attribute (text, IBUS_ATTR_TYPE_UNDERLINE,
+                        IBUS_ATTR_UNDERLINE_SINGLE, 0, action->composed);
+                // Preedit string from libhangul context.
+                // This is currently composing syllable.
+                ibus_text_append_attribute (text, IBUS_ATTR_TYPE_FOREGROUND,
+                        0x00ffffff, action->composed, -1);
+                ibus_text_append_attribute (text, IBUS_ATTR_TYPE_BACKGROUND,
+                        0x00000000, action->composed, -1);
+                ibus_engine_update_preedit_text_with_mode (engine,
+                                                           text,
+                                                           action->length,
+                                                           TRUE,
+                                                           preedit_option);
+            } else {
+                text = ibus_text_new_from_static_string ("");
+                ibus_engine_update_preedit_text (engine, text, 0, FALSE);
+            }
+            break;
+        }
     }
 
-    ustring_delete(preedit);
+    composer_actions_clear (list);
 }
 
+/**
+ * Applies the actions of the composer, after the ones of the burst
+ * before, so the client gets them in the order of the keys.
+ */
 static void
-ibus_hangul_engine_process_commit_and_edit (IBusHangulEngine *hangul)
+ibus_hangul_engine_apply_actions (IBusHangulEngine *hangul)
 {
-    // commit current commit_text + preedit_text
-    const ucschar *hic_commit_text = hangul_ic_get_commit_string (hangul->context);
-    const ucschar *hic_preedit_text = hangul_ic_get_preedit_string (hangul->context);
+    ibus_hangul_engine_flush_burst (hangul);
+    ibus_hangul_engine_emit_actions (hangul, actions);
+}
 
-    UString *commit_text = ustring_new ();
-    ustring_append_ucs4 (commit_text, hic_commit_text, -1);
-    ustring_append_ucs4 (commit_text, hic_preedit_text, -1);
+static void
+ibus_hangul_engine_flush_burst (IBusHangulEngine *hangul)
+{
+    if (hangul->burst_flush_id != 0) {
+        g_source_remove (hangul->burst_flush_id);
+        hangul->burst_flush_id = 0;
+    }
 
-    // commit only when the final result is different from preedit text cache
-    if (ustring_compare (commit_text, hangul->preedit) != 0) {
-        IBusEngine *engine = (IBusEngine *)hangul;
+    if (hangul->burst != NULL && hangul->burst->actions->len > 0) {
+        g_debug ("burst:%u: %u actions", hangul->id,
+                 hangul->burst->actions->len);
+        ibus_hangul_engine_emit_actions (hangul, hangul->burst);
+    }
+}
 
-        // remove composing text
-        guint preedit_text_len = ustring_length (hangul->preedit);
-        ibus_engine_delete_surrounding_text (engine, -preedit_text_len, preedit_text_len);
+static gboolean
+ibus_hangul_engine_burst_idle (gpointer user_data)
+{
+    IBusHangulEngine *hangul = (IBusHangulEngine *) user_data;
 
-        const ucschar *s = ustring_begin (commit_text);
-        IBusText *text = ibus_text_new_from_ucs4 (s);
-        ibus_engine_commit_text (engine, text);
-    }
+    hangul->burst_flush_id = 0;
+    ibus_hangul_engine_flush_burst (hangul);
 
-    ustring_delete (commit_text);
+    return G_SOURCE_REMOVE;
+}
 
-    // update preedit_text cache
-    ustring_clear (hangul->preedit);
-    ustring_append_ucs4 (hangul->preedit, hic_preedit_text, -1);
+/**
+ * Keeps the actions of a key of a burst and merges them with the ones of
+ * the keys before. They are applied when the main loop has dispatched
+ * the key events which are already queued, or before anything else is
+ * sent to the client.
+ *
+ * Only the preedit modes which don't read the surrounding text take part:
+ * the client's text is behind while the actions are kept.
+ */
+static guint
+count_preedit_updates (ComposerActions *list)
+{
+    guint i, n = 0;
+
+    for (i = 0; i < list->actions->len; i++) {
+        if (g_array_index (list->actions, ComposerAction, i).type ==
+                COMPOSER_ACTION_UPDATE_PREEDIT)
+            n++;
+    }
+
+    return n;
 }
 
-static void
-ibus_hangul_engine_process_edit_and_commit (IBusHangulEngine *hangul)
+static gboolean
+ibus_hangul_engine_defer_actions (IBusHangulEngine *hangul)
 {
-    IBusEngine *engine = (IBusEngine *)hangul;
+    guint n;
 
-    const ucschar *hic_commit_text = hangul_ic_get_commit_string (hangul->context);
-    const ucschar *hic_preedit_text = hangul_ic_get_preedit_string (hangul->context);
+    if (!hangul->in_burst ||
+        composer_get_preedit_mode (hangul->composer) == PREEDIT_MODE_NONE ||
+        composer_get_hanja_mode (hangul->composer))
+        return FALSE;
 
-    if (hangul->preedit_mode == PREEDIT_MODE_WORD || hangul->hanja_mode) {
-        ustring_append_ucs4 (hangul->preedit, hic_commit_text, -1);
+    if (hangul->burst == NULL)
+        hangul->burst = composer_actions_new ();
 
-        if (hic_preedit_text == NULL || hic_preedit_text[0] == 0) {
-            if (ustring_length (hangul->preedit) > 0) {
-                IBusText *text;
-                const ucschar* preedit_text;
+    n = count_preedit_updates (hangul->burst) +
+        count_preedit_updates (actions);
+    composer_actions_merge (hangul->burst, actions);
+    composer_actions_clear (actions);
+    stats_add (STATS_PREEDIT_UPDATES_SUPPRESSED,
+               n - count_preedit_updates (hangul->burst));
 
-                /* clear preedit text before commit */
-                ibus_hangul_engine_clear_preedit_text (hangul);
+    if (hangul->burst_flush_id == 0) {
+        hangul->burst_flush_id = g_idle_add (ibus_hangul_engine_burst_idle,
+                                             hangul);
+    }
 
-                preedit_text = ustring_begin (hangul->preedit);
-                text = ibus_text_new_from_ucs4 ((gunichar*)preedit_text);
-                ibus_engine_commit_text (engine, text);
-                ustring_clear (hangul->preedit);
-            }
-        }
-    } else {
-        if (hic_commit_text != NULL && hic_commit_text[0] != 0) {
-            IBusText *text;
+    return TRUE;
+}
 
-            /* clear preedit text before commit */
-            ibus_hangul_engine_clear_preedit_text (hangul);
+static void
+ibus_hangul_engine_update_preedit_text (IBusHangulEngine *hangul)
+{
+    composer_update_preedit (hangul->composer, actions);
+    ibus_hangul_engine_apply_actions (hangul);
+}
 
-            text = ibus_text_new_from_ucs4 (hic_commit_text);
-            ibus_engine_commit_text (engine, text);
-        }
+static IBusLookupTable*
+ibus_hangul_engine_get_lookup_table (IBusHangulEngine *hangul)
+{
+    // Most contexts never show hanja candidates, so the lookup table is
+    // created when it is needed first time.
+    if (hangul->table == NULL) {
+        hangul->table = ibus_lookup_table_new (9, 0, TRUE, FALSE);
+        g_object_ref_sink (hangul->table);
+        memstat_update (MEMSTAT_LOOKUP_TABLE, &hangul->mem_lookup_table,
+                        LOOKUP_TABLE_BASE_SIZE);
     }
 
-    ibus_hangul_engine_update_preedit_text (hangul);
+    return hangul->table;
 }
 
 static void
@@ -933,7 +1316,7 @@ ibus_hangul_engine_update_lookup_table_ui (IBusHangulEngine *hangul)
 
     // update aux text
     cursor_pos = ibus_lookup_table_get_cursor_pos (hangul->table);
-    comment = hanja_list_get_nth_comment (hangul->hanja_list, cursor_pos);
+    comment = candidate_list_get_nth_comment (hangul->hanja_list, cursor_pos);
 
     text = ibus_text_new_from_string (comment);
     ibus_engine_update_auxiliary_text ((IBusEngine *)hangul, text, TRUE);
@@ -948,288 +1331,290 @@ ibus_hangul_engine_commit_current_candidate (IBusHangulEngine *hangul)
     guint cursor_pos;
     const char* key;
     const char* value;
-    const ucschar* hic_preedit;
-    glong key_len;
-    glong hic_preedit_len;
-    glong preedit_len;
-
-    IBusText* text;
 
     cursor_pos = ibus_lookup_table_get_cursor_pos (hangul->table);
-    key = hanja_list_get_nth_key (hangul->hanja_list, cursor_pos);
-    value = hanja_list_get_nth_value (hangul->hanja_list, cursor_pos);
-    hic_preedit = hangul_ic_get_preedit_string (hangul->context);
-
-    key_len = g_utf8_strlen(key, -1);
-    preedit_len = ustring_length(hangul->preedit);
-    hic_preedit_len = ucschar_strlen (hic_preedit);
-
-    if (hangul->last_lookup_method == LOOKUP_METHOD_PREFIX) {
-        if (preedit_len == 0 && hic_preedit_len == 0) {
-            /* remove surrounding_text */
-            if (key_len > 0) {
-                ibus_engine_delete_surrounding_text ((IBusEngine *)hangul,
-                        -key_len , key_len);
-            }
-        } else {
-            /* remove ibus preedit text */
-            if (key_len > 0) {
-                glong n = MIN(key_len, preedit_len);
-                ustring_erase (hangul->preedit, 0, n);
-                key_len -= preedit_len;
-            }
-
-            /* remove hic preedit text */
-            if (key_len > 0) {
-                hangul_ic_reset (hangul->context);
-                key_len -= hic_preedit_len;
-            }
-        }
-    } else {
-        /* remove hic preedit text */
-        if (hic_preedit_len > 0) {
-            hangul_ic_reset (hangul->context);
-            if (hangul->preedit_mode == PREEDIT_MODE_NONE) {
-                if (preedit_len > hic_preedit_len) {
-                    guint pos = preedit_len - hic_preedit_len;
-                    ustring_erase (hangul->preedit, pos, hic_preedit_len);
-                } else {
-                    ustring_clear (hangul->preedit);
-                }
-                preedit_len = ustring_length(hangul->preedit);
-            } else {
-                key_len -= hic_preedit_len;
-            }
-        }
-
-        /* remove ibus preedit text */
-        if (key_len > preedit_len) {
-            ustring_erase (hangul->preedit, 0, preedit_len);
-            key_len -= preedit_len;
-        } else if (key_len > 0) {
-            ustring_erase (hangul->preedit, 0, key_len);
-            key_len = 0;
-        }
-
-        /* remove surrounding_text */
-        if (key_len > 0) {
-            ibus_engine_delete_surrounding_text ((IBusEngine *)hangul,
-                    -key_len , key_len);
-        }
-    }
-
-    /* clear preedit text before commit */
-    ibus_hangul_engine_clear_preedit_text (hangul);
-
-    text = ibus_text_new_from_string (value);
-    ibus_engine_commit_text ((IBusEngine *)hangul, text);
-
-    ibus_hangul_engine_update_preedit_text (hangul);
+    key = candidate_list_get_nth_key (hangul->hanja_list, cursor_pos);
+    value = candidate_list_get_nth_value (hangul->hanja_list, cursor_pos);
+    // Only queued here, the user dictionary is written on its own thread.
+    user_dict_add (user_dict, key, value);
+
+    composer_commit_candidate (hangul->composer, key, value,
+                               hangul->last_lookup_method, actions);
+    ibus_hangul_engine_apply_actions (hangul);
 }
 
-static gchar*
-h_ibus_text_get_substring (IBusText* ibus_text, glong p1, glong p2)
-{
-    const gchar* text;
-    const gchar* begin;
-    const gchar* end;
-    gchar* substring;
-    glong limit;
-    glong pos;
-    glong n;
-
-    text = ibus_text_get_text (ibus_text);
-    limit = ibus_text_get_length (ibus_text) + 1;
-    if (text == NULL || limit == 0)
+static CandidateList*
+ibus_hangul_engine_lookup_hanja_table (const char* key, LookupMethod method)
+{
+    if (key == NULL)
         return NULL;
 
-    p1 = MAX(0, p1);
-    p2 = MAX(0, p2);
-
-    pos = MIN(p1, p2);
-    n = ABS(p2 - p1);
-
-    if (pos + n > limit)
-        n = limit - pos;
+    g_debug("lookup hanja table: %s", key);
+    return dictionary_lookup (dictionary, key, method);
+}
 
-    begin = g_utf8_offset_to_pointer (text, pos);
-    end = g_utf8_offset_to_pointer (begin, n);
+/**
+ * Returns the key to look up for the current preedit and surrounding
+ * text, and the method in lookup_method. The key is no longer than the
+ * longest key in the dictionaries, nor HANJA_SUFFIX_MAX_WINDOW.
+ */
+static gchar*
+ibus_hangul_engine_get_hanja_key (IBusHangulEngine *hangul,
+                                  LookupMethod     *lookup_method_ret)
+{
+    guint max_len = dictionary_get_max_key_length (dictionary);
 
-    substring = g_strndup (begin, end - begin);
-    return substring;
+    return composer_get_hanja_key (hangul->composer,
+                                   MIN (max_len, HANJA_SUFFIX_MAX_WINDOW),
+                                   lookup_method_ret);
 }
 
-static HanjaList*
-ibus_hangul_engine_lookup_hanja_table (const char* key, int method)
+static void
+ibus_hangul_engine_apply_hanja_list (IBusHangulEngine *hangul)
 {
-    HanjaList* list = NULL;
-
-    if (key == NULL)
-        return NULL;
+    CandidateList* list = hangul->hanja_list;
+    if (list != NULL) {
+        guint i, n;
+        gsize bytes = LOOKUP_TABLE_BASE_SIZE;
 
-    switch (method) {
-    case LOOKUP_METHOD_EXACT:
-        if (symbol_table != NULL)
-            list = hanja_table_match_exact (symbol_table, key);
+        n = candidate_list_get_size (list);
 
-        if (list == NULL)
-            list = hanja_table_match_exact (hanja_table, key);
+        ibus_hangul_engine_get_lookup_table (hangul);
+        lookup_table_set_candidates (hangul->table, list);
+        for (i = 0; i < n; i++) {
+            const char* value = candidate_list_get_nth_value (list, i);
+            bytes += sizeof (IBusText) + strlen (value) + 1;
+        }
+        memstat_update (MEMSTAT_LOOKUP_TABLE, &hangul->mem_lookup_table,
+                        bytes);
 
-        break;
-    case LOOKUP_METHOD_PREFIX:
-        if (symbol_table != NULL)
-            list = hanja_table_match_prefix (symbol_table, key);
+        ibus_lookup_table_set_cursor_pos (hangul->table, 0);
+        TRACE1 (lookup_table_show, n);
+        ibus_hangul_engine_update_lookup_table_ui (hangul);
+        lookup_table_set_visible (hangul->table, TRUE);
+    }
+}
 
-        if (list == NULL)
-            list = hanja_table_match_prefix (hanja_table, key);
+static void
+ibus_hangul_engine_hide_lookup_table (IBusHangulEngine *hangul)
+{
+    gboolean is_visible = FALSE;
 
-        break;
-    case LOOKUP_METHOD_SUFFIX:
-        if (symbol_table != NULL)
-            list = hanja_table_match_suffix (symbol_table, key);
+    if (hangul->table != NULL)
+        is_visible = lookup_table_is_visible (hangul->table);
 
-        if (list == NULL)
-            list = hanja_table_match_suffix (hanja_table, key);
+    // Sending hide lookup table message when the lookup table
+    // is not visible results wrong behavior. So I have to check
+    // whether the table is visible or not before to hide.
+    if (is_visible) {
+        TRACE (lookup_table_hide);
+        ibus_engine_hide_lookup_table ((IBusEngine *)hangul);
+        ibus_engine_hide_auxiliary_text ((IBusEngine *)hangul);
+        lookup_table_set_visible (hangul->table, FALSE);
+    }
 
-        break;
+    if (hangul->hanja_list != NULL) {
+        candidate_list_delete (hangul->hanja_list);
+        hangul->hanja_list = NULL;
     }
 
-    g_debug("lookup hanja table: %s", key);
-    return list;
+    ibus_hangul_engine_cancel_lookup (hangul);
 }
 
+/**
+ * Drops the result of the pending lookup, if any. A result must not come
+ * to a context which was unfocused or reset after the lookup started:
+ * the key of a suffix lookup comes from the surrounding text, which may
+ * still match.
+ */
 static void
-ibus_hangul_engine_update_hanja_list (IBusHangulEngine *hangul)
+ibus_hangul_engine_cancel_lookup (IBusHangulEngine *hangul)
 {
-    gchar* hanja_key;
-    gchar* preedit_utf8;
-    const ucschar* hic_preedit;
-    UString* preedit = NULL;
-    int lookup_method;
-    IBusText* ibus_text = NULL;
-    guint cursor_pos = 0;
-    guint anchor_pos = 0;
-
-    if (hangul->hanja_list != NULL) {
-        hanja_list_delete (hangul->hanja_list);
-        hangul->hanja_list = NULL;
-    }
+    g_atomic_int_inc (&hangul->lookup_generation);
+    hangul->lookup_pending = FALSE;
+    hangul->restore_lookup = FALSE;
+}
 
-    hic_preedit = hangul_ic_get_preedit_string (hangul->context);
+static void
+ibus_hangul_lookup_thread (gpointer data, gpointer user_data)
+{
+    HanjaLookup* lookup = data;
+
+    // Skip the lookups which were superseded while they were queued.
+    if (lookup->generation ==
+            g_atomic_int_get (&lookup->hangul->lookup_generation)) {
+        lookup->result = ibus_hangul_engine_lookup_hanja_table (lookup->key,
+                lookup->method);
+        lookup->searched = TRUE;
+        TRACE3 (lookup_end, strlen (lookup->key), lookup->method,
+                lookup->result != NULL ?
+                    candidate_list_get_size (lookup->result) : 0);
+    }
+
+    g_mutex_lock (&lookups_done_mutex);
+    g_queue_push_tail (&lookups_done, lookup);
+    if (lookups_done_id == 0) {
+        lookups_done_id = g_idle_add_full (G_PRIORITY_DEFAULT,
+                                           ibus_hangul_engine_lookups_done,
+                                           NULL, NULL);
+    }
+    g_mutex_unlock (&lookups_done_mutex);
+}
 
-    hanja_key = NULL;
-    lookup_method = LOOKUP_METHOD_PREFIX;
+/* Applies the lookups which are done, on the main thread. */
+static gboolean
+ibus_hangul_engine_lookups_done (gpointer data)
+{
+    GQueue done = G_QUEUE_INIT;
+    HanjaLookup* lookup;
 
-    if (hangul->preedit_mode != PREEDIT_MODE_NONE) {
-        preedit = ustring_dup (hangul->preedit);
-        ustring_append_ucs4 (preedit, hic_preedit, -1);
-    }
+    g_mutex_lock (&lookups_done_mutex);
+    done = lookups_done;
+    g_queue_init (&lookups_done);
+    lookups_done_id = 0;
+    g_mutex_unlock (&lookups_done_mutex);
 
-    if (preedit != NULL && ustring_length(preedit) > 0) {
-        preedit_utf8 = ustring_to_utf8 (preedit, -1);
-        if (hangul->preedit_mode == PREEDIT_MODE_WORD || hangul->hanja_mode) {
-            hanja_key = preedit_utf8;
-            lookup_method = LOOKUP_METHOD_PREFIX;
-        } else {
-            gchar* substr;
-            ibus_engine_get_surrounding_text ((IBusEngine *)hangul, &ibus_text,
-                    &cursor_pos, &anchor_pos);
+    while ((lookup = g_queue_pop_head (&done)) != NULL)
+        ibus_hangul_engine_lookup_done (lookup);
 
-            substr = h_ibus_text_get_substring (ibus_text,
-                    (glong)cursor_pos - 32, cursor_pos);
+    return G_SOURCE_REMOVE;
+}
 
-            if (substr != NULL) {
-                hanja_key = g_strconcat (substr, preedit_utf8, NULL);
-                g_free (preedit_utf8);
-            } else {
-                hanja_key = preedit_utf8;
-            }
-            lookup_method = LOOKUP_METHOD_SUFFIX;
-        }
-    } else {
-        ibus_engine_get_surrounding_text ((IBusEngine *)hangul, &ibus_text,
-                &cursor_pos, &anchor_pos);
-        if (cursor_pos != anchor_pos) {
-            // If we have selection in surrounding text, we use that.
-            hanja_key = h_ibus_text_get_substring (ibus_text,
-                    cursor_pos, anchor_pos);
-            lookup_method = LOOKUP_METHOD_EXACT;
+static void
+ibus_hangul_engine_lookup_done (HanjaLookup *lookup)
+{
+    IBusHangulEngine* hangul = lookup->hangul;
+    gboolean applied = FALSE;
+
+    if (lookup->generation == g_atomic_int_get (&hangul->lookup_generation)) {
+        gchar* key;
+        LookupMethod method;
+
+        hangul->lookup_pending = FALSE;
+
+        // Keys which don't change the preedit text, or the surrounding
+        // text may have changed it without a new lookup.
+        key = ibus_hangul_engine_get_hanja_key (hangul, &method);
+        if (lookup->result != NULL &&
+            method == lookup->method && g_strcmp0 (key, lookup->key) == 0) {
+            hangul->hanja_list = lookup->result;
+            hangul->last_lookup_method = lookup->method;
+            lookup->result = NULL;
+            applied = TRUE;
+
+            // We should redraw preedit text with IBUS_ENGINE_PREEDIT_CLEAR
+            // option here to prevent committing it on focus out event
+            // incidentally.
+            ibus_hangul_engine_update_preedit_text (hangul);
+            ibus_hangul_engine_apply_hanja_list (hangul);
         } else {
-            hanja_key = h_ibus_text_get_substring (ibus_text,
-                    (glong)cursor_pos - 32, cursor_pos);
-            lookup_method = LOOKUP_METHOD_SUFFIX;
+            ibus_hangul_engine_hide_lookup_table (hangul);
         }
-    }
+        g_free (key);
 
-    if (hanja_key != NULL) {
-        hangul->hanja_list = ibus_hangul_engine_lookup_hanja_table (hanja_key,
-                lookup_method);
-        hangul->last_lookup_method = lookup_method;
-        g_free (hanja_key);
+        ibus_hangul_engine_update_memstat (hangul);
     }
 
-    if (preedit != NULL)
-        ustring_delete (preedit);
+    if (!lookup->searched) {
+        stats_add (STATS_LOOKUPS_SKIPPED, 1);
+    } else if (applied) {
+        stats_add (STATS_CANDIDATES,
+                   candidate_list_get_size (hangul->hanja_list));
+    } else if (lookup->result == NULL) {
+        stats_add (STATS_LOOKUPS_EMPTY, 1);
+    } else {
+        stats_add (STATS_LOOKUPS_STALE, 1);
+    }
 
-    if (ibus_text != NULL)
-        g_object_unref (ibus_text);
+    ibus_hangul_lookup_free (lookup);
 }
 
 static void
-ibus_hangul_engine_apply_hanja_list (IBusHangulEngine *hangul)
+ibus_hangul_lookup_free (HanjaLookup *lookup)
 {
-    HanjaList* list = hangul->hanja_list;
-    if (list != NULL) {
-        int i, n;
-        n = hanja_list_get_size (list);
-
-        ibus_lookup_table_clear (hangul->table);
-        for (i = 0; i < n; i++) {
-            const char* value = hanja_list_get_nth_value (list, i);
-            IBusText* text = ibus_text_new_from_string (value);
-            ibus_lookup_table_append_candidate (hangul->table, text);
-        }
-
-        ibus_lookup_table_set_cursor_pos (hangul->table, 0);
-        ibus_hangul_engine_update_lookup_table_ui (hangul);
-        lookup_table_set_visible (hangul->table, TRUE);
-    }
+    candidate_list_delete (lookup->result);
+    g_object_unref (lookup->hangul);
+    g_free (lookup->key);
+    g_free (lookup);
 }
 
+/**
+ * Looks the key of the pending lookup up on the main thread. A key which
+ * the lookup table would take must not go to the composer only because
+ * the candidates are not there yet.
+ */
 static void
-ibus_hangul_engine_hide_lookup_table (IBusHangulEngine *hangul)
+ibus_hangul_engine_finish_lookup (IBusHangulEngine *hangul)
 {
-    gboolean is_visible;
-    is_visible = lookup_table_is_visible (hangul->table);
+    gchar* key;
+    LookupMethod method;
 
-    // Sending hide lookup table message when the lookup table
-    // is not visible results wrong behavior. So I have to check
-    // whether the table is visible or not before to hide.
-    if (is_visible) {
-        ibus_engine_hide_lookup_table ((IBusEngine *)hangul);
-        ibus_engine_hide_auxiliary_text ((IBusEngine *)hangul);
-        lookup_table_set_visible (hangul->table, FALSE);
+    // The result of the queued lookup is dropped.
+    ibus_hangul_engine_cancel_lookup (hangul);
+
+    key = ibus_hangul_engine_get_hanja_key (hangul, &method);
+    if (key != NULL) {
+        hangul->hanja_list = ibus_hangul_engine_lookup_hanja_table (key,
+                                                                    method);
+        g_free (key);
     }
 
     if (hangul->hanja_list != NULL) {
-        hanja_list_delete (hangul->hanja_list);
-        hangul->hanja_list = NULL;
+        hangul->last_lookup_method = method;
+        ibus_hangul_engine_update_preedit_text (hangul);
+        ibus_hangul_engine_apply_hanja_list (hangul);
+    } else {
+        ibus_hangul_engine_hide_lookup_table (hangul);
     }
+
+    ibus_hangul_engine_update_memstat (hangul);
 }
 
+/**
+ * Starts a lookup of the current key on lookup_pool. The lookup table is
+ * updated when it is done, so composing is never blocked by a dictionary.
+ * The shown table stays until then, but its candidates are dropped, so
+ * keys are not handled as candidate keys for a stale list.
+ */
 static void
 ibus_hangul_engine_update_lookup_table (IBusHangulEngine *hangul)
 {
-    ibus_hangul_engine_update_hanja_list (hangul);
+    HanjaLookup* lookup;
+    gchar* key;
+    LookupMethod method;
 
     if (hangul->hanja_list != NULL) {
-	// We should redraw preedit text with IBUS_ENGINE_PREEDIT_CLEAR option
-	// here to prevent committing it on focus out event incidentally.
-	ibus_hangul_engine_update_preedit_text (hangul);
-        ibus_hangul_engine_apply_hanja_list (hangul);
-    } else {
+        candidate_list_delete (hangul->hanja_list);
+        hangul->hanja_list = NULL;
+    }
+
+    key = ibus_hangul_engine_get_hanja_key (hangul, &method);
+    if (key == NULL) {
         ibus_hangul_engine_hide_lookup_table (hangul);
+        return;
     }
+
+    lookup = g_new0 (HanjaLookup, 1);
+    lookup->hangul = g_object_ref (hangul);
+    lookup->key = key;
+    lookup->method = method;
+    lookup->generation = g_atomic_int_add (&hangul->lookup_generation, 1) + 1;
+
+    TRACE2 (lookup_start, strlen (key), method);
+    switch (method) {
+    case LOOKUP_METHOD_EXACT:
+        stats_add (STATS_LOOKUPS_EXACT, 1);
+        break;
+    case LOOKUP_METHOD_PREFIX:
+        stats_add (STATS_LOOKUPS_PREFIX, 1);
+        break;
+    case LOOKUP_METHOD_SUFFIX:
+        stats_add (STATS_LOOKUPS_SUFFIX, 1);
+        break;
+    }
+
+    hangul->lookup_pending = TRUE;
+    g_thread_pool_push (lookup_pool, lookup, NULL);
 }
 
 static gboolean
@@ -1237,7 +1622,16 @@ ibus_hangul_engine_process_candidate_key_event (IBusHangulEngine    *hangul,
                                                 guint                keyval,
                                                 guint                modifiers)
 {
-    if (keyval == IBUS_Escape) {
+    guint nth;
+    guint page_size;
+    guint cursor_pos;
+
+    switch (composer_get_candidate_key (hangul->composer, keyval,
+                                        lookup_table_orientation != 0,
+                                        &nth)) {
+    case COMPOSER_CANDIDATE_KEY_NONE:
+        return FALSE;
+    case COMPOSER_CANDIDATE_KEY_CLOSE:
         ibus_hangul_engine_hide_lookup_table (hangul);
 	// When the lookup table is poped up, preedit string is 
 	// updated with IBUS_ENGINE_PREEDIT_CLEAR option.
@@ -1246,168 +1640,98 @@ ibus_hangul_engine_process_candidate_key_event (IBusHangulEngine    *hangul,
 	// with IBUS_ENGINE_PREEDIT_COMMIT option.
 	ibus_hangul_engine_update_preedit_text (hangul);
         return TRUE;
-    } else if (keyval == IBUS_Return) {
-        ibus_hangul_engine_commit_current_candidate (hangul);
-
-        if (hangul->hanja_mode && ibus_hangul_engine_has_preedit (hangul)) {
-            ibus_hangul_engine_update_lookup_table (hangul);
-        } else {
-            ibus_hangul_engine_hide_lookup_table (hangul);
-        }
-        return TRUE;
-    } else if (keyval >= IBUS_1 && keyval <= IBUS_9) {
-        guint page_no;
-        guint page_size;
-        guint cursor_pos;
-
+    case COMPOSER_CANDIDATE_KEY_SELECT:
         page_size = ibus_lookup_table_get_page_size (hangul->table);
         cursor_pos = ibus_lookup_table_get_cursor_pos (hangul->table);
-        page_no = cursor_pos / page_size;
-
-        cursor_pos = page_no * page_size + (keyval - IBUS_1);
+        cursor_pos = cursor_pos / page_size * page_size + nth;
         ibus_lookup_table_set_cursor_pos (hangul->table, cursor_pos);
-
+        /* fall through */
+    case COMPOSER_CANDIDATE_KEY_COMMIT:
         ibus_hangul_engine_commit_current_candidate (hangul);
 
-        if (hangul->hanja_mode && ibus_hangul_engine_has_preedit (hangul)) {
+        if (composer_get_hanja_mode (hangul->composer) &&
+            composer_has_preedit (hangul->composer)) {
             ibus_hangul_engine_update_lookup_table (hangul);
         } else {
             ibus_hangul_engine_hide_lookup_table (hangul);
         }
         return TRUE;
-    } else if (keyval == IBUS_Page_Up) {
-        ibus_lookup_table_page_up (hangul->table);
-        ibus_hangul_engine_update_lookup_table_ui (hangul);
-        return TRUE;
-    } else if (keyval == IBUS_Page_Down) {
-        ibus_lookup_table_page_down (hangul->table);
-        ibus_hangul_engine_update_lookup_table_ui (hangul);
-        return TRUE;
-    } else {
-        if (lookup_table_orientation == 0) {
-            // horizontal
-            if (keyval == IBUS_Left) {
-                ibus_lookup_table_cursor_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_Right) {
-                ibus_lookup_table_cursor_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_Up) {
-                ibus_lookup_table_page_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_Down) {
-                ibus_lookup_table_page_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            }
-        } else {
-            // vertical
-            if (keyval == IBUS_Left) {
-                ibus_lookup_table_page_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_Right) {
-                ibus_lookup_table_page_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_Up) {
-                ibus_lookup_table_cursor_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_Down) {
-                ibus_lookup_table_cursor_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            }
-        }
-    }
-
-    if (!hangul->hanja_mode) {
-        if (lookup_table_orientation == 0) {
-            // horizontal
-            if (keyval == IBUS_h) {
-                ibus_lookup_table_cursor_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_l) {
-                ibus_lookup_table_cursor_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_k) {
-                ibus_lookup_table_page_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_j) {
-                ibus_lookup_table_page_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            }
-        } else {
-            // vertical
-            if (keyval == IBUS_h) {
-                ibus_lookup_table_page_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_l) {
-                ibus_lookup_table_page_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_k) {
-                ibus_lookup_table_cursor_up (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            } else if (keyval == IBUS_j) {
-                ibus_lookup_table_cursor_down (hangul->table);
-                ibus_hangul_engine_update_lookup_table_ui (hangul);
-                return TRUE;
-            }
-        }
+    case COMPOSER_CANDIDATE_KEY_CURSOR_UP:
+        ibus_lookup_table_cursor_up (hangul->table);
+        break;
+    case COMPOSER_CANDIDATE_KEY_CURSOR_DOWN:
+        ibus_lookup_table_cursor_down (hangul->table);
+        break;
+    case COMPOSER_CANDIDATE_KEY_PAGE_UP:
+        ibus_lookup_table_page_up (hangul->table);
+        break;
+    case COMPOSER_CANDIDATE_KEY_PAGE_DOWN:
+        ibus_lookup_table_page_down (hangul->table);
+        break;
     }
 
-    return FALSE;
+    ibus_hangul_engine_update_lookup_table_ui (hangul);
+    return TRUE;
 }
 
 static gboolean
-ibus_hangul_engine_process_key_event (IBusEngine     *engine,
-                                      guint           keyval,
-                                      guint           keycode,
-                                      guint           modifiers)
+ibus_hangul_engine_handle_key_event (IBusEngine     *engine,
+                                     guint           keyval,
+                                     guint           keycode,
+                                     guint           modifiers)
 {
     IBusHangulEngine *hangul = (IBusHangulEngine *) engine;
 
     guint mask;
     gboolean retval;
     guint orig_keyval = keyval;
+    guint nth;
 
-    if (modifiers & IBUS_RELEASE_MASK)
+    if (modifiers & IBUS_RELEASE_MASK) {
+        KEY_PATH (STATS_KEY_RELEASE);
         return FALSE;
+    }
+
+    if (!hangul->in_burst)
+        ibus_hangul_engine_flush_burst (hangul);
 
     // if we don't ignore shift keys, shift key will make flush the preedit 
     // string. So you cannot input shift+key.
     // Let's think about these examples:
     //   dlTek (2 set)
     //   qhRdmaqkq (2 set)
-    if (keyval == IBUS_Shift_L || keyval == IBUS_Shift_R)
+    if (keyval == IBUS_Shift_L || keyval == IBUS_Shift_R) {
+        KEY_PATH (STATS_KEY_SHIFT);
         return FALSE;
+    }
 
     // On password mode, we ignore hotkeys
-    if (hangul->input_purpose == IBUS_INPUT_PURPOSE_PASSWORD)
+    if (hangul->input_purpose == IBUS_INPUT_PURPOSE_PASSWORD) {
+        KEY_PATH (STATS_KEY_PASSWORD);
         return IBUS_ENGINE_CLASS (parent_class)->process_key_event (engine, keyval, keycode, modifiers);
+    }
 
     /* Process candidate key event before hot keys,
      * or lookup table can't receive important events.
      * For example, if Esc key is pressed, this key event should be used for
      * closing lookup table, not for turning to latin mode. */
+    if (hangul->lookup_pending &&
+        composer_get_candidate_key (hangul->composer, keyval,
+                                    lookup_table_orientation != 0, &nth) !=
+            COMPOSER_CANDIDATE_KEY_NONE) {
+        ibus_hangul_engine_finish_lookup (hangul);
+    }
+
     if (hangul->hanja_list != NULL) {
         retval = ibus_hangul_engine_process_candidate_key_event (hangul,
                      keyval, modifiers);
-        if (hangul->hanja_mode) {
-            if (retval)
+        if (composer_get_hanja_mode (hangul->composer)) {
+            if (retval) {
+                KEY_PATH (STATS_KEY_CANDIDATE);
                 return TRUE;
+            }
         } else {
+            KEY_PATH (STATS_KEY_CANDIDATE);
             return TRUE;
         }
     }
@@ -1419,35 +1743,52 @@ ibus_hangul_engine_process_key_event (IBusEngine     *engine,
     // right hanja key event, we don't have preedit string to be changed
     // to hanja word.
     // See this bug: http://code.google.com/p/ibus/issues/detail?id=1036
-    if (hotkey_list_has_modifier(&switch_keys, keyval))
+    if (composer_is_hotkey_modifier (COMPOSER_HOTKEY_SWITCH, keyval)) {
+        KEY_PATH (STATS_KEY_HOTKEY_MODIFIER);
         return FALSE;
+    }
 
-    if (hotkey_list_match(&switch_keys, keyval, modifiers)) {
+    if (composer_match_hotkey (COMPOSER_HOTKEY_SWITCH, keyval, modifiers)) {
+        TRACE2 (hotkey, "switch", keyval);
+        KEY_PATH (STATS_KEY_HOTKEY);
         ibus_hangul_engine_switch_input_mode (hangul);
         return TRUE;
     }
 
-    if (hotkey_list_match (&on_keys, keyval, modifiers)) {
+    if (composer_match_hotkey (COMPOSER_HOTKEY_ON, keyval, modifiers)) {
+        TRACE2 (hotkey, "on", keyval);
+        KEY_PATH (STATS_KEY_HOTKEY);
         ibus_hangul_engine_set_input_mode (hangul, INPUT_MODE_HANGUL);
         return FALSE;
     }
 
-    if (hangul->input_mode == INPUT_MODE_LATIN)
+    if (hangul->input_mode == INPUT_MODE_LATIN) {
+        KEY_PATH (STATS_KEY_LATIN);
         return IBUS_ENGINE_CLASS (parent_class)->process_key_event (engine, keyval, keycode, modifiers);
+    }
 
     /* This feature is for vi* users.
      * On Esc, the input mode is changed to latin */
-    if (hotkey_list_match (&off_keys, keyval, modifiers)) {
+    if (composer_match_hotkey (COMPOSER_HOTKEY_OFF, keyval, modifiers)) {
+        TRACE2 (hotkey, "off", keyval);
+        KEY_PATH (STATS_KEY_HOTKEY);
         ibus_hangul_engine_set_input_mode (hangul, INPUT_MODE_LATIN);
         /* If we return TRUE, then vi will not receive "ESC" key event. */
         return FALSE;
     }
 
-    if (hotkey_list_has_modifier(&hanja_keys, keyval))
+    if (composer_is_hotkey_modifier (COMPOSER_HOTKEY_HANJA, keyval)) {
+        KEY_PATH (STATS_KEY_HOTKEY_MODIFIER);
 	return FALSE; 
+    }
 
-    if (hotkey_list_match(&hanja_keys, keyval, modifiers)) {
-        if (hangul->hanja_list == NULL) {
+    if (composer_match_hotkey (COMPOSER_HOTKEY_HANJA, keyval, modifiers)) {
+        TRACE2 (hotkey, "hanja", keyval);
+        KEY_PATH (STATS_KEY_HOTKEY);
+        // The key may be looked up with the text before the cursor.
+        ibus_hangul_engine_flush_burst (hangul);
+        // A second press closes the table, even before it is shown.
+        if (hangul->hanja_list == NULL && !hangul->lookup_pending) {
             ibus_hangul_engine_update_lookup_table (hangul);
         } else {
             ibus_hangul_engine_hide_lookup_table (hangul);
@@ -1463,32 +1804,18 @@ ibus_hangul_engine_process_key_event (IBusEngine     *engine,
     mask = IBUS_CONTROL_MASK |
 	    IBUS_MOD1_MASK | IBUS_MOD3_MASK | IBUS_MOD4_MASK | IBUS_MOD5_MASK;
     if (modifiers & mask) {
+        KEY_PATH (STATS_KEY_MODIFIER);
         ibus_hangul_engine_flush (hangul);
         return FALSE;
     }
 
-    if (hangul->preedit_mode == PREEDIT_MODE_NONE) {
-        ibus_hangul_engine_check_caret_pos_sanity (hangul);
-    }
-
     if (keyval == IBUS_BackSpace) {
-        retval = hangul_ic_backspace (hangul->context);
-        if (!retval) {
-            guint preedit_len = ustring_length (hangul->preedit);
-            if (preedit_len > 0) {
-                ustring_erase (hangul->preedit, preedit_len - 1, 1);
-                retval = TRUE;
-            }
-        }
-
-        if (hangul->preedit_mode == PREEDIT_MODE_NONE) {
-            ibus_hangul_engine_process_commit_and_edit (hangul);
-        } else {
-            ibus_hangul_engine_update_preedit_text (hangul);
-        }
+        KEY_PATH (STATS_KEY_BACKSPACE);
+        retval = composer_backspace (hangul->composer, actions);
+        ibus_hangul_engine_apply_actions (hangul);
 
-        if (hangul->hanja_mode) {
-            if (ibus_hangul_engine_has_preedit (hangul)) {
+        if (composer_get_hanja_mode (hangul->composer)) {
+            if (composer_has_preedit (hangul->composer)) {
                 ibus_hangul_engine_update_lookup_table (hangul);
             } else {
                 ibus_hangul_engine_hide_lookup_table (hangul);
@@ -1503,7 +1830,7 @@ ibus_hangul_engine_process_key_event (IBusEngine     *engine,
 	// But if the hic is in transliteration mode, then we should not
 	// normalize the keyval.
 	bool is_transliteration_mode =
-		 hangul_ic_is_transliteration(hangul->context);
+		 composer_is_transliteration (hangul->composer);
 	if (!is_transliteration_mode) {
 	    if (keymap != NULL)
 		keyval = ibus_keymap_lookup_keysym(keymap, keycode, modifiers);
@@ -1518,15 +1845,12 @@ ibus_hangul_engine_process_key_event (IBusEngine     *engine,
                     keyval = toupper(keyval);
             }
         }
-        retval = hangul_ic_process (hangul->context, keyval);
-
-        if (hangul->preedit_mode == PREEDIT_MODE_NONE) {
-            ibus_hangul_engine_process_commit_and_edit (hangul);
-        } else {
-            ibus_hangul_engine_process_edit_and_commit (hangul);
-        }
+        KEY_PATH (STATS_KEY_COMPOSE);
+        retval = composer_process_key (hangul->composer, keyval, actions);
+        if (!retval || !ibus_hangul_engine_defer_actions (hangul))
+            ibus_hangul_engine_apply_actions (hangul);
 
-        if (hangul->hanja_mode) {
+        if (composer_get_hanja_mode (hangul->composer)) {
             ibus_hangul_engine_update_lookup_table (hangul);
         }
 
@@ -1579,6 +1903,8 @@ ibus_hangul_engine_process_key_event (IBusEngine     *engine,
      */
     if (use_event_forwarding) {
         if (!retval) {
+            TRACE1 (key_event_path, "forward");
+            stats_add (STATS_FORWARDED_KEYS, 1);
             ibus_engine_forward_key_event (engine, orig_keyval, keycode, modifiers);
         }
 
@@ -1588,32 +1914,43 @@ ibus_hangul_engine_process_key_event (IBusEngine     *engine,
     return retval;
 }
 
-static void
-ibus_hangul_engine_flush (IBusHangulEngine *hangul)
+static gboolean
+ibus_hangul_engine_process_key_event (IBusEngine     *engine,
+                                      guint           keyval,
+                                      guint           keycode,
+                                      guint           modifiers)
 {
-    const gunichar *str;
-    IBusText *text;
+    IBusHangulEngine *hangul = (IBusHangulEngine *) engine;
+    gboolean retval;
+    gint64 now = g_get_monotonic_time ();
 
-    ibus_hangul_engine_hide_lookup_table (hangul);
+    TRACE3 (key_event_entry, keyval, keycode, modifiers);
 
-    str = hangul_ic_flush (hangul->context);
+    if (!(modifiers & IBUS_RELEASE_MASK)) {
+        hangul->in_burst = burst_interval > 0 && hangul->last_key_time != 0 &&
+            now - hangul->last_key_time < (gint64) burst_interval * 1000;
+        hangul->last_key_time = now;
+    }
 
-    ustring_append_ucs4 (hangul->preedit, str, -1);
+    retval = ibus_hangul_engine_handle_key_event (engine, keyval, keycode,
+                                                  modifiers);
+    ibus_hangul_engine_update_memstat ((IBusHangulEngine *) engine);
 
-    if (ustring_length (hangul->preedit) != 0) {
-        /* clear preedit text before commit */
-        ibus_hangul_engine_clear_preedit_text (hangul);
+    TRACE2 (key_event_exit, keyval, retval);
 
-	str = ustring_begin (hangul->preedit);
-	text = ibus_text_new_from_ucs4 (str);
+    if (!(modifiers & IBUS_RELEASE_MASK))
+        stats_add_key_latency (g_get_monotonic_time () - now);
 
-        g_debug ("flush:%u: %s", hangul->id, text->text);
-	ibus_engine_commit_text ((IBusEngine *) hangul, text);
+    return retval;
+}
 
-	ustring_clear(hangul->preedit);
-    }
+static void
+ibus_hangul_engine_flush (IBusHangulEngine *hangul)
+{
+    ibus_hangul_engine_hide_lookup_table (hangul);
 
-    ibus_hangul_engine_update_preedit_text (hangul);
+    composer_flush (hangul->composer, actions);
+    ibus_hangul_engine_apply_actions (hangul);
 }
 
 static void
@@ -1623,6 +1960,11 @@ ibus_hangul_engine_focus_in (IBusEngine *engine)
 
     //g_debug ("focus_in: %u", hangul->id);
 
+    if (hangul->idle_release_id != 0) {
+        g_source_remove (hangul->idle_release_id);
+        hangul->idle_release_id = 0;
+    }
+
     ibus_hangul_engine_update_preedit_mode (hangul);
 
     if (hangul->input_mode == INPUT_MODE_HANGUL) {
@@ -1631,7 +1973,7 @@ ibus_hangul_engine_focus_in (IBusEngine *engine)
         ibus_property_set_state (hangul->prop_hangul_mode, PROP_STATE_UNCHECKED);
     }
 
-    if (hangul->hanja_mode) {
+    if (composer_get_hanja_mode (hangul->composer)) {
         ibus_property_set_state (hangul->prop_hanja_mode, PROP_STATE_CHECKED);
     } else {
         ibus_property_set_state (hangul->prop_hanja_mode, PROP_STATE_UNCHECKED);
@@ -1643,11 +1985,48 @@ ibus_hangul_engine_focus_in (IBusEngine *engine)
 
     if (hangul->hanja_list != NULL) {
         ibus_hangul_engine_update_lookup_table_ui (hangul);
+    } else if (hangul->restore_lookup) {
+        hangul->restore_lookup = FALSE;
+        ibus_hangul_engine_update_lookup_table (hangul);
     }
 
     IBUS_ENGINE_CLASS (parent_class)->focus_in (engine);
 }
 
+/**
+ * Releases the candidate list and the lookup table of an instance which
+ * has not been focused for idle_release_timeout seconds.
+ * They are created again on the next hanja lookup. If the candidates were
+ * shown at the focus out, focus_in() looks them up again.
+ */
+static gboolean
+ibus_hangul_engine_release_idle_resources (gpointer user_data)
+{
+    IBusHangulEngine *hangul = (IBusHangulEngine *) user_data;
+
+    hangul->idle_release_id = 0;
+
+    g_debug ("release idle resources:%u", hangul->id);
+
+    ibus_hangul_engine_cancel_lookup (hangul);
+
+    if (hangul->hanja_list != NULL) {
+        candidate_list_delete (hangul->hanja_list);
+        hangul->hanja_list = NULL;
+        hangul->restore_lookup = TRUE;
+    }
+
+    if (hangul->table != NULL) {
+        g_object_unref (hangul->table);
+        hangul->table = NULL;
+    }
+
+    memstat_update (MEMSTAT_LOOKUP_TABLE, &hangul->mem_lookup_table, 0);
+    ibus_hangul_engine_update_memstat (hangul);
+
+    return G_SOURCE_REMOVE;
+}
+
 static void
 ibus_hangul_engine_focus_out (IBusEngine *engine)
 {
@@ -1655,18 +2034,29 @@ ibus_hangul_engine_focus_out (IBusEngine *engine)
 
     //g_debug ("focus_out: %u", hangul->id);
 
+    ibus_hangul_engine_flush_burst (hangul);
+
+    // The result would be shown on an unfocused context.
+    ibus_hangul_engine_cancel_lookup (hangul);
+
     if (hangul->hanja_list == NULL) {
 	// ibus-hangul uses
 	// ibus_engine_update_preedit_text_with_mode() function which makes
 	// the preedit string committed automatically when the focus is out.
 	// So we don't need to commit the preedit here.
-	hangul_ic_reset (hangul->context);
-        ustring_clear (hangul->preedit);
+	composer_reset (hangul->composer);
     } else {
         ibus_engine_hide_lookup_table (engine);
         ibus_engine_hide_auxiliary_text (engine);
     }
 
+    if (idle_release_timeout > 0 && hangul->idle_release_id == 0) {
+        hangul->idle_release_id = g_timeout_add_seconds (idle_release_timeout,
+                ibus_hangul_engine_release_idle_resources, hangul);
+    }
+
+    ibus_hangul_engine_update_memstat (hangul);
+
     IBUS_ENGINE_CLASS (parent_class)->focus_out ((IBusEngine *) hangul);
 }
 
@@ -1677,9 +2067,10 @@ ibus_hangul_engine_reset (IBusEngine *engine)
 
     g_debug ("reset:%u", hangul->id);
 
-    if (hangul->preedit_mode == PREEDIT_MODE_NONE) {
-        hangul_ic_reset (hangul->context);
-        ustring_clear (hangul->preedit);
+    ibus_hangul_engine_cancel_lookup (hangul);
+
+    if (composer_get_preedit_mode (hangul->composer) == PREEDIT_MODE_NONE) {
+        composer_reset (hangul->composer);
     }
 
     if (use_client_commit) {
@@ -1687,11 +2078,11 @@ ibus_hangul_engine_reset (IBusEngine *engine)
         // ibus_engine_update_preedit_text_with_mode() function which makes
         // the preedit string committed automatically when the reset is received
         // So we don't need to commit the preedit here.
-        hangul_ic_reset (hangul->context);
-        ustring_clear (hangul->preedit);
+        composer_reset (hangul->composer);
     }
 
     ibus_hangul_engine_flush (hangul);
+    ibus_hangul_engine_update_memstat (hangul);
 
     IBUS_ENGINE_CLASS (parent_class)->reset (engine);
 }
@@ -1784,8 +2175,10 @@ ibus_hangul_engine_property_activate (IBusEngine    *engine,
     } else if (strcmp(prop_name, "hanja_mode") == 0) {
         IBusHangulEngine *hangul = (IBusHangulEngine *) engine;
 
-        hangul->hanja_mode = !hangul->hanja_mode;
-        if (hangul->hanja_mode) {
+        gboolean hanja_mode = !composer_get_hanja_mode (hangul->composer);
+
+        composer_set_hanja_mode (hangul->composer, hanja_mode);
+        if (hanja_mode) {
             ibus_property_set_state (hangul->prop_hanja_mode,
                     PROP_STATE_CHECKED);
         } else {
@@ -1798,23 +2191,6 @@ ibus_hangul_engine_property_activate (IBusEngine    *engine,
     }
 }
 
-static gboolean
-ibus_hangul_engine_has_preedit (IBusHangulEngine *hangul)
-{
-    guint preedit_len;
-    const ucschar *hic_preedit;
-
-    hic_preedit = hangul_ic_get_preedit_string (hangul->context);
-    if (hic_preedit[0] != 0)
-        return TRUE;
-
-    preedit_len = ustring_length (hangul->preedit);
-    if (preedit_len > 0)
-        return TRUE;
-
-    return FALSE;
-}
-
 static void
 ibus_hangul_engine_switch_input_mode (IBusHangulEngine *hangul)
 {
@@ -1824,31 +2200,20 @@ ibus_hangul_engine_switch_input_mode (IBusHangulEngine *hangul)
         input_mode = INPUT_MODE_HANGUL;
     }
 
-    if (hangul->preedit_mode == PREEDIT_MODE_NONE) {
-        hangul_ic_reset (hangul->context);
-        ustring_clear (hangul->preedit);
+    if (composer_get_preedit_mode (hangul->composer) == PREEDIT_MODE_NONE) {
+        composer_reset (hangul->composer);
     }
 
     ibus_hangul_engine_set_input_mode (hangul, input_mode);
 }
 
 static IBusText *
-ibus_hangul_engine_get_input_mode_symbol (IBusHangulEngine *hangul,
-                                          int input_mode)
+ibus_hangul_get_input_mode_symbol (int input_mode)
 {
-    IBusText **symbols = hangul->input_mode_symbols;
-
-    if (symbols[0] == NULL) {
-        symbols[INPUT_MODE_HANGUL] = ibus_text_new_from_string ("한");
-        g_object_ref_sink(symbols[INPUT_MODE_HANGUL]);
-        symbols[INPUT_MODE_LATIN] = ibus_text_new_from_string ("EN");
-        g_object_ref_sink(symbols[INPUT_MODE_LATIN]);
-    }
-
     if (input_mode >= INPUT_MODE_COUNT)
-        return symbols[INPUT_MODE_HANGUL];
+        return input_mode_symbols[INPUT_MODE_HANGUL];
 
-    return symbols[input_mode];
+    return input_mode_symbols[input_mode];
 }
 
 static void
@@ -1869,7 +2234,7 @@ ibus_hangul_engine_set_input_mode (IBusHangulEngine *hangul, int input_mode)
     g_debug("input_mode:%u: %s", hangul->id,
             (input_mode == INPUT_MODE_HANGUL) ? "hangul" : "latin");
 
-    symbol = ibus_hangul_engine_get_input_mode_symbol (hangul, input_mode);
+    symbol = ibus_hangul_get_input_mode_symbol (input_mode);
     ibus_property_set_symbol(prop, symbol);
 
     if (hangul->input_mode == INPUT_MODE_HANGUL) {
@@ -1881,27 +2246,6 @@ ibus_hangul_engine_set_input_mode (IBusHangulEngine *hangul, int input_mode)
     ibus_engine_update_property (IBUS_ENGINE (hangul), prop);
 }
 
-static bool
-ibus_hangul_engine_on_transition (HangulInputContext     *hic,
-                                  ucschar                 c,
-                                  const ucschar          *preedit,
-                                  void                   *data)
-{
-    if (!auto_reorder) {
-        if (hangul_is_choseong (c)) {
-            if (hangul_ic_has_jungseong (hic) || hangul_ic_has_jongseong (hic))
-                return false;
-        }
-
-        if (hangul_is_jungseong (c)) {
-            if (hangul_ic_has_jongseong (hic))
-                return false;
-        }
-    }
-
-    return true;
-}
-
 static void
 print_changed_settings (const gchar *schema_id, const gchar *key, GVariant *value)
 {
@@ -1911,245 +2255,350 @@ print_changed_settings (const gchar *schema_id, const gchar *key, GVariant *valu
 }
 
 static void
-settings_changed (GSettings    *settings,
-                  const gchar  *key,
-                  gpointer      user_data)
+settings_set_hangul_keyboard (GVariant *value)
 {
-    IBusHangulEngine *hangul = (IBusHangulEngine *) user_data;
-    GValue schema_value = G_VALUE_INIT;
-    const gchar *schema_id;
-    GVariant *value;
+    GHashTableIter iter;
+    gpointer key;
 
-    g_return_if_fail (G_IS_SETTINGS (settings));
+    g_string_assign (hangul_keyboard, g_variant_get_string (value, NULL));
 
-    g_value_init (&schema_value, G_TYPE_STRING);
-    g_object_get_property (G_OBJECT (settings), "schema-id", &schema_value);
-    schema_id = g_value_get_string (&schema_value);
-    value = g_settings_get_value (settings, key);
-    if (strcmp (schema_id, "org.freedesktop.ibus.engine.hangul") == 0) {
-        if (strcmp(key, "hangul-keyboard") == 0) {
-            const gchar *str = g_variant_get_string(value, NULL);
-            g_string_assign (hangul_keyboard, str);
-            hangul_ic_select_keyboard (hangul->context, hangul_keyboard->str);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "hanja-keys") == 0) {
-            const gchar* str = g_variant_get_string(value, NULL);
-	    hotkey_list_set_from_string(&hanja_keys, str);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "word-commit") == 0) {
-            word_commit = g_variant_get_boolean (value);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "auto-reorder") == 0) {
-            auto_reorder = g_variant_get_boolean (value);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "switch-keys") == 0) {
-            const gchar* str = g_variant_get_string(value, NULL);
-	    hotkey_list_set_from_string(&switch_keys, str);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "on-keys") == 0) {
-            const gchar* str = g_variant_get_string(value, NULL);
-	    hotkey_list_set_from_string(&on_keys, str);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "off-keys") == 0) {
-            const gchar* str = g_variant_get_string(value, NULL);
-	    hotkey_list_set_from_string(&off_keys, str);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "initial-input-mode") == 0) {
-            const gchar* str = g_variant_get_string (value, NULL);
-            if (strcmp(str, "latin") == 0) {
-                initial_input_mode = INPUT_MODE_LATIN;
-            } else if (strcmp(str, "hangul") == 0) {
-                initial_input_mode = INPUT_MODE_HANGUL;
-            }
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "use-event-forwarding") == 0) {
-            use_event_forwarding = g_variant_get_boolean (value);
-            print_changed_settings (schema_id, key, value);
-        } else if (strcmp (key, "preedit-mode") == 0) {
-            const gchar* str = g_variant_get_string (value, NULL);
-            if (strcmp(str, "none") == 0) {
-                global_preedit_mode = PREEDIT_MODE_NONE;
-            } else if (strcmp(str, "word") == 0) {
-                global_preedit_mode = PREEDIT_MODE_WORD;
-            } else {
-                global_preedit_mode = PREEDIT_MODE_SYLLABLE;
-            }
-            print_changed_settings (schema_id, key, value);
-        }
-    } else if (strcmp (schema_id, "org.freedesktop.ibus.panel") == 0) {
-        if (strcmp (key, "lookup-table-orientation") == 0) {
-            lookup_table_orientation = g_variant_get_int32(value);
-            print_changed_settings (schema_id, key, value);
-        }
+    g_hash_table_iter_init (&iter, live_engines);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        IBusHangulEngine *hangul = (IBusHangulEngine *) key;
+        if (hangul->composer != NULL)
+            composer_select_keyboard (hangul->composer, hangul_keyboard->str);
     }
-    g_variant_unref (value);
-    g_value_unset (&schema_value);
 }
 
 static void
-lookup_table_set_visible (IBusLookupTable *table, gboolean flag)
+settings_set_hanja_keys (GVariant *value)
 {
-    g_object_set_data (G_OBJECT(table), "visible", GUINT_TO_POINTER(flag));
+    composer_set_hotkeys (COMPOSER_HOTKEY_HANJA,
+                          g_variant_get_string (value, NULL));
 }
 
-static gboolean
-lookup_table_is_visible (IBusLookupTable *table)
+static void
+settings_set_switch_keys (GVariant *value)
 {
-    gpointer res = g_object_get_data (G_OBJECT(table), "visible");
-    return GPOINTER_TO_UINT(res);
+    composer_set_hotkeys (COMPOSER_HOTKEY_SWITCH,
+                          g_variant_get_string (value, NULL));
 }
 
 static void
-key_event_list_append(GArray* list, guint keyval, guint modifiers)
+settings_set_on_keys (GVariant *value)
 {
-    struct KeyEvent ev = { keyval, modifiers};
-    g_array_append_val(list, ev);
+    composer_set_hotkeys (COMPOSER_HOTKEY_ON,
+                          g_variant_get_string (value, NULL));
 }
 
-static gboolean
-key_event_list_match(GArray* list, guint keyval, guint modifiers)
+static void
+settings_set_off_keys (GVariant *value)
 {
-    guint i;
-    guint mask;
+    composer_set_hotkeys (COMPOSER_HOTKEY_OFF,
+                          g_variant_get_string (value, NULL));
+}
 
-    /* ignore capslock and numlock */
-    mask = IBUS_SHIFT_MASK |
-           IBUS_CONTROL_MASK |
-           IBUS_MOD1_MASK |
-           IBUS_MOD3_MASK |
-           IBUS_MOD4_MASK |
-           IBUS_MOD5_MASK;
-
-    modifiers &= mask;
-    for (i = 0; i < list->len; ++i) {
-        struct KeyEvent* ev = &g_array_index(list, struct KeyEvent, i);
-        if (ev->keyval == keyval && ev->modifiers == modifiers) {
-            return TRUE;
-        }
-    }
+static void
+settings_set_word_commit (GVariant *value)
+{
+    word_commit = g_variant_get_boolean (value);
+}
 
-    return FALSE;
+static void
+settings_set_auto_reorder (GVariant *value)
+{
+    composer_set_auto_reorder (g_variant_get_boolean (value));
 }
 
 static void
-ibus_hangul_engine_candidate_clicked (IBusEngine     *engine,
-                                      guint           index,
-                                      guint           button,
-                                      guint           state)
+settings_set_disable_latin_mode (GVariant *value)
 {
-    IBusHangulEngine *hangul = (IBusHangulEngine *) engine;
-    if (hangul == NULL)
-	return;
+    disable_latin_mode = g_variant_get_boolean (value);
+}
 
-    if (hangul->table == NULL)
-	return;
+static void
+settings_set_initial_input_mode (GVariant *value)
+{
+    const gchar* str = g_variant_get_string (value, NULL);
+    if (strcmp(str, "latin") == 0) {
+        initial_input_mode = INPUT_MODE_LATIN;
+    } else if (strcmp(str, "hangul") == 0) {
+        initial_input_mode = INPUT_MODE_HANGUL;
+    }
+}
 
-    ibus_lookup_table_set_cursor_pos (hangul->table, index);
-    ibus_hangul_engine_commit_current_candidate (hangul);
+static void
+settings_set_use_event_forwarding (GVariant *value)
+{
+    use_event_forwarding = g_variant_get_boolean (value);
+}
 
-    if (hangul->hanja_mode) {
-	ibus_hangul_engine_update_lookup_table (hangul);
+static void
+settings_set_preedit_mode (GVariant *value)
+{
+    const gchar* str = g_variant_get_string (value, NULL);
+    if (strcmp(str, "none") == 0) {
+        global_preedit_mode = PREEDIT_MODE_NONE;
+    } else if (strcmp(str, "word") == 0) {
+        global_preedit_mode = PREEDIT_MODE_WORD;
     } else {
-	ibus_hangul_engine_hide_lookup_table (hangul);
+        global_preedit_mode = PREEDIT_MODE_SYLLABLE;
     }
 }
 
 static void
-ibus_hangul_engine_set_content_type (IBusEngine     *engine,
-                                     guint           purpose,
-                                     guint           hints)
+settings_set_idle_release_timeout (GVariant *value)
 {
-    IBusHangulEngine *hangul = (IBusHangulEngine *) engine;
-    if (hangul == NULL)
-        return;
+    idle_release_timeout = g_variant_get_uint32 (value);
+}
 
-    hangul->input_purpose = purpose;
+static void
+settings_set_burst_interval (GVariant *value)
+{
+    burst_interval = g_variant_get_uint32 (value);
 }
 
 static void
-hotkey_list_init(HotkeyList* list)
+settings_set_extra_dictionaries (GVariant *value)
 {
-    list->all_modifiers = 0;
-    list->keys = g_array_sized_new(FALSE, TRUE, sizeof(struct KeyEvent), 4);
+    gchar** paths = g_variant_dup_strv (value, NULL);
+    guint i;
+
+    if (extra_dictionaries != NULL) {
+        for (i = 0; extra_dictionaries[i] != NULL; ++i)
+            dictionary_remove_table (dictionary, extra_dictionaries[i],
+                                     DICTIONARY_PRIORITY_EXTRA + i);
+        g_strfreev (extra_dictionaries);
+    }
+
+    extra_dictionaries = paths;
+
+    // They are loaded on a worker thread, so a long list doesn't stop the
+    // engine. The extra dictionaries are looked up in the order of the
+    // list.
+    for (i = 0; paths[i] != NULL; ++i) {
+        dictionary_load_table (dictionary, paths[i],
+                               DICTIONARY_PRIORITY_EXTRA + i);
+    }
 }
 
 static void
-hotkey_list_fini(HotkeyList* list)
+settings_set_lookup_table_orientation (GVariant *value)
 {
-    g_array_free(list->keys, TRUE);
-    list->keys = NULL;
+    lookup_table_orientation = g_variant_get_int32 (value);
 }
 
+static const SettingsEntry hangul_settings_entries[] = {
+    { "hangul-keyboard",        settings_set_hangul_keyboard },
+    { "switch-keys",            settings_set_switch_keys },
+    { "hanja-keys",             settings_set_hanja_keys },
+    { "on-keys",                settings_set_on_keys },
+    { "off-keys",               settings_set_off_keys },
+    { "word-commit",            settings_set_word_commit },
+    { "auto-reorder",           settings_set_auto_reorder },
+    { "disable-latin-mode",     settings_set_disable_latin_mode },
+    { "initial-input-mode",     settings_set_initial_input_mode },
+    { "use-event-forwarding",   settings_set_use_event_forwarding },
+    { "preedit-mode",           settings_set_preedit_mode },
+    { "idle-release-timeout",   settings_set_idle_release_timeout },
+    { "burst-interval",         settings_set_burst_interval },
+    { "extra-dictionaries",     settings_set_extra_dictionaries },
+};
+
+static const SettingsEntry panel_settings_entries[] = {
+    { "lookup-table-orientation", settings_set_lookup_table_orientation },
+};
+
+static SettingsSchema hangul_settings = {
+    "org.freedesktop.ibus.engine.hangul",
+    hangul_settings_entries,
+    G_N_ELEMENTS (hangul_settings_entries),
+    NULL,
+    NULL,
+};
+
+static SettingsSchema panel_settings = {
+    "org.freedesktop.ibus.panel",
+    panel_settings_entries,
+    G_N_ELEMENTS (panel_settings_entries),
+    NULL,
+    NULL,
+};
+
+/**
+ * Creates the GSettings object of the schema, applies the current values
+ * of all the keys and starts to watch changes.
+ */
 static void
-hotkey_list_append_from_string(HotkeyList *list, const char* str)
+settings_schema_init (SettingsSchema *schema)
 {
-    guint keyval = 0;
-    guint modifiers = 0;
-    gboolean res;
+    guint i;
 
-    res = ibus_key_event_from_string(str, &keyval, &modifiers);
-    if (res) {
-	hotkey_list_append(list, keyval, modifiers);
+    schema->settings = g_settings_new (schema->schema_id);
+    schema->handlers = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+    for (i = 0; i < schema->n_entries; ++i) {
+        const SettingsEntry *entry = &schema->entries[i];
+        GQuark quark = g_quark_from_static_string (entry->key);
+        GVariant *value;
+
+        g_hash_table_insert (schema->handlers,
+                             GUINT_TO_POINTER (quark), (gpointer) entry);
+
+        value = g_settings_get_value (schema->settings, entry->key);
+        if (value != NULL) {
+            entry->handler (value);
+            g_variant_unref (value);
+        }
     }
+
+    g_signal_connect (schema->settings, "changed",
+                      G_CALLBACK (settings_changed), schema);
 }
 
 static void
-hotkey_list_append(HotkeyList *list, guint keyval, guint modifiers)
+settings_schema_fini (SettingsSchema *schema)
 {
-    list->all_modifiers |= modifiers;
-    key_event_list_append(list->keys, keyval, modifiers);
+    if (schema->settings != NULL) {
+        g_signal_handlers_disconnect_by_func (schema->settings,
+                                              G_CALLBACK (settings_changed),
+                                              schema);
+    }
+
+    g_clear_object (&schema->settings);
+    g_clear_pointer (&schema->handlers, g_hash_table_destroy);
 }
 
 static void
-hotkey_list_set_from_string(HotkeyList *list, const char* str)
+settings_changed (GSettings    *settings,
+                  const gchar  *key,
+                  gpointer      user_data)
 {
-    gchar** items = g_strsplit(str, ",", 0);
+    SettingsSchema *schema = (SettingsSchema *) user_data;
+    const SettingsEntry *entry;
+    GQuark quark;
+    GVariant *value;
+
+    g_return_if_fail (G_IS_SETTINGS (settings));
 
-    list->all_modifiers = 0;
-    g_array_set_size(list->keys, 0);
+    // GSettings interns the keys of a schema, so we don't need to
+    // compare the key strings one by one.
+    quark = g_quark_try_string (key);
+    entry = g_hash_table_lookup (schema->handlers, GUINT_TO_POINTER (quark));
+    if (entry == NULL)
+        return;
 
-    if (items != NULL) {
-        int i;
-        for (i = 0; items[i] != NULL; ++i) {
-	    hotkey_list_append_from_string(list, items[i]);
-        }
-        g_strfreev(items);
-    }
+    TRACE2 (settings_changed, schema->schema_id, key);
+
+    value = g_settings_get_value (settings, key);
+    entry->handler (value);
+    print_changed_settings (schema->schema_id, key, value);
+    g_variant_unref (value);
 }
 
-static gboolean
-hotkey_list_match(HotkeyList* list, guint keyval, guint modifiers)
+static void
+lookup_table_set_visible (IBusLookupTable *table, gboolean flag)
 {
-    return key_event_list_match(list->keys, keyval, modifiers);
+    g_object_set_data (G_OBJECT(table), "visible", GUINT_TO_POINTER(flag));
 }
 
 static gboolean
-hotkey_list_has_modifier(HotkeyList* list, guint keyval)
+lookup_table_is_visible (IBusLookupTable *table)
 {
-    if (list->all_modifiers & IBUS_CONTROL_MASK) {
-	if (keyval == IBUS_Control_L || keyval == IBUS_Control_R)
-	    return TRUE;
-    }
+    gpointer res = g_object_get_data (G_OBJECT(table), "visible");
+    return GPOINTER_TO_UINT(res);
+}
 
-    if (list->all_modifiers & IBUS_MOD1_MASK) {
-	if (keyval == IBUS_Alt_L || keyval == IBUS_Alt_R)
-	    return TRUE;
-    }
+/**
+ * Fills the table with the values of list. The candidate texts are kept
+ * with the table, and a text is reused when the next list has the same
+ * value at its place, so showing the same candidates again doesn't make
+ * an IBusText for each of them.
+ */
+static void
+lookup_table_set_candidates (IBusLookupTable *table, CandidateList *list)
+{
+    GPtrArray *texts;
+    guint i, n;
 
-    if (list->all_modifiers & IBUS_SUPER_MASK) {
-	if (keyval == IBUS_Super_L || keyval == IBUS_Super_R)
-	    return TRUE;
+    texts = g_object_get_data (G_OBJECT(table), "candidates");
+    if (texts == NULL) {
+        texts = g_ptr_array_new_with_free_func (g_object_unref);
+        g_object_set_data_full (G_OBJECT(table), "candidates", texts,
+                                (GDestroyNotify) g_ptr_array_unref);
     }
 
-    if (list->all_modifiers & IBUS_HYPER_MASK) {
-	if (keyval == IBUS_Hyper_L || keyval == IBUS_Hyper_R)
-	    return TRUE;
+    n = candidate_list_get_size (list);
+    if (texts->len > n)
+        g_ptr_array_set_size (texts, n);
+
+    ibus_lookup_table_clear (table);
+    for (i = 0; i < n; i++) {
+        const char* value = candidate_list_get_nth_value (list, i);
+        IBusText* text;
+
+        if (i == texts->len) {
+            g_ptr_array_add (texts, NULL);
+        } else {
+            text = g_ptr_array_index (texts, i);
+            if (strcmp (ibus_text_get_text (text), value) != 0)
+                g_clear_object (&g_ptr_array_index (texts, i));
+        }
+
+        if (g_ptr_array_index (texts, i) == NULL) {
+            text = ibus_text_new_from_string (value);
+            g_ptr_array_index (texts, i) = g_object_ref_sink (text);
+        }
+
+        ibus_lookup_table_append_candidate (table,
+                                            g_ptr_array_index (texts, i));
     }
+}
+
+/* Clears the table and frees the texts kept for the candidates. */
+static void
+lookup_table_drop_candidates (IBusLookupTable *table)
+{
+    ibus_lookup_table_clear (table);
+    g_object_set_data (G_OBJECT(table), "candidates", NULL);
+}
+
+static void
+ibus_hangul_engine_candidate_clicked (IBusEngine     *engine,
+                                      guint           index,
+                                      guint           button,
+                                      guint           state)
+{
+    IBusHangulEngine *hangul = (IBusHangulEngine *) engine;
+    if (hangul == NULL)
+	return;
+
+    if (hangul->table == NULL || hangul->hanja_list == NULL)
+	return;
+
+    ibus_lookup_table_set_cursor_pos (hangul->table, index);
+    ibus_hangul_engine_commit_current_candidate (hangul);
 
-    if (list->all_modifiers & IBUS_META_MASK) {
-	if (keyval == IBUS_Meta_L || keyval == IBUS_Meta_R)
-	    return TRUE;
+    if (composer_get_hanja_mode (hangul->composer)) {
+	ibus_hangul_engine_update_lookup_table (hangul);
+    } else {
+	ibus_hangul_engine_hide_lookup_table (hangul);
     }
+}
+
+static void
+ibus_hangul_engine_set_content_type (IBusEngine     *engine,
+                                     guint           purpose,
+                                     guint           hints)
+{
+    IBusHangulEngine *hangul = (IBusHangulEngine *) engine;
+    if (hangul == NULL)
+        return;
+
+    // A password field doesn't use the composer, its keys must come after
+    // the text of the burst.
+    ibus_hangul_engine_flush_burst (hangul);
 
-    return FALSE;
+    hangul->input_purpose = purpose;
 }
+
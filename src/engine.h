@@ -30,5 +30,8 @@ GType   ibus_hangul_engine_get_type    (void);
 
 void    ibus_hangul_init (IBusBus *bus);
 void    ibus_hangul_exit (void);
+void    ibus_hangul_load (void);
+
+gchar*  ibus_hangul_get_memory_report (void);
 
 #endif
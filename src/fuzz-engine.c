@@ -0,0 +1,639 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * A libFuzzer harness for the engine. Each input is a script of client
+ * events: key presses with modifiers, focus changes, resets, content types,
+ * surrounding text, property activations and candidate clicks. They are
+ * played to a new engine as a client would send them, and what the engine
+ * sends back is applied to an emulated client, which checks that:
+ *
+ *   - DeleteSurroundingText only deletes text before the cursor which the
+ *     client has,
+ *   - the cursor of UpdatePreeditText is within the preedit text,
+ *   - CommitText never commits an empty string.
+ *
+ * Each event must be handled within a time budget, so slow paths are
+ * reported as crashes with the input that made them. The budget is 100 ms,
+ * and can be set in milliseconds with IBUS_HANGUL_FUZZ_BUDGET. The time of
+ * the slowest input is printed at exit.
+ *
+ * Configure with --enable-fuzzing, which needs clang, and run it with
+ * "make fuzz" in src. AFL++ can build it as well, with afl-clang-fast.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <glib/gstdio.h>
+#include <ibus.h>
+
+#include "engine.h"
+
+#define FUZZ_DEFAULT_BUDGET     100     /* ms */
+
+/* The burst-interval when the input turns the burst mode on. Every key
+ * after the first one is a part of a burst, so the input replays the same
+ * way however long the keys take. */
+#define FUZZ_BURST_INTERVAL     (3600 * 1000)   /* ms */
+
+typedef struct {
+    const guint8 *data;
+    size_t        size;
+    size_t        pos;
+} FuzzInput;
+
+enum {
+    FUZZ_OP_KEY = 0,            /* 0 - 7, keys are the most of the events */
+    FUZZ_OP_FOCUS_IN = 8,
+    FUZZ_OP_FOCUS_OUT,
+    FUZZ_OP_RESET,
+    FUZZ_OP_ENABLE,
+    FUZZ_OP_DISABLE,
+    FUZZ_OP_CAPABILITIES,
+    FUZZ_OP_CONTENT_TYPE,
+    FUZZ_OP_SURROUNDING_TEXT,
+    FUZZ_OP_PROPERTY,
+    FUZZ_OP_CANDIDATE_CLICKED,
+    FUZZ_OP_NAVIGATE,
+    FUZZ_OP_WAIT,
+    FUZZ_N_OPS
+};
+
+/* Keys which have no keycode in the us keymap, or which the engine treats
+ * specially. */
+static const guint special_keyvals[] = {
+    IBUS_Hangul, IBUS_Hangul_Hanja, IBUS_F9, IBUS_Escape,
+    IBUS_Left, IBUS_Right, IBUS_Up, IBUS_Down,
+    IBUS_Page_Up, IBUS_Page_Down, IBUS_Home, IBUS_End,
+    IBUS_Delete, IBUS_Alt_R, IBUS_Control_R, IBUS_KP_1,
+    IBUS_KP_Enter, IBUS_Super_L,
+};
+
+/* The text which the surrounding text is made of. */
+static const char * const surrounding_chars[] = {
+    "가", "한", "국", "어", "漢", "字", "ㄱ", "ㅏ", "a", "Z", " ", "\n",
+    "é", "😀",
+};
+
+static const char * const keyboards[] = {
+    "2", "2y", "32", "39", "3f", "3s", "3y", "ro", "ahn",
+};
+
+static const char * const preedit_modes[] = {
+    "none", "syllable", "word",
+};
+
+static const char * const properties[] = {
+    "hanja_mode", "InputMode",
+};
+
+static IBusKeymap *keymap = NULL;
+static GSettings *settings = NULL;
+static GDBusConnection *connection = NULL;
+static GDBusConnection *peer = NULL;
+static gint64 budget;
+static gint64 slowest_input = 0;
+static gchar *data_dir = NULL;
+
+/*
+ * The emulated client. The filter runs on the GDBus worker thread.
+ */
+static GMutex client_lock;
+static GString *client_text = NULL;     /* the text before the cursor */
+static GString *client_after = NULL;    /* the text after the cursor */
+static gboolean client_changed = FALSE;
+
+/* ------------------------------------------------------------------ */
+/* the emulated client                                                 */
+
+static void
+fuzz_client_delete (gint offset, guint nchars)
+{
+    glong len = g_utf8_strlen (client_text->str, -1);
+    const gchar *start;
+
+    // The engine deletes only what it has committed or read from the
+    // surrounding text, which is always before the cursor.
+    if (offset >= 0 || (glong) nchars != -offset || -offset > len)
+        g_error ("DeleteSurroundingText (%d, %u) with %ld chars before "
+                 "the cursor", offset, nchars, len);
+
+    start = g_utf8_offset_to_pointer (client_text->str, len + offset);
+    g_string_truncate (client_text, start - client_text->str);
+}
+
+static GDBusMessage*
+fuzz_filter (GDBusConnection *connection,
+             GDBusMessage    *message,
+             gboolean         incoming,
+             gpointer         user_data)
+{
+    const gchar *member;
+    GVariant *body;
+
+    if (incoming ||
+        g_dbus_message_get_message_type (message) !=
+        G_DBUS_MESSAGE_TYPE_SIGNAL)
+        return message;
+
+    member = g_dbus_message_get_member (message);
+    body = g_dbus_message_get_body (message);
+
+    g_mutex_lock (&client_lock);
+
+    if (strcmp (member, "CommitText") == 0) {
+        GVariant *variant;
+        GVariant *text;
+        const gchar *str;
+
+        // IBusText is serialized as (sa{sv}sv)
+        g_variant_get (body, "(v)", &variant);
+        text = g_variant_get_child_value (variant, 2);
+        str = g_variant_get_string (text, NULL);
+        if (str[0] == '\0')
+            g_error ("CommitText with an empty text");
+        g_string_append (client_text, str);
+        client_changed = TRUE;
+        g_variant_unref (text);
+        g_variant_unref (variant);
+    } else if (strcmp (member, "UpdatePreeditText") == 0) {
+        GVariant *variant;
+        GVariant *text;
+        guint cursor_pos;
+        gboolean visible;
+        guint mode;
+        glong len;
+
+        g_variant_get (body, "(vubu)", &variant, &cursor_pos, &visible, &mode);
+        text = g_variant_get_child_value (variant, 2);
+        len = g_utf8_strlen (g_variant_get_string (text, NULL), -1);
+        if (cursor_pos > len)
+            g_error ("UpdatePreeditText with the cursor at %u of %ld chars",
+                     cursor_pos, len);
+        g_variant_unref (text);
+        g_variant_unref (variant);
+    } else if (strcmp (member, "DeleteSurroundingText") == 0) {
+        gint offset;
+        guint nchars;
+
+        g_variant_get (body, "(iu)", &offset, &nchars);
+        fuzz_client_delete (offset, nchars);
+        client_changed = TRUE;
+    } else if (strcmp (member, "ForwardKeyEvent") == 0) {
+        guint keyval, keycode, state;
+
+        g_variant_get (body, "(uuu)", &keyval, &keycode, &state);
+        if (!(state & (IBUS_RELEASE_MASK | IBUS_CONTROL_MASK |
+                       IBUS_MOD1_MASK)) &&
+            keyval >= 0x20 && keyval < 0x7f) {
+            g_string_append_c (client_text, keyval);
+            client_changed = TRUE;
+        }
+    }
+
+    g_mutex_unlock (&client_lock);
+
+    return message;
+}
+
+static void
+fuzz_on_peer_connected (GObject      *source_object,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+    GError *error = NULL;
+
+    peer = g_dbus_connection_new_finish (result, &error);
+    if (peer == NULL)
+        g_error ("Failed to connect the peer: %s", error->message);
+}
+
+/**
+ * Connects two ends of a socketpair as peers. The engines are put on
+ * connection, and the peer only receives.
+ */
+static void
+fuzz_connect (void)
+{
+    GSocket *sockets[2];
+    GSocketConnection *streams[2];
+    GError *error = NULL;
+    gchar *guid;
+    int fds[2];
+    guint i;
+
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        g_error ("socketpair failed");
+
+    for (i = 0; i < 2; i++) {
+        sockets[i] = g_socket_new_from_fd (fds[i], &error);
+        if (sockets[i] == NULL)
+            g_error ("%s", error->message);
+        streams[i] = g_socket_connection_factory_create_connection (sockets[i]);
+    }
+
+    guid = g_dbus_generate_guid ();
+    g_dbus_connection_new (G_IO_STREAM (streams[0]), guid,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER |
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_ALLOW_ANONYMOUS,
+            NULL, NULL, fuzz_on_peer_connected, NULL);
+    connection = g_dbus_connection_new_sync (G_IO_STREAM (streams[1]), NULL,
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+            NULL, NULL, &error);
+    if (connection == NULL)
+        g_error ("Failed to connect: %s", error->message);
+
+    while (peer == NULL)
+        g_main_context_iteration (NULL, TRUE);
+
+    g_free (guid);
+    for (i = 0; i < 2; i++) {
+        g_object_unref (streams[i]);
+        g_object_unref (sockets[i]);
+    }
+
+    g_dbus_connection_add_filter (connection, fuzz_filter, NULL, NULL);
+}
+
+/* ------------------------------------------------------------------ */
+/* the script                                                          */
+
+static guint
+fuzz_input_next (FuzzInput *input)
+{
+    if (input->pos >= input->size)
+        return 0;
+    return input->data[input->pos++];
+}
+
+static void
+fuzz_set_string (const char *key, const char *value)
+{
+    gchar *old = g_settings_get_string (settings, key);
+
+    if (strcmp (old, value) != 0)
+        g_settings_set_string (settings, key, value);
+    g_free (old);
+}
+
+static void
+fuzz_set_boolean (const char *key, gboolean value)
+{
+    if (g_settings_get_boolean (settings, key) != value)
+        g_settings_set_boolean (settings, key, value);
+}
+
+static void
+fuzz_set_uint (const char *key, guint value)
+{
+    if (g_settings_get_uint (settings, key) != value)
+        g_settings_set_uint (settings, key, value);
+}
+
+/**
+ * Runs the main loop until the lookups of the engine are done. Each
+ * pending lookup holds a reference to the engine.
+ */
+static void
+fuzz_wait (IBusEngine *engine, guint ref_count)
+{
+    g_dbus_connection_flush_sync (connection, NULL, NULL);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+    while (G_OBJECT (engine)->ref_count > ref_count)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+fuzz_send_surrounding_text (IBusEngine *engine)
+{
+    IBusText *text;
+    gchar *str;
+    guint cursor_pos;
+
+    g_mutex_lock (&client_lock);
+    str = g_strconcat (client_text->str, client_after->str, NULL);
+    cursor_pos = g_utf8_strlen (client_text->str, -1);
+    client_changed = FALSE;
+    g_mutex_unlock (&client_lock);
+
+    text = ibus_text_new_from_string (str);
+    g_signal_emit_by_name (engine, "set-surrounding-text",
+                           text, cursor_pos, cursor_pos);
+    g_free (str);
+}
+
+static void
+fuzz_key (IBusEngine *engine, FuzzInput *input)
+{
+    guint byte = fuzz_input_next (input);
+    guint bits = fuzz_input_next (input);
+    guint modifiers = 0;
+    guint keyval;
+    guint keycode;
+    gboolean handled;
+
+    if (bits & 0x01)
+        modifiers |= IBUS_SHIFT_MASK;
+    if (bits & 0x02)
+        modifiers |= IBUS_CONTROL_MASK;
+    if (bits & 0x04)
+        modifiers |= IBUS_MOD1_MASK;
+    if (bits & 0x08)
+        modifiers |= IBUS_LOCK_MASK;
+    if (bits & 0x10)
+        modifiers |= IBUS_MOD4_MASK;
+
+    if (byte < 0xc0) {
+        // evdev keycodes from 1 to space, as a keyboard sends them
+        keycode = 1 + byte % 57;
+        keyval = ibus_keymap_lookup_keysym (keymap, keycode,
+                modifiers & (IBUS_SHIFT_MASK | IBUS_LOCK_MASK));
+    } else {
+        keyval = special_keyvals[byte % G_N_ELEMENTS (special_keyvals)];
+        keycode = 0;
+    }
+
+    g_signal_emit_by_name (engine, "process-key-event",
+                           keyval, keycode, modifiers, &handled);
+    // Some clients don't send the release of handled keys.
+    if (!(bits & 0x20)) {
+        g_signal_emit_by_name (engine, "process-key-event",
+                               keyval, keycode, modifiers | IBUS_RELEASE_MASK,
+                               &handled);
+    }
+}
+
+/**
+ * Replaces the text of the client, as if the user moved the cursor or
+ * the application changed the text.
+ */
+static void
+fuzz_surrounding_text (IBusEngine *engine, FuzzInput *input)
+{
+    guint len = fuzz_input_next (input) % 16;
+    guint cursor_pos = fuzz_input_next (input) % (len + 1);
+    guint i;
+
+    g_mutex_lock (&client_lock);
+    g_string_truncate (client_text, 0);
+    g_string_truncate (client_after, 0);
+    for (i = 0; i < len; i++) {
+        guint c = fuzz_input_next (input) % G_N_ELEMENTS (surrounding_chars);
+        g_string_append (i < cursor_pos ? client_text : client_after,
+                         surrounding_chars[c]);
+    }
+    g_mutex_unlock (&client_lock);
+
+    fuzz_send_surrounding_text (engine);
+}
+
+static void
+fuzz_op (IBusEngine *engine, FuzzInput *input, guint op, guint *caps,
+         guint ref_count)
+{
+    guint arg;
+
+    switch (op) {
+    case FUZZ_OP_FOCUS_IN:
+        g_signal_emit_by_name (engine, "focus-in");
+        break;
+    case FUZZ_OP_FOCUS_OUT:
+        g_signal_emit_by_name (engine, "focus-out");
+        break;
+    case FUZZ_OP_RESET:
+        g_signal_emit_by_name (engine, "reset");
+        break;
+    case FUZZ_OP_ENABLE:
+        g_signal_emit_by_name (engine, "enable");
+        break;
+    case FUZZ_OP_DISABLE:
+        g_signal_emit_by_name (engine, "disable");
+        break;
+    case FUZZ_OP_CAPABILITIES:
+        *caps = fuzz_input_next (input) & (IBUS_CAP_PREEDIT_TEXT |
+                                           IBUS_CAP_AUXILIARY_TEXT |
+                                           IBUS_CAP_LOOKUP_TABLE |
+                                           IBUS_CAP_FOCUS |
+                                           IBUS_CAP_PROPERTY |
+                                           IBUS_CAP_SURROUNDING_TEXT);
+        g_signal_emit_by_name (engine, "set-capabilities", *caps);
+        break;
+    case FUZZ_OP_CONTENT_TYPE:
+        arg = fuzz_input_next (input);
+        g_signal_emit_by_name (engine, "set-content-type",
+                               arg % (IBUS_INPUT_PURPOSE_PIN + 1),
+                               fuzz_input_next (input));
+        break;
+    case FUZZ_OP_SURROUNDING_TEXT:
+        // Clients send the surrounding text only if the engine can use it.
+        if (*caps & IBUS_CAP_SURROUNDING_TEXT)
+            fuzz_surrounding_text (engine, input);
+        break;
+    case FUZZ_OP_PROPERTY:
+        arg = fuzz_input_next (input);
+        g_signal_emit_by_name (engine, "property-activate",
+                               properties[arg % G_N_ELEMENTS (properties)],
+                               (arg & 0x80) ? PROP_STATE_CHECKED :
+                                              PROP_STATE_UNCHECKED);
+        break;
+    case FUZZ_OP_CANDIDATE_CLICKED:
+        // The index is in the page, which has at most 10 candidates.
+        g_signal_emit_by_name (engine, "candidate-clicked",
+                               fuzz_input_next (input) % 10, 1, 0);
+        break;
+    case FUZZ_OP_NAVIGATE:
+        arg = fuzz_input_next (input) % 4;
+        g_signal_emit_by_name (engine,
+                               arg == 0 ? "page-up" :
+                               arg == 1 ? "page-down" :
+                               arg == 2 ? "cursor-up" : "cursor-down");
+        break;
+    case FUZZ_OP_WAIT:
+        fuzz_wait (engine, ref_count);
+        break;
+    default:
+        fuzz_key (engine, input);
+        break;
+    }
+}
+
+static void
+fuzz_remove_dir (const gchar *dir)
+{
+    GDir *d = g_dir_open (dir, 0, NULL);
+    const gchar *name;
+
+    if (d == NULL)
+        return;
+
+    while ((name = g_dir_read_name (d)) != NULL) {
+        gchar *path = g_build_filename (dir, name, NULL);
+        if (g_file_test (path, G_FILE_TEST_IS_DIR))
+            fuzz_remove_dir (path);
+        else
+            g_unlink (path);
+        g_free (path);
+    }
+    g_dir_close (d);
+    g_rmdir (dir);
+}
+
+static void
+fuzz_report (void)
+{
+    g_printerr ("slowest input: %" G_GINT64_FORMAT " us\n", slowest_input);
+
+    fuzz_remove_dir (data_dir);
+    g_free (data_dir);
+}
+
+int
+LLVMFuzzerInitialize (int *argc, char ***argv)
+{
+    const gchar *env;
+
+    // The settings are kept in memory, so the harness doesn't change the
+    // settings of the user. GSETTINGS_SCHEMA_DIR must point to the schema.
+    // The data directory is a new one, so no file of the user or of an
+    // earlier run is read. The engine is built without a user dictionary.
+    g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+    data_dir = g_build_filename (g_get_tmp_dir (), "fuzz-engine-XXXXXX",
+                                 NULL);
+    if (g_mkdtemp (data_dir) == NULL) {
+        g_printerr ("Can't create %s\n", data_dir);
+        exit (1);
+    }
+    g_setenv ("XDG_DATA_HOME", data_dir, TRUE);
+
+    env = g_getenv ("IBUS_HANGUL_FUZZ_BUDGET");
+    budget = (env != NULL ? g_ascii_strtoll (env, NULL, 10) :
+                            FUZZ_DEFAULT_BUDGET) * 1000;
+
+    ibus_init ();
+    ibus_hangul_init (NULL);
+
+    settings = g_settings_new ("org.freedesktop.ibus.engine.hangul");
+    keymap = ibus_keymap_get ("us");
+    client_text = g_string_new (NULL);
+    client_after = g_string_new (NULL);
+
+    fuzz_connect ();
+
+    atexit (fuzz_report);
+
+    return 0;
+}
+
+int
+LLVMFuzzerTestOneInput (const guint8 *data, size_t size)
+{
+    static guint n_engines = 0;
+    FuzzInput input = { data, size, 0 };
+    IBusEngine *engine;
+    gchar *path;
+    guint config;
+    guint caps;
+    guint ref_count;
+    gint64 input_start;
+    gint64 elapsed;
+
+    // The first two bytes are the settings.
+    config = fuzz_input_next (&input);
+    fuzz_set_string ("hangul-keyboard",
+                     keyboards[config % G_N_ELEMENTS (keyboards)]);
+    fuzz_set_string ("preedit-mode",
+                     preedit_modes[(config >> 4) % G_N_ELEMENTS (preedit_modes)]);
+    config = fuzz_input_next (&input);
+    fuzz_set_boolean ("use-event-forwarding", config & 0x01);
+    fuzz_set_boolean ("word-commit", config & 0x02);
+    fuzz_set_boolean ("auto-reorder", config & 0x04);
+    fuzz_set_string ("initial-input-mode",
+                     (config & 0x08) ? "latin" : "hangul");
+    // Not the default interval, which would make it depend on the time.
+    fuzz_set_uint ("burst-interval",
+                   (config & 0x10) ? FUZZ_BURST_INTERVAL : 0);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    g_mutex_lock (&client_lock);
+    g_string_truncate (client_text, 0);
+    g_string_truncate (client_after, 0);
+    client_changed = FALSE;
+    g_mutex_unlock (&client_lock);
+
+    input_start = g_get_monotonic_time ();
+
+    path = g_strdup_printf ("/org/freedesktop/IBus/Engine/%u", ++n_engines);
+    engine = ibus_engine_new_with_type (IBUS_TYPE_HANGUL_ENGINE, "hangul",
+                                        path, connection);
+    g_object_ref_sink (engine);
+    g_free (path);
+    ref_count = G_OBJECT (engine)->ref_count;
+
+    caps = IBUS_CAP_PREEDIT_TEXT | IBUS_CAP_AUXILIARY_TEXT |
+           IBUS_CAP_LOOKUP_TABLE | IBUS_CAP_FOCUS | IBUS_CAP_SURROUNDING_TEXT;
+    g_signal_emit_by_name (engine, "set-capabilities", caps);
+    g_signal_emit_by_name (engine, "enable");
+    g_signal_emit_by_name (engine, "focus-in");
+
+    while (input.pos < input.size) {
+        guint op = fuzz_input_next (&input) % FUZZ_N_OPS;
+        gint64 start = g_get_monotonic_time ();
+        gboolean changed;
+
+        fuzz_op (engine, &input, op, &caps, ref_count);
+
+        // The client tells the engine about the text it has changed
+        // before the next event.
+        g_dbus_connection_flush_sync (connection, NULL, NULL);
+        while (g_main_context_iteration (NULL, FALSE))
+            ;
+        g_mutex_lock (&client_lock);
+        changed = client_changed;
+        g_mutex_unlock (&client_lock);
+        if (changed && (caps & IBUS_CAP_SURROUNDING_TEXT))
+            fuzz_send_surrounding_text (engine);
+
+        elapsed = g_get_monotonic_time () - start;
+        if (elapsed > budget) {
+            g_error ("Event %u at %zu took %" G_GINT64_FORMAT " us",
+                     op, input.pos, elapsed);
+        }
+    }
+
+    fuzz_wait (engine, ref_count);
+    ibus_object_destroy ((IBusObject *) engine);
+    g_object_unref (engine);
+    g_dbus_connection_flush_sync (connection, NULL, NULL);
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+
+    elapsed = g_get_monotonic_time () - input_start;
+    slowest_input = MAX (slowest_input, elapsed);
+
+    return 0;
+}
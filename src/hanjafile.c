@@ -0,0 +1,348 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include "hanjafile.h"
+
+/* the number of comments which are kept after they are read */
+#define HANJA_FILE_COMMENT_CACHE_SIZE  16
+
+typedef struct {
+    const char *key;
+    const char *value;
+    guint32     comment_offset; /* in the file */
+    guint32     comment_len;    /* 0 if there is no comment */
+} HanjaFileEntry;
+
+typedef struct {
+    guint       entry;
+    gchar      *comment;        /* NULL if the slot is empty */
+} HanjaFileCacheSlot;
+
+struct _HanjaFile {
+    gint          ref_count;
+    int           fd;           /* the comments are read from it */
+    GArray       *entries;      /* HanjaFileEntry sorted by key */
+    GStringChunk *strings;
+    gsize         strings_size; /* the bytes put in strings */
+
+    GMutex        cache_lock;
+    /* the most recently used first */
+    HanjaFileCacheSlot cache[HANJA_FILE_COMMENT_CACHE_SIZE];
+};
+
+static gint
+hanja_file_compare_entry (gconstpointer a, gconstpointer b)
+{
+    const HanjaFileEntry *e1 = a;
+    const HanjaFileEntry *e2 = b;
+    gint r;
+
+    r = strcmp (e1->key, e2->key);
+    if (r != 0)
+        return r;
+
+    // The entries of a key keep the order of the file.
+    return e1->comment_offset < e2->comment_offset ? -1 :
+           (e1->comment_offset > e2->comment_offset ? 1 : 0);
+}
+
+static void
+hanja_file_parse (HanjaFile *file, const gchar *contents, gsize length)
+{
+    const gchar *p = contents;
+    const gchar *end = contents + length;
+
+    while (p < end) {
+        const gchar *line_end = memchr (p, '\n', end - p);
+        const gchar *key_end;
+        const gchar *value_end;
+        const gchar *comment;
+        const gchar *comment_end;
+        HanjaFileEntry entry;
+
+        if (line_end == NULL)
+            line_end = end;
+
+        comment_end = line_end;
+        if (comment_end > p && comment_end[-1] == '\r')
+            comment_end--;
+
+        key_end = memchr (p, ':', comment_end - p);
+        if (p[0] == '#' || key_end == NULL || key_end == p)
+            goto next;
+
+        value_end = memchr (key_end + 1, ':', comment_end - key_end - 1);
+        if (value_end == NULL) {
+            value_end = comment_end;
+            comment = comment_end;
+        } else {
+            comment = value_end + 1;
+        }
+
+        if (value_end == key_end + 1)
+            goto next;
+
+        // The same keys come together, only one copy is kept.
+        entry.key = NULL;
+        if (file->entries->len > 0) {
+            const char *prev = g_array_index (file->entries, HanjaFileEntry,
+                                              file->entries->len - 1).key;
+            if (strncmp (prev, p, key_end - p) == 0 &&
+                prev[key_end - p] == '\0')
+                entry.key = prev;
+        }
+        if (entry.key == NULL) {
+            entry.key = g_string_chunk_insert_len (file->strings,
+                                                   p, key_end - p);
+            file->strings_size += key_end - p + 1;
+        }
+        entry.value = g_string_chunk_insert_len (file->strings, key_end + 1,
+                                                 value_end - key_end - 1);
+        file->strings_size += value_end - key_end;
+        entry.comment_offset = comment - contents;
+        entry.comment_len = comment_end - comment;
+        g_array_append_val (file->entries, entry);
+
+next:
+        p = line_end + 1;
+    }
+
+    g_array_sort (file->entries, hanja_file_compare_entry);
+}
+
+/**
+ * Loads the keys and the values of the file at path.
+ * Returns NULL if it can't be read.
+ */
+HanjaFile*
+hanja_file_load (const char *path)
+{
+    HanjaFile *file;
+    GMappedFile *mapped;
+    int fd;
+
+    g_return_val_if_fail (path != NULL, NULL);
+
+    fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+
+    mapped = g_mapped_file_new_from_fd (fd, FALSE, NULL);
+    if (mapped == NULL) {
+        close (fd);
+        return NULL;
+    }
+
+    // The comments are addressed by 32 bit offsets.
+    if (g_mapped_file_get_length (mapped) > G_MAXUINT32) {
+        g_mapped_file_unref (mapped);
+        close (fd);
+        return NULL;
+    }
+
+    file = g_new0 (HanjaFile, 1);
+    file->ref_count = 1;
+    file->fd = fd;
+    file->entries = g_array_new (FALSE, FALSE, sizeof (HanjaFileEntry));
+    file->strings = g_string_chunk_new (4096);
+    g_mutex_init (&file->cache_lock);
+
+    hanja_file_parse (file, g_mapped_file_get_contents (mapped),
+                      g_mapped_file_get_length (mapped));
+
+    g_mapped_file_unref (mapped);
+
+    return file;
+}
+
+HanjaFile*
+hanja_file_ref (HanjaFile *file)
+{
+    g_return_val_if_fail (file != NULL, NULL);
+
+    g_atomic_int_inc (&file->ref_count);
+    return file;
+}
+
+void
+hanja_file_unref (HanjaFile *file)
+{
+    guint i;
+
+    if (file == NULL)
+        return;
+
+    if (!g_atomic_int_dec_and_test (&file->ref_count))
+        return;
+
+    for (i = 0; i < HANJA_FILE_COMMENT_CACHE_SIZE; i++)
+        g_free (file->cache[i].comment);
+    g_mutex_clear (&file->cache_lock);
+    g_array_free (file->entries, TRUE);
+    g_string_chunk_free (file->strings);
+    close (file->fd);
+    g_free (file);
+}
+
+gboolean
+hanja_file_match_exact (HanjaFile  *file,
+                        const char *key,
+                        guint      *first,
+                        guint      *n)
+{
+    GArray *entries = file->entries;
+    guint lo = 0;
+    guint hi = entries->len;
+    guint end;
+
+    // the first entry whose key is not less than key
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (strcmp (g_array_index (entries, HanjaFileEntry, mid).key, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (end = lo; end < entries->len; end++) {
+        if (strcmp (g_array_index (entries, HanjaFileEntry, end).key, key) != 0)
+            break;
+    }
+
+    *first = lo;
+    *n = end - lo;
+
+    return end > lo;
+}
+
+guint
+hanja_file_get_size (HanjaFile *file)
+{
+    return file->entries->len;
+}
+
+/**
+ * The strings are counted as they were put in the chunks, so the unused
+ * end of the last chunk is not. The comments are not in memory.
+ */
+gsize
+hanja_file_get_memory_size (HanjaFile *file)
+{
+    return sizeof (HanjaFile) +
+           file->entries->len * sizeof (HanjaFileEntry) +
+           file->strings_size;
+}
+
+const char*
+hanja_file_get_key (HanjaFile *file, guint entry)
+{
+    g_return_val_if_fail (entry < file->entries->len, NULL);
+    return g_array_index (file->entries, HanjaFileEntry, entry).key;
+}
+
+const char*
+hanja_file_get_value (HanjaFile *file, guint entry)
+{
+    g_return_val_if_fail (entry < file->entries->len, NULL);
+    return g_array_index (file->entries, HanjaFileEntry, entry).value;
+}
+
+static gchar*
+hanja_file_read_comment (HanjaFile *file, const HanjaFileEntry *e)
+{
+    gchar *comment = g_malloc (e->comment_len + 1);
+    gsize done = 0;
+
+    while (done < e->comment_len) {
+        ssize_t r = pread (file->fd, comment + done, e->comment_len - done,
+                           e->comment_offset + done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        done += r;
+    }
+    comment[done] = '\0';
+
+    // The file may have been rewritten in place; it will be reloaded soon.
+    if (!g_utf8_validate (comment, done, NULL)) {
+        g_free (comment);
+        return NULL;
+    }
+
+    return comment;
+}
+
+gchar*
+hanja_file_get_comment (HanjaFile *file, guint entry)
+{
+    const HanjaFileEntry *e;
+    HanjaFileCacheSlot slot;
+    gchar *comment;
+    guint i;
+
+    g_return_val_if_fail (entry < file->entries->len, NULL);
+
+    e = &g_array_index (file->entries, HanjaFileEntry, entry);
+    if (e->comment_len == 0)
+        return NULL;
+
+    g_mutex_lock (&file->cache_lock);
+
+    for (i = 0; i < HANJA_FILE_COMMENT_CACHE_SIZE; i++) {
+        if (file->cache[i].comment == NULL)
+            break;
+        if (file->cache[i].entry == entry)
+            goto found;
+    }
+
+    comment = hanja_file_read_comment (file, e);
+    if (comment == NULL) {
+        g_mutex_unlock (&file->cache_lock);
+        return NULL;
+    }
+
+    // Put it in the last slot, which is empty or the least recently used.
+    i = MIN (i, HANJA_FILE_COMMENT_CACHE_SIZE - 1);
+    g_free (file->cache[i].comment);
+    file->cache[i].entry = entry;
+    file->cache[i].comment = comment;
+
+found:
+    slot = file->cache[i];
+    memmove (&file->cache[1], &file->cache[0], i * sizeof (slot));
+    file->cache[0] = slot;
+    comment = g_strdup (slot.comment);
+
+    g_mutex_unlock (&file->cache_lock);
+
+    return comment;
+}
@@ -0,0 +1,60 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __HANJA_FILE_H__
+#define __HANJA_FILE_H__
+
+#include <glib.h>
+
+/**
+ * A dictionary file in libhangul's format, "key:value:comment" lines.
+ * Only the keys and the values are loaded into memory. The comments,
+ * which take most of the file, are left in the file and are read by the
+ * entry when they are shown. The recently read ones are cached.
+ * The file is kept open, so the comments still come from the same file
+ * after it is replaced on the disk.
+ * A HanjaFile is not changed after it is loaded, and may be used from
+ * any thread.
+ */
+typedef struct _HanjaFile HanjaFile;
+
+HanjaFile*  hanja_file_load         (const char *path);
+HanjaFile*  hanja_file_ref          (HanjaFile  *file);
+void        hanja_file_unref        (HanjaFile  *file);
+
+/* the number of entries, which are sorted by key */
+guint       hanja_file_get_size     (HanjaFile  *file);
+/* the bytes which the keys and the values take in memory */
+gsize       hanja_file_get_memory_size (HanjaFile *file);
+
+/* the entries of a key are at [*first, *first + *n) in the order of the file */
+gboolean    hanja_file_match_exact  (HanjaFile  *file,
+                                     const char *key,
+                                     guint      *first,
+                                     guint      *n);
+
+const char* hanja_file_get_key      (HanjaFile  *file,
+                                     guint       entry);
+const char* hanja_file_get_value    (HanjaFile  *file,
+                                     guint       entry);
+/* returns a newly allocated string, or NULL if the entry has no comment */
+gchar*      hanja_file_get_comment  (HanjaFile  *file,
+                                     guint       entry);
+
+#endif
@@ -0,0 +1,36 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __LOOKUP_METHOD_H__
+#define __LOOKUP_METHOD_H__
+
+/**
+ * How the key of a hanja lookup is matched with the keys of a dictionary.
+ * The composer makes the key and the method, and the dictionary uses them.
+ */
+typedef enum {
+    /* the whole key */
+    LOOKUP_METHOD_EXACT,
+    /* the prefixes of the key, the longest first */
+    LOOKUP_METHOD_PREFIX,
+    /* the suffixes of the key, the longest first */
+    LOOKUP_METHOD_SUFFIX,
+} LookupMethod;
+
+#endif /* __LOOKUP_METHOD_H__ */
@@ -23,16 +23,23 @@
 #endif
 
 #include <ibus.h>
+#include <glib-unix.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <locale.h>
 #include <hangul.h>
 
 #include "i18n.h"
 #include "engine.h"
+#include "stats.h"
 
 
+/* seconds to wait for the connection to the bus */
+#define CONNECT_TIMEOUT     10
+
 static IBusBus *bus = NULL;
 static IBusFactory *factory = NULL;
+static guint connect_timeout_id = 0;
 
 /* options */
 static gboolean ibus = FALSE;
@@ -55,32 +62,19 @@ ibus_disconnected_cb (IBusBus  *bus,
 }
 
 
-static void
-start_component (void)
+static gboolean
+dump_memory_usage_cb (gpointer user_data)
 {
-    IBusComponent *component;
-    IBusConfig* config;
-    gboolean res;
-
-    ibus_init ();
-
-    bus = ibus_bus_new ();
-
-    res = ibus_bus_is_connected (bus);
-    if (!res) {
-        g_warning ("Unable to connect to IBus");
-        exit (2);
-    }
-
-    config = ibus_bus_get_config (bus);
-    if (config == NULL) {
-        g_warning ("Unable to connect to IBus config component");
-        exit (3);
-    }
-
-    g_signal_connect (bus, "disconnected", G_CALLBACK (ibus_disconnected_cb), NULL);
+    gchar* report = ibus_hangul_get_memory_report ();
+    g_message ("memory usage:\n%s", report);
+    g_free (report);
+    return G_SOURCE_CONTINUE;
+}
 
-    ibus_hangul_init (bus);
+static IBusComponent*
+create_component (void)
+{
+    IBusComponent *component;
 
     component = ibus_component_new ("org.freedesktop.IBus.Hangul",
                                     N_("Korean input method"),
@@ -99,19 +93,125 @@ start_component (void)
                                                      "Peng Huang <shawn.p.huang@gmail.com>",
                                                      PKGDATADIR"/icon/ibus-hangul.svg",
                                                      "us"));
+    return component;
+}
+
+static void
+request_name_done_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+    GError *error = NULL;
+
+    ibus_bus_request_name_async_finish (IBUS_BUS (source_object), result,
+                                        &error);
+    if (error != NULL) {
+        g_warning ("Unable to request the name: %s", error->message);
+        g_clear_error (&error);
+    }
+}
+
+static void
+register_component_done_cb (GObject      *source_object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+    GError *error = NULL;
 
-    factory = ibus_factory_new (ibus_bus_get_connection (bus));
+    if (!ibus_bus_register_component_async_finish (IBUS_BUS (source_object),
+                                                   result, &error)) {
+        g_warning ("Unable to register the component: %s", error->message);
+        g_clear_error (&error);
+    }
+}
 
+static IBusEngine*
+create_engine_cb (IBusFactory *factory,
+                  const gchar *engine_name,
+                  gpointer     user_data)
+{
+    // Load before the first engine exists, so that the compose tables of
+    // IBusEngineSimple are measured. The factory creates the engine.
+    ibus_hangul_load ();
+
+    return NULL;
+}
+
+static void
+ibus_connected_cb (IBusBus  *bus,
+                   gpointer  user_data)
+{
+    GDBusConnection *connection;
+    IBusComponent *component;
+    GError *error = NULL;
+
+    // Only the first connection; the component quits when it is lost.
+    if (factory != NULL)
+        return;
+
+    g_debug ("bus connected");
+
+    if (connect_timeout_id != 0) {
+        g_source_remove (connect_timeout_id);
+        connect_timeout_id = 0;
+    }
+
+    connection = ibus_bus_get_connection (bus);
+
+    // The factory is on the connection before the name is owned, so
+    // CreateEngine can be served as soon as the daemon sees the name.
+    factory = ibus_factory_new (connection);
     ibus_factory_add_engine (factory, "hangul", IBUS_TYPE_HANGUL_ENGINE);
+    g_signal_connect (factory, "create-engine",
+                      G_CALLBACK (create_engine_cb), NULL);
+
+    // Counters and key latencies for monitoring, see stats.h.
+    if (stats_export (connection, &error) == 0) {
+        g_warning ("Unable to export the statistics: %s", error->message);
+        g_clear_error (&error);
+    }
 
     if (ibus) {
-        ibus_bus_request_name (bus, "org.freedesktop.IBus.Hangul", 0);
+        ibus_bus_request_name_async (bus, "org.freedesktop.IBus.Hangul", 0,
+                                     -1, NULL, request_name_done_cb, NULL);
     }
     else {
-        ibus_bus_register_component (bus, component);
+        component = create_component ();
+        ibus_bus_register_component_async (bus, component, -1, NULL,
+                                           register_component_done_cb, NULL);
+        g_object_unref (component);
     }
+}
+
+static gboolean
+connect_timeout_cb (gpointer user_data)
+{
+    g_warning ("Unable to connect to IBus");
+    exit (2);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+start_component (void)
+{
+    ibus_init ();
+
+    // The engine doesn't use the config component of IBus, the settings
+    // are read with GSettings. So it only waits for the bus, and doesn't
+    // block on it: the engine is set up while the bus connects.
+    bus = ibus_bus_new_async ();
+
+    g_signal_connect (bus, "connected", G_CALLBACK (ibus_connected_cb), NULL);
+    g_signal_connect (bus, "disconnected", G_CALLBACK (ibus_disconnected_cb), NULL);
+
+    ibus_hangul_init (bus);
+
+    // kill -USR1 dumps the memory usage of the engine to the log.
+    g_unix_signal_add (SIGUSR1, dump_memory_usage_cb, NULL);
 
-    g_object_unref (component);
+    connect_timeout_id = g_timeout_add_seconds (CONNECT_TIMEOUT,
+                                                connect_timeout_cb, NULL);
 
     ibus_main ();
 
@@ -0,0 +1,152 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#include "memstat.h"
+
+typedef struct {
+    gsize bytes;
+    gsize peak_bytes;
+    gint  objects;
+    gint  peak_objects;
+} MemStat;
+
+static MemStat memstat[MEMSTAT_CATEGORY_COUNT];
+
+static const gchar* memstat_names[MEMSTAT_CATEGORY_COUNT] = {
+    "hanja table",
+    "symbol table",
+    "compose table",
+    "engine",
+    "preedit",
+    "hanja list",
+    "lookup table",
+};
+
+/**
+ * Returns the number of bytes allocated from the heap.
+ * The difference of two calls tells how much memory an operation took,
+ * which is the only way to measure the compose tables of IBusEngineSimple.
+ * It counts what the other threads allocate meanwhile too, so the objects
+ * which can tell their size should be counted with that instead.
+ * Returns 0 if the C library cannot tell.
+ */
+gsize
+memstat_heap_size (void)
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 info = mallinfo2 ();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+void
+memstat_add (MemStatCategory category, gssize bytes, gint objects)
+{
+    MemStat* stat;
+
+    g_return_if_fail (category < MEMSTAT_CATEGORY_COUNT);
+
+    stat = &memstat[category];
+
+    if (bytes < 0 && (gsize) -bytes > stat->bytes)
+        stat->bytes = 0;
+    else
+        stat->bytes += bytes;
+
+    stat->objects = MAX (0, stat->objects + objects);
+
+    stat->peak_bytes = MAX (stat->peak_bytes, stat->bytes);
+    stat->peak_objects = MAX (stat->peak_objects, stat->objects);
+}
+
+/**
+ * Replaces an amount which was accounted before with a new one.
+ * @accounted keeps the amount of a single object, so the object count
+ * of the category changes when it becomes zero or nonzero.
+ */
+void
+memstat_update (MemStatCategory category, gsize *accounted, gsize bytes)
+{
+    gint objects = 0;
+
+    if (*accounted == bytes)
+        return;
+
+    if (*accounted == 0)
+        objects = 1;
+    else if (bytes == 0)
+        objects = -1;
+
+    memstat_add (category, (gssize) bytes - (gssize) *accounted, objects);
+    *accounted = bytes;
+}
+
+gsize
+memstat_get_bytes (MemStatCategory category)
+{
+    g_return_val_if_fail (category < MEMSTAT_CATEGORY_COUNT, 0);
+
+    return memstat[category].bytes;
+}
+
+const gchar*
+memstat_get_name (MemStatCategory category)
+{
+    g_return_val_if_fail (category < MEMSTAT_CATEGORY_COUNT, NULL);
+
+    return memstat_names[category];
+}
+
+void
+memstat_report (GString *report)
+{
+    gsize total = 0;
+    gsize total_peak = 0;
+    int i;
+
+    g_string_append_printf (report, "%-16s %12s %12s %8s %8s\n",
+                            "category", "bytes", "peak", "count", "peak");
+
+    for (i = 0; i < MEMSTAT_CATEGORY_COUNT; ++i) {
+        const MemStat* stat = &memstat[i];
+
+        g_string_append_printf (report,
+                "%-16s %12" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT " %8d %8d\n",
+                memstat_names[i], stat->bytes, stat->peak_bytes,
+                stat->objects, stat->peak_objects);
+        total += stat->bytes;
+        total_peak += stat->peak_bytes;
+    }
+
+    g_string_append_printf (report,
+            "%-16s %12" G_GSIZE_FORMAT " %12" G_GSIZE_FORMAT "\n",
+            "total", total, total_peak);
+    g_string_append_printf (report, "%-16s %12" G_GSIZE_FORMAT "\n",
+            "heap in use", memstat_heap_size ());
+}
@@ -0,0 +1,55 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MEMSTAT_H__
+#define __MEMSTAT_H__
+
+#include <glib.h>
+
+/**
+ * Memory accounting categories.
+ * Process wide tables are measured once when they are loaded.
+ * Per context data is updated by the engine whenever it changes.
+ */
+typedef enum {
+    MEMSTAT_HANJA_TABLE,
+    MEMSTAT_SYMBOL_TABLE,
+    MEMSTAT_COMPOSE_TABLE,
+    MEMSTAT_ENGINE,
+    MEMSTAT_PREEDIT,
+    MEMSTAT_HANJA_LIST,
+    MEMSTAT_LOOKUP_TABLE,
+    MEMSTAT_CATEGORY_COUNT,
+} MemStatCategory;
+
+gsize   memstat_heap_size   (void);
+
+void    memstat_add         (MemStatCategory  category,
+                             gssize           bytes,
+                             gint             objects);
+void    memstat_update      (MemStatCategory  category,
+                             gsize           *accounted,
+                             gsize            bytes);
+
+gsize   memstat_get_bytes   (MemStatCategory  category);
+const gchar* memstat_get_name (MemStatCategory category);
+
+void    memstat_report      (GString         *report);
+
+#endif
@@ -0,0 +1,279 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "stats.h"
+
+#define STATS_OBJECT_PATH   "/org/freedesktop/IBus/Hangul/Stats"
+#define STATS_INTERFACE     "org.freedesktop.IBus.Hangul.Stats"
+
+/**
+ * Key latencies are kept in a histogram. Each power of two is split into
+ * LATENCY_SUB_BUCKETS buckets, so a percentile is off by at most 1/8,
+ * and the histogram doesn't grow with the number of keys.
+ */
+#define LATENCY_SUB_BUCKETS     8
+#define LATENCY_BUCKET_COUNT    (LATENCY_SUB_BUCKETS * 36)
+
+static guint64 key_counts[STATS_KEY_PATH_COUNT];
+static guint64 counters[STATS_COUNTER_COUNT];
+static guint64 latency_buckets[LATENCY_BUCKET_COUNT];
+static guint64 latency_count;
+static guint64 latency_max;
+static guint   live_contexts;
+static gint64  reset_time;
+
+static const gchar* key_path_names[STATS_KEY_PATH_COUNT] = {
+    "release",
+    "shift",
+    "password",
+    "candidate",
+    "hotkey",
+    "hotkey-modifier",
+    "latin",
+    "modifier",
+    "backspace",
+    "compose",
+};
+
+static const gchar* counter_names[STATS_COUNTER_COUNT] = {
+    "commits",
+    "preedit-updates",
+    "preedit-updates-suppressed",
+    "forwarded-keys",
+    "lookups-exact",
+    "lookups-prefix",
+    "lookups-suffix",
+    "lookups-skipped",
+    "lookups-stale",
+    "lookups-empty",
+    "candidates",
+};
+
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" STATS_INTERFACE "'>"
+    "    <method name='GetStats'>"
+    "      <arg type='a{sv}' name='stats' direction='out'/>"
+    "    </method>"
+    "    <method name='Reset'/>"
+    "  </interface>"
+    "</node>";
+
+static GDBusNodeInfo *introspection_data = NULL;
+
+const gchar*
+stats_key_path_name (StatsKeyPath path)
+{
+    g_return_val_if_fail (path < STATS_KEY_PATH_COUNT, NULL);
+
+    return key_path_names[path];
+}
+
+void
+stats_count_key (StatsKeyPath path)
+{
+    g_return_if_fail (path < STATS_KEY_PATH_COUNT);
+
+    key_counts[path]++;
+}
+
+void
+stats_add (StatsCounter counter, guint64 n)
+{
+    g_return_if_fail (counter < STATS_COUNTER_COUNT);
+
+    counters[counter] += n;
+}
+
+static guint
+latency_bucket (guint64 usec)
+{
+    guint e;
+    guint bucket;
+
+    if (usec < LATENCY_SUB_BUCKETS)
+        return usec;
+
+    // the position of the highest bit, and the next 3 bits
+    e = g_bit_storage (usec) - 1;
+    bucket = (e - 2) * LATENCY_SUB_BUCKETS +
+        ((usec >> (e - 3)) & (LATENCY_SUB_BUCKETS - 1));
+
+    return MIN (bucket, LATENCY_BUCKET_COUNT - 1);
+}
+
+/* The largest latency which goes to the bucket. */
+static guint64
+latency_bucket_limit (guint bucket)
+{
+    guint e;
+    guint64 sub;
+
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket;
+
+    e = bucket / LATENCY_SUB_BUCKETS + 2;
+    sub = bucket % LATENCY_SUB_BUCKETS;
+
+    return ((LATENCY_SUB_BUCKETS + sub + 1) << (e - 3)) - 1;
+}
+
+void
+stats_add_key_latency (gint64 usec)
+{
+    guint64 value = MAX (usec, 0);
+
+    latency_buckets[latency_bucket (value)]++;
+    latency_count++;
+    latency_max = MAX (latency_max, value);
+}
+
+/* Returns the latency under which percent of the keys were handled. */
+static guint64
+latency_percentile (guint percent)
+{
+    guint64 rank;
+    guint64 n = 0;
+    guint i;
+
+    if (latency_count == 0)
+        return 0;
+
+    rank = (latency_count * percent + 99) / 100;
+    for (i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        n += latency_buckets[i];
+        if (n >= rank)
+            return MIN (latency_bucket_limit (i), latency_max);
+    }
+
+    return latency_max;
+}
+
+void
+stats_set_live_contexts (guint n)
+{
+    live_contexts = n;
+}
+
+/* The number of live contexts is not a counter, it stays. */
+void
+stats_reset (void)
+{
+    memset (key_counts, 0, sizeof (key_counts));
+    memset (counters, 0, sizeof (counters));
+    memset (latency_buckets, 0, sizeof (latency_buckets));
+    latency_count = 0;
+    latency_max = 0;
+    reset_time = g_get_real_time ();
+}
+
+GVariant*
+stats_get (void)
+{
+    GVariantBuilder builder;
+    int i;
+
+    if (reset_time == 0)
+        reset_time = g_get_real_time ();
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+    g_variant_builder_add (&builder, "{sv}", "since",
+            g_variant_new_int64 (reset_time / G_USEC_PER_SEC));
+
+    for (i = 0; i < STATS_KEY_PATH_COUNT; ++i) {
+        gchar *name = g_strconcat ("keys-", key_path_names[i], NULL);
+        g_variant_builder_add (&builder, "{sv}", name,
+                g_variant_new_uint64 (key_counts[i]));
+        g_free (name);
+    }
+
+    for (i = 0; i < STATS_COUNTER_COUNT; ++i) {
+        g_variant_builder_add (&builder, "{sv}", counter_names[i],
+                g_variant_new_uint64 (counters[i]));
+    }
+
+    g_variant_builder_add (&builder, "{sv}", "live-contexts",
+            g_variant_new_uint32 (live_contexts));
+
+    g_variant_builder_add (&builder, "{sv}", "key-latency-count",
+            g_variant_new_uint64 (latency_count));
+    g_variant_builder_add (&builder, "{sv}", "key-latency-p50-us",
+            g_variant_new_uint64 (latency_percentile (50)));
+    g_variant_builder_add (&builder, "{sv}", "key-latency-p90-us",
+            g_variant_new_uint64 (latency_percentile (90)));
+    g_variant_builder_add (&builder, "{sv}", "key-latency-p99-us",
+            g_variant_new_uint64 (latency_percentile (99)));
+    g_variant_builder_add (&builder, "{sv}", "key-latency-max-us",
+            g_variant_new_uint64 (latency_max));
+
+    return g_variant_builder_end (&builder);
+}
+
+static void
+stats_method_call (GDBusConnection       *connection,
+                   const gchar           *sender,
+                   const gchar           *object_path,
+                   const gchar           *interface_name,
+                   const gchar           *method_name,
+                   GVariant              *parameters,
+                   GDBusMethodInvocation *invocation,
+                   gpointer               user_data)
+{
+    if (g_strcmp0 (method_name, "GetStats") == 0) {
+        g_dbus_method_invocation_return_value (invocation,
+                g_variant_new ("(@a{sv})", stats_get ()));
+    } else if (g_strcmp0 (method_name, "Reset") == 0) {
+        stats_reset ();
+        g_dbus_method_invocation_return_value (invocation, NULL);
+    } else {
+        g_dbus_method_invocation_return_error (invocation,
+                G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                "Unknown method %s", method_name);
+    }
+}
+
+static const GDBusInterfaceVTable stats_vtable = {
+    stats_method_call,
+    NULL,
+    NULL,
+};
+
+guint
+stats_export (GDBusConnection *connection, GError **error)
+{
+    g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), 0);
+
+    if (introspection_data == NULL) {
+        introspection_data = g_dbus_node_info_new_for_xml (introspection_xml,
+                                                           NULL);
+    }
+
+    return g_dbus_connection_register_object (connection, STATS_OBJECT_PATH,
+            g_dbus_node_info_lookup_interface (introspection_data,
+                                               STATS_INTERFACE),
+            &stats_vtable,
+            NULL, NULL, error);
+}
@@ -0,0 +1,80 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <gio/gio.h>
+
+/**
+ * Where a key event went in the engine.
+ */
+typedef enum {
+    STATS_KEY_RELEASE,
+    STATS_KEY_SHIFT,
+    STATS_KEY_PASSWORD,
+    STATS_KEY_CANDIDATE,
+    STATS_KEY_HOTKEY,
+    STATS_KEY_HOTKEY_MODIFIER,
+    STATS_KEY_LATIN,
+    STATS_KEY_MODIFIER,
+    STATS_KEY_BACKSPACE,
+    STATS_KEY_COMPOSE,
+    STATS_KEY_PATH_COUNT,
+} StatsKeyPath;
+
+/**
+ * Counters of the engine since the start or the last reset.
+ * They are only changed on the main thread.
+ */
+typedef enum {
+    STATS_COMMITS,
+    STATS_PREEDIT_UPDATES,
+    /* merged away in a burst of keys */
+    STATS_PREEDIT_UPDATES_SUPPRESSED,
+    STATS_FORWARDED_KEYS,
+    STATS_LOOKUPS_EXACT,
+    STATS_LOOKUPS_PREFIX,
+    STATS_LOOKUPS_SUFFIX,
+    /* superseded before the dictionary was looked up */
+    STATS_LOOKUPS_SKIPPED,
+    /* looked up, but the text changed before the result came */
+    STATS_LOOKUPS_STALE,
+    STATS_LOOKUPS_EMPTY,
+    STATS_CANDIDATES,
+    STATS_COUNTER_COUNT,
+} StatsCounter;
+
+const gchar* stats_key_path_name    (StatsKeyPath     path);
+
+void         stats_count_key        (StatsKeyPath     path);
+void         stats_add              (StatsCounter     counter,
+                                     guint64          n);
+void         stats_add_key_latency  (gint64           usec);
+void         stats_set_live_contexts (guint           n);
+
+void         stats_reset            (void);
+GVariant*    stats_get              (void);
+
+/* Exports the stats on the object path /org/freedesktop/IBus/Hangul/Stats
+ * of connection, with the interface org.freedesktop.IBus.Hangul.Stats. */
+guint        stats_export           (GDBusConnection *connection,
+                                     GError         **error);
+
+#endif
@@ -0,0 +1,383 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Counts the heap allocations of the engine for each key in the steady
+ * state of typical typing, and fails if they are over the budget in
+ * test-allocations.budget. When the hot path changes, measure the budget
+ * again with "make update-allocation-budget" in src: the test writes what
+ * it counts, raised by ALLOC_BUDGET_MARGIN percent, to the file in
+ * ALLOC_BUDGET_OUTPUT instead of checking it.
+ *
+ * Allocations are counted on the main thread only, where the engine runs,
+ * so what GDBus does on its worker thread is not counted.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <ibus.h>
+
+#include "engine.h"
+#include "bench-common.h"
+
+/* The scripts are played this many times before and while counting. */
+#define WARM_UP_RUNS    3
+#define COUNTED_RUNS    10
+
+/* The budget is this many percent over what was counted, for the
+ * differences between the versions of glib and ibus. */
+#define ALLOC_BUDGET_MARGIN 25
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static __thread gboolean count_allocs = FALSE;
+static __thread guint64 n_allocs = 0;
+static __thread guint64 n_bytes = 0;
+
+void*
+malloc (size_t size)
+{
+    if (count_allocs) {
+        n_allocs++;
+        n_bytes += size;
+    }
+    return __libc_malloc (size);
+}
+
+void*
+calloc (size_t nmemb, size_t size)
+{
+    if (count_allocs) {
+        n_allocs++;
+        n_bytes += nmemb * size;
+    }
+    return __libc_calloc (nmemb, size);
+}
+
+void*
+realloc (void *ptr, size_t size)
+{
+    if (count_allocs) {
+        n_allocs++;
+        n_bytes += size;
+    }
+    return __libc_realloc (ptr, size);
+}
+#endif
+
+typedef struct {
+    const char  *name;
+    const char  *preedit_mode;
+    gboolean     hanja_mode;
+    const guint *keyvals;       /* 0 terminated */
+} AllocScript;
+
+/* 안녕하세요 and a space on the 2 set keyboard */
+static const guint typing_keyvals[] = {
+    'd', 'k', 's', 's', 'u', 'd', 'g', 'k', 't', 'p', 'd', 'y', ' ', 0
+};
+
+/* 안녕 and the backspaces to 아, then a space */
+static const guint backspace_keyvals[] = {
+    'd', 'k', 's', 's', 'u', 'd',
+    IBUS_BackSpace, IBUS_BackSpace, IBUS_BackSpace, IBUS_BackSpace,
+    ' ', 0
+};
+
+/* 한, the hanja key, and Escape which closes the lookup table */
+static const guint hanja_keyvals[] = {
+    'g', 'k', 's', IBUS_Hangul_Hanja, IBUS_Escape, ' ', 0
+};
+
+/* some latin text between Hangul keys */
+static const guint mode_switch_keyvals[] = {
+    IBUS_Hangul, 'i', 'b', 'u', 's', ' ', IBUS_Hangul, 'g', 'k', 's', ' ', 0
+};
+
+static const AllocScript scripts[] = {
+    { "typing-syllable",  "syllable", FALSE, typing_keyvals },
+    { "typing-word",      "word",     FALSE, typing_keyvals },
+    { "typing-none",      "none",     FALSE, typing_keyvals },
+    { "backspace",        "syllable", FALSE, backspace_keyvals },
+    { "backspace-none",   "none",     FALSE, backspace_keyvals },
+    { "hanja",            "syllable", FALSE, hanja_keyvals },
+    { "hanja-mode",       "syllable", TRUE,  typing_keyvals },
+    { "mode-switch",      "syllable", FALSE, mode_switch_keyvals },
+};
+
+static GDBusConnection *connection = NULL;
+static GSettings *settings = NULL;
+static IBusKeymap *keymap = NULL;
+static GKeyFile *budget = NULL;
+/* the budget is measured and written to the file, not checked */
+static const gchar *budget_output = NULL;
+
+static void
+remove_dir (const gchar *dir)
+{
+    GDir *d = g_dir_open (dir, 0, NULL);
+    const gchar *name;
+
+    if (d == NULL)
+        return;
+
+    while ((name = g_dir_read_name (d)) != NULL) {
+        gchar *path = g_build_filename (dir, name, NULL);
+        if (g_file_test (path, G_FILE_TEST_IS_DIR))
+            remove_dir (path);
+        else
+            g_unlink (path);
+        g_free (path);
+    }
+    g_dir_close (d);
+    g_rmdir (dir);
+}
+
+static void
+iterate (void)
+{
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+}
+
+/**
+ * Runs the main loop until the hanja lookups of the engine are done.
+ * Each pending lookup holds a reference to the engine.
+ */
+static void
+wait_for_lookups (IBusEngine *engine, guint ref_count)
+{
+    iterate ();
+    while (G_OBJECT (engine)->ref_count > ref_count)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+/* what was counted, plus ALLOC_BUDGET_MARGIN percent rounded up */
+static guint64
+add_margin (guint64 counted)
+{
+    return counted + (counted * ALLOC_BUDGET_MARGIN + 99) / 100;
+}
+
+static void
+play_script (IBusEngine *engine, guint ref_count, const BenchKey *keys,
+             guint n_keys)
+{
+    guint i;
+
+    for (i = 0; i < n_keys; i++) {
+        gboolean handled;
+
+        g_signal_emit_by_name (engine, "process-key-event", keys[i].keyval,
+                               keys[i].keycode, keys[i].modifiers, &handled);
+        g_signal_emit_by_name (engine, "process-key-event", keys[i].keyval,
+                               keys[i].keycode,
+                               keys[i].modifiers | IBUS_RELEASE_MASK,
+                               &handled);
+        wait_for_lookups (engine, ref_count);
+    }
+}
+
+static void
+test_allocations (gconstpointer data)
+{
+    static guint n_engines = 0;
+    const AllocScript *script = data;
+    IBusEngine *engine;
+    GArray *keys;
+    gchar *path;
+    guint ref_count;
+    guint64 allocs_start;
+    guint64 bytes_start;
+    guint64 allocs_per_key;
+    guint64 bytes_per_key;
+    guint64 max_allocs;
+    guint64 max_bytes;
+    guint n_keys;
+    guint i;
+
+#ifndef __GLIBC__
+    g_test_skip ("Allocations are counted only with glibc");
+    return;
+#else
+    max_allocs = g_key_file_get_uint64 (budget, script->name,
+                                        "allocations", NULL);
+    max_bytes = g_key_file_get_uint64 (budget, script->name, "bytes", NULL);
+    if (budget_output == NULL && (max_allocs == 0 || max_bytes == 0)) {
+        g_test_fail_printf ("No budget for %s", script->name);
+        return;
+    }
+
+    keys = g_array_new (FALSE, FALSE, sizeof (BenchKey));
+    for (i = 0; script->keyvals[i] != 0; i++) {
+        BenchKey key;
+
+        bench_key_from_keyval (keymap, script->keyvals[i], &key);
+        g_array_append_val (keys, key);
+    }
+    n_keys = keys->len;
+
+    g_settings_set_string (settings, "preedit-mode", script->preedit_mode);
+    iterate ();
+
+    path = g_strdup_printf ("/org/freedesktop/IBus/Engine/%u", ++n_engines);
+    engine = ibus_engine_new_with_type (IBUS_TYPE_HANGUL_ENGINE, "hangul",
+                                        path, connection);
+    g_object_ref_sink (engine);
+    g_free (path);
+    ref_count = G_OBJECT (engine)->ref_count;
+
+    g_signal_emit_by_name (engine, "set-capabilities",
+                           IBUS_CAP_PREEDIT_TEXT | IBUS_CAP_AUXILIARY_TEXT |
+                           IBUS_CAP_LOOKUP_TABLE | IBUS_CAP_FOCUS |
+                           IBUS_CAP_SURROUNDING_TEXT);
+    g_signal_emit_by_name (engine, "enable");
+    g_signal_emit_by_name (engine, "focus-in");
+    if (script->hanja_mode) {
+        g_signal_emit_by_name (engine, "property-activate", "hanja_mode",
+                               PROP_STATE_CHECKED);
+    }
+
+    for (i = 0; i < WARM_UP_RUNS; i++)
+        play_script (engine, ref_count, (BenchKey*) keys->data, n_keys);
+
+    allocs_start = n_allocs;
+    bytes_start = n_bytes;
+    count_allocs = TRUE;
+    for (i = 0; i < COUNTED_RUNS; i++)
+        play_script (engine, ref_count, (BenchKey*) keys->data, n_keys);
+    count_allocs = FALSE;
+
+    allocs_per_key = (n_allocs - allocs_start) / (COUNTED_RUNS * n_keys);
+    bytes_per_key = (n_bytes - bytes_start) / (COUNTED_RUNS * n_keys);
+
+    g_test_message ("%s: %" G_GUINT64_FORMAT " allocations, %"
+                    G_GUINT64_FORMAT " bytes per key", script->name,
+                    allocs_per_key, bytes_per_key);
+    if (budget_output != NULL) {
+        g_key_file_set_uint64 (budget, script->name, "allocations",
+                               add_margin (allocs_per_key));
+        g_key_file_set_uint64 (budget, script->name, "bytes",
+                               add_margin (bytes_per_key));
+    } else {
+        g_assert_cmpuint (allocs_per_key, <=, max_allocs);
+        g_assert_cmpuint (bytes_per_key, <=, max_bytes);
+    }
+
+    g_signal_emit_by_name (engine, "focus-out");
+    wait_for_lookups (engine, ref_count);
+    ibus_object_destroy ((IBusObject *) engine);
+    g_object_unref (engine);
+    g_array_free (keys, TRUE);
+#endif
+}
+
+int
+main (int argc, char* argv[])
+{
+    GDBusConnection *peer = NULL;
+    GError *error = NULL;
+    gchar *data_dir;
+    guint i;
+    int result;
+
+    g_test_init (&argc, &argv, NULL);
+
+    // The settings are kept in memory and the user dictionary in a
+    // temporary directory. GSETTINGS_SCHEMA_DIR is set by make.
+    data_dir = g_build_filename (g_get_tmp_dir (),
+                                 "test-allocations-XXXXXX", NULL);
+    g_assert_nonnull (g_mkdtemp (data_dir));
+    g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+    g_setenv ("XDG_DATA_HOME", data_dir, TRUE);
+
+    budget = g_key_file_new ();
+    budget_output = g_getenv ("ALLOC_BUDGET_OUTPUT");
+    if (budget_output == NULL &&
+        !g_key_file_load_from_file (budget, ALLOC_BUDGET_FILE,
+                                    G_KEY_FILE_NONE, &error)) {
+        g_printerr ("%s: %s\n", ALLOC_BUDGET_FILE, error->message);
+        return 1;
+    }
+
+    ibus_init ();
+    ibus_hangul_init (NULL);
+
+    settings = g_settings_new ("org.freedesktop.ibus.engine.hangul");
+    g_settings_set_string (settings, "hangul-keyboard", "2");
+    g_settings_set_string (settings, "initial-input-mode", "hangul");
+    // The keys come back to back. Each one is counted on its own path,
+    // not merged into a burst, whatever the speed of the machine.
+    g_settings_set_uint (settings, "burst-interval", 0);
+    keymap = ibus_keymap_get ("us");
+    connection = bench_connect (&peer);
+
+    for (i = 0; i < G_N_ELEMENTS (scripts); i++) {
+        gchar *test_path = g_strconcat ("/ibus-hangul/allocations/",
+                                        scripts[i].name, NULL);
+        g_test_add_data_func (test_path, &scripts[i], test_allocations);
+        g_free (test_path);
+    }
+
+    result = g_test_run ();
+
+    if (budget_output != NULL && result == 0) {
+        gchar *comment = g_strdup_printf (
+                " The allocations and bytes which the engine may allocate"
+                " for each key in\n"
+                " test-allocations, on the main thread. Each group is a"
+                " script of the test.\n"
+                " Written by \"make update-allocation-budget\": what was"
+                " counted, plus %d%%.",
+                ALLOC_BUDGET_MARGIN);
+
+        g_key_file_set_comment (budget, NULL, NULL, comment, NULL);
+        if (!g_key_file_save_to_file (budget, budget_output, &error)) {
+            g_printerr ("%s: %s\n", budget_output, error->message);
+            g_clear_error (&error);
+            result = 1;
+        }
+        g_free (comment);
+    }
+
+    g_object_unref (connection);
+    g_object_unref (peer);
+    g_object_unref (keymap);
+    g_object_unref (settings);
+    g_key_file_free (budget);
+
+    ibus_hangul_exit ();
+
+    // The user dictionary is written on a thread, which is done by now.
+    remove_dir (data_dir);
+    g_free (data_dir);
+
+    return result;
+}
@@ -0,0 +1,593 @@
+/* vim: set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2009-2011 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "composer.h"
+
+#include <glib.h>
+#include <ibus.h>
+
+/* What a client shows: the text before the cursor and the preedit.
+ * The last selected characters of the text are selected. */
+typedef struct {
+    UString* text;
+    UString* preedit;
+    guint    commits;
+    guint    updates;
+    guint    selected;
+    gchar*   surrounding;
+} Client;
+
+static void
+client_init(Client* client)
+{
+    client->text = ustring_new();
+    client->preedit = ustring_new();
+    client->commits = 0;
+    client->updates = 0;
+    client->selected = 0;
+    client->surrounding = NULL;
+}
+
+static void
+client_fini(Client* client)
+{
+    ustring_delete(client->text);
+    ustring_delete(client->preedit);
+    g_free(client->surrounding);
+}
+
+static const gchar*
+client_get_surrounding(gpointer user_data, guint* cursor_pos, guint* anchor_pos)
+{
+    Client* client = user_data;
+
+    g_free(client->surrounding);
+    client->surrounding = ustring_to_utf8(client->text, -1);
+    *cursor_pos = ustring_length(client->text);
+    *anchor_pos = *cursor_pos - client->selected;
+
+    return client->surrounding;
+}
+
+static void
+client_apply(Client* client, ComposerActions* actions)
+{
+    guint i;
+
+    for (i = 0; i < actions->actions->len; i++) {
+        const ComposerAction* action;
+        const ucschar* str;
+        guint len;
+
+        action = &g_array_index(actions->actions, ComposerAction, i);
+        str = composer_actions_get_text(actions, action);
+
+        switch (action->type) {
+        case COMPOSER_ACTION_COMMIT:
+            ustring_append_ucs4(client->text, str, action->length);
+            client->commits++;
+            break;
+        case COMPOSER_ACTION_UPDATE_PREEDIT:
+            ustring_clear(client->preedit);
+            ustring_append_ucs4(client->preedit, str, action->length);
+            client->updates++;
+            break;
+        case COMPOSER_ACTION_DELETE_BEFORE_CURSOR:
+            len = ustring_length(client->text);
+            g_assert_cmpuint(action->length, <=, len);
+            ustring_erase(client->text, len - action->length, action->length);
+            break;
+        }
+    }
+
+    composer_actions_clear(actions);
+}
+
+static void
+client_type(Client* client, Composer* composer, const char* keys)
+{
+    ComposerActions* actions = composer_actions_new();
+    const char* p;
+
+    for (p = keys; *p != '\0'; p++) {
+        composer_process_key(composer, *p, actions);
+        client_apply(client, actions);
+    }
+
+    composer_actions_free(actions);
+}
+
+static void
+assert_ustring(const UString* str, const char* expected)
+{
+    gchar* utf8 = ustring_to_utf8(str, -1);
+
+    g_assert_cmpstr(utf8, ==, expected);
+    g_free(utf8);
+}
+
+static void
+assert_hanja_key(Composer* composer, guint max_key_length,
+                 const char* expected, LookupMethod expected_method)
+{
+    LookupMethod method;
+    gchar* key;
+
+    key = composer_get_hanja_key(composer, max_key_length, &method);
+    g_assert_cmpstr(key, ==, expected);
+    g_assert_cmpint(method, ==, expected_method);
+    g_free(key);
+}
+
+/* Types keys one by one into one client, and as a burst into another,
+ * and checks that both show the same. */
+static void
+check_burst(ComposerPreeditMode mode, const char* keys)
+{
+    Composer* one = composer_new("2");
+    Composer* all = composer_new("2");
+    ComposerActions* actions = composer_actions_new();
+    ComposerActions* burst = composer_actions_new();
+    Client expected;
+    Client merged;
+    const char* p;
+
+    composer_set_preedit_mode(one, mode);
+    composer_set_preedit_mode(all, mode);
+    client_init(&expected);
+    client_init(&merged);
+
+    for (p = keys; *p != '\0'; p++) {
+        if (*p == '\b') {
+            composer_backspace(one, actions);
+            client_apply(&expected, actions);
+            composer_backspace(all, actions);
+        } else {
+            composer_process_key(one, *p, actions);
+            client_apply(&expected, actions);
+            composer_process_key(all, *p, actions);
+        }
+        composer_actions_merge(burst, actions);
+        composer_actions_clear(actions);
+    }
+    client_apply(&merged, burst);
+
+    g_assert_cmpint(ustring_compare(expected.text, merged.text), ==, 0);
+    g_assert_cmpint(ustring_compare(expected.preedit, merged.preedit), ==, 0);
+    g_assert_cmpuint(merged.commits, <=, 1);
+    g_assert_cmpuint(merged.updates, <=, 2);
+
+    client_fini(&expected);
+    client_fini(&merged);
+    composer_actions_free(actions);
+    composer_actions_free(burst);
+    composer_delete(one);
+    composer_delete(all);
+}
+
+static void
+test_composer_burst_syllable(void)
+{
+    check_burst(PREEDIT_MODE_SYLLABLE, "dkssudgktpdy");
+    check_burst(PREEDIT_MODE_SYLLABLE, "gksrmf\b\bdj");
+    check_burst(PREEDIT_MODE_SYLLABLE, "r");
+    check_burst(PREEDIT_MODE_SYLLABLE, "qhRdmaqkq");
+}
+
+static void
+test_composer_burst_word(void)
+{
+    check_burst(PREEDIT_MODE_WORD, "dkssudgktpdy");
+    check_burst(PREEDIT_MODE_WORD, "dlTek\b\b\b");
+}
+
+static void
+test_composer_merge_commits(void)
+{
+    ComposerActions* actions = composer_actions_new();
+    ComposerActions* burst = composer_actions_new();
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_SYLLABLE);
+
+    // "가나" and then a flush: two commits which become one.
+    composer_process_key(composer, 'r', actions);
+    composer_process_key(composer, 'k', actions);
+    composer_process_key(composer, 's', actions);
+    composer_process_key(composer, 'k', actions);
+    composer_flush(composer, actions);
+    composer_actions_merge(burst, actions);
+
+    g_assert_cmpuint(burst->actions->len, <=, 3);
+    client_apply(&client, burst);
+    g_assert_cmpuint(client.commits, ==, 1);
+    g_assert_cmpuint(ustring_length(client.text), ==, 2);
+    g_assert_cmpuint(ustring_length(client.preedit), ==, 0);
+
+    client_fini(&client);
+    composer_delete(composer);
+    composer_actions_free(actions);
+    composer_actions_free(burst);
+}
+
+static void
+test_composer_none_minimal_diff(void)
+{
+    ComposerActions* actions = composer_actions_new();
+    Composer* composer = composer_new("2");
+    const ComposerAction* action;
+    Client client;
+    UString* expected;
+
+    client_init(&client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_NONE);
+
+    composer_process_key(composer, 'r', actions);
+    composer_process_key(composer, 'k', actions);
+    composer_process_key(composer, 'r', actions);
+    client_apply(&client, actions);
+
+    // "각" and "ㅇ": the first character stays, only the new one is sent.
+    composer_process_key(composer, 'd', actions);
+    g_assert_cmpuint(actions->actions->len, ==, 1);
+    action = &g_array_index(actions->actions, ComposerAction, 0);
+    g_assert_cmpint(action->type, ==, COMPOSER_ACTION_COMMIT);
+    g_assert_cmpuint(action->length, ==, 1);
+    client_apply(&client, actions);
+
+    // "ㅇ" becomes "아": one character is replaced.
+    composer_process_key(composer, 'k', actions);
+    g_assert_cmpuint(actions->actions->len, ==, 2);
+    action = &g_array_index(actions->actions, ComposerAction, 0);
+    g_assert_cmpint(action->type, ==, COMPOSER_ACTION_DELETE_BEFORE_CURSOR);
+    g_assert_cmpuint(action->length, ==, 1);
+    client_apply(&client, actions);
+
+    expected = ustring_new();
+    ustring_append_utf8(expected, "각아");
+    g_assert_cmpint(ustring_compare(client.text, expected), ==, 0);
+
+    ustring_delete(expected);
+    client_fini(&client);
+    composer_delete(composer);
+    composer_actions_free(actions);
+}
+
+static void
+test_composer_hanja_key_prefix(void)
+{
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+
+    // The whole word is the key, and its prefixes are looked up.
+    composer_set_preedit_mode(composer, PREEDIT_MODE_WORD);
+    client_type(&client, composer, "gksrnr");
+    assert_hanja_key(composer, 10, "한국", LOOKUP_METHOD_PREFIX);
+    composer_reset(composer);
+
+    // So is the text composed in the hanja mode.
+    composer_set_preedit_mode(composer, PREEDIT_MODE_SYLLABLE);
+    composer_set_hanja_mode(composer, TRUE);
+    client_type(&client, composer, "eogks");
+    assert_hanja_key(composer, 10, "대한", LOOKUP_METHOD_PREFIX);
+
+    client_fini(&client);
+    composer_delete(composer);
+}
+
+static void
+test_composer_hanja_key_suffix(void)
+{
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_SYLLABLE);
+
+    // The syllable and the text before it, as far as the longest key.
+    client_type(&client, composer, "eogksalsrnr");
+    assert_ustring(client.text, "대한민");
+    assert_ustring(client.preedit, "국");
+    assert_hanja_key(composer, 10, "대한민국", LOOKUP_METHOD_SUFFIX);
+    assert_hanja_key(composer, 2, "민국", LOOKUP_METHOD_SUFFIX);
+
+    client_fini(&client);
+    composer_delete(composer);
+}
+
+static void
+test_composer_hanja_key_exact(void)
+{
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_SYLLABLE);
+
+    // Nothing is composed, and the selected text is the key.
+    ustring_append_utf8(client.text, "대한민국");
+    client.selected = 2;
+    assert_hanja_key(composer, 10, "민국", LOOKUP_METHOD_EXACT);
+
+    client_fini(&client);
+    composer_delete(composer);
+}
+
+static void
+test_composer_hanja_key_none(void)
+{
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_NONE);
+
+    // The composed text is in the surrounding text already.
+    client_type(&client, composer, "gksrnr");
+    assert_ustring(client.text, "한국");
+    assert_hanja_key(composer, 10, "한국", LOOKUP_METHOD_SUFFIX);
+    assert_hanja_key(composer, 1, "국", LOOKUP_METHOD_SUFFIX);
+
+    client_fini(&client);
+    composer_delete(composer);
+}
+
+static void
+test_composer_commit_candidate_prefix(void)
+{
+    ComposerActions* actions = composer_actions_new();
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_WORD);
+
+    // A prefix of the word is replaced, and the rest stays in the preedit.
+    client_type(&client, composer, "gksrnr");
+    composer_commit_candidate(composer, "한", "韓", LOOKUP_METHOD_PREFIX,
+                              actions);
+    client_apply(&client, actions);
+    assert_ustring(client.text, "韓");
+    assert_ustring(client.preedit, "국");
+
+    composer_commit_candidate(composer, "국", "國", LOOKUP_METHOD_PREFIX,
+                              actions);
+    client_apply(&client, actions);
+    assert_ustring(client.text, "韓國");
+    assert_ustring(client.preedit, "");
+    g_assert_false(composer_has_preedit(composer));
+
+    client_fini(&client);
+    composer_delete(composer);
+    composer_actions_free(actions);
+}
+
+static void
+test_composer_commit_candidate_suffix(void)
+{
+    ComposerActions* actions = composer_actions_new();
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_SYLLABLE);
+
+    // The syllable and the text before it are replaced.
+    client_type(&client, composer, "eogksalsrnr");
+    composer_commit_candidate(composer, "민국", "民國", LOOKUP_METHOD_SUFFIX,
+                              actions);
+    client_apply(&client, actions);
+    assert_ustring(client.text, "대한民國");
+    assert_ustring(client.preedit, "");
+
+    client_fini(&client);
+    composer_delete(composer);
+    composer_actions_free(actions);
+}
+
+static void
+test_composer_commit_candidate_exact(void)
+{
+    ComposerActions* actions = composer_actions_new();
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_SYLLABLE);
+
+    // The selected text is replaced.
+    ustring_append_utf8(client.text, "대한민국");
+    client.selected = 2;
+    composer_commit_candidate(composer, "민국", "民國", LOOKUP_METHOD_EXACT,
+                              actions);
+    client_apply(&client, actions);
+    assert_ustring(client.text, "대한民國");
+
+    client_fini(&client);
+    composer_delete(composer);
+    composer_actions_free(actions);
+}
+
+static void
+test_composer_commit_candidate_none(void)
+{
+    ComposerActions* actions = composer_actions_new();
+    Composer* composer = composer_new("2");
+    Client client;
+
+    client_init(&client);
+    composer_set_surrounding_func(composer, client_get_surrounding, &client);
+    composer_set_preedit_mode(composer, PREEDIT_MODE_NONE);
+
+    // The composed text was committed, and is deleted with the rest.
+    client_type(&client, composer, "gksrnr");
+    composer_commit_candidate(composer, "한국", "韓國", LOOKUP_METHOD_SUFFIX,
+                              actions);
+    client_apply(&client, actions);
+    assert_ustring(client.text, "韓國");
+    g_assert_false(composer_has_preedit(composer));
+
+    client_fini(&client);
+    composer_delete(composer);
+    composer_actions_free(actions);
+}
+
+static void
+assert_candidate_key(Composer* composer, guint keyval, gboolean vertical,
+                     ComposerCandidateKey expected, guint expected_nth)
+{
+    guint nth;
+
+    g_assert_cmpint(composer_get_candidate_key(composer, keyval, vertical,
+                                               &nth), ==, expected);
+    g_assert_cmpuint(nth, ==, expected_nth);
+}
+
+static void
+test_composer_candidate_keys(void)
+{
+    Composer* composer = composer_new("2");
+
+    assert_candidate_key(composer, IBUS_Escape, FALSE,
+                         COMPOSER_CANDIDATE_KEY_CLOSE, 0);
+    assert_candidate_key(composer, IBUS_Return, FALSE,
+                         COMPOSER_CANDIDATE_KEY_COMMIT, 0);
+    assert_candidate_key(composer, IBUS_1, FALSE,
+                         COMPOSER_CANDIDATE_KEY_SELECT, 0);
+    assert_candidate_key(composer, IBUS_9, FALSE,
+                         COMPOSER_CANDIDATE_KEY_SELECT, 8);
+    assert_candidate_key(composer, IBUS_0, FALSE,
+                         COMPOSER_CANDIDATE_KEY_NONE, 0);
+    assert_candidate_key(composer, IBUS_Page_Down, TRUE,
+                         COMPOSER_CANDIDATE_KEY_PAGE_DOWN, 0);
+
+    // The cursor moves along the table, the page across it.
+    assert_candidate_key(composer, IBUS_Right, FALSE,
+                         COMPOSER_CANDIDATE_KEY_CURSOR_DOWN, 0);
+    assert_candidate_key(composer, IBUS_Down, FALSE,
+                         COMPOSER_CANDIDATE_KEY_PAGE_DOWN, 0);
+    assert_candidate_key(composer, IBUS_Right, TRUE,
+                         COMPOSER_CANDIDATE_KEY_PAGE_DOWN, 0);
+    assert_candidate_key(composer, IBUS_Down, TRUE,
+                         COMPOSER_CANDIDATE_KEY_CURSOR_DOWN, 0);
+
+    // So do the vi keys, except in the hanja mode where they are text.
+    assert_candidate_key(composer, IBUS_h, FALSE,
+                         COMPOSER_CANDIDATE_KEY_CURSOR_UP, 0);
+    assert_candidate_key(composer, IBUS_k, TRUE,
+                         COMPOSER_CANDIDATE_KEY_CURSOR_UP, 0);
+    composer_set_hanja_mode(composer, TRUE);
+    assert_candidate_key(composer, IBUS_h, FALSE,
+                         COMPOSER_CANDIDATE_KEY_NONE, 0);
+    assert_candidate_key(composer, IBUS_Left, FALSE,
+                         COMPOSER_CANDIDATE_KEY_CURSOR_UP, 0);
+
+    composer_delete(composer);
+}
+
+static void
+test_composer_hotkeys(void)
+{
+    composer_set_hotkeys(COMPOSER_HOTKEY_HANJA, "Hangul_Hanja,F9");
+    composer_set_hotkeys(COMPOSER_HOTKEY_SWITCH, "Hangul,Shift+space");
+
+    g_assert_true(composer_match_hotkey(COMPOSER_HOTKEY_HANJA,
+                                        IBUS_F9, 0));
+    // Caps Lock and Num Lock don't matter.
+    g_assert_true(composer_match_hotkey(COMPOSER_HOTKEY_HANJA,
+                                        IBUS_F9, IBUS_LOCK_MASK));
+    g_assert_false(composer_match_hotkey(COMPOSER_HOTKEY_HANJA,
+                                         IBUS_F9, IBUS_CONTROL_MASK));
+    g_assert_false(composer_match_hotkey(COMPOSER_HOTKEY_SWITCH,
+                                         IBUS_F9, 0));
+
+    g_assert_true(composer_match_hotkey(COMPOSER_HOTKEY_SWITCH,
+                                        IBUS_space, IBUS_SHIFT_MASK));
+    g_assert_false(composer_match_hotkey(COMPOSER_HOTKEY_SWITCH,
+                                         IBUS_space, 0));
+
+    // Only the modifiers of the keys of a hotkey are held for it.
+    composer_set_hotkeys(COMPOSER_HOTKEY_ON, "Control+Hangul");
+    g_assert_true(composer_is_hotkey_modifier(COMPOSER_HOTKEY_ON,
+                                              IBUS_Control_L));
+    g_assert_false(composer_is_hotkey_modifier(COMPOSER_HOTKEY_ON,
+                                               IBUS_Alt_L));
+    g_assert_false(composer_is_hotkey_modifier(COMPOSER_HOTKEY_HANJA,
+                                               IBUS_Control_L));
+
+    // A new list replaces the old one.
+    composer_set_hotkeys(COMPOSER_HOTKEY_HANJA, "");
+    g_assert_false(composer_match_hotkey(COMPOSER_HOTKEY_HANJA,
+                                         IBUS_F9, 0));
+
+    composer_clear_hotkeys();
+    g_assert_false(composer_match_hotkey(COMPOSER_HOTKEY_SWITCH,
+                                         IBUS_Hangul, 0));
+    g_assert_false(composer_is_hotkey_modifier(COMPOSER_HOTKEY_ON,
+                                               IBUS_Control_L));
+}
+
+int
+main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/ibus-hangul/composer/burst-syllable",
+                    test_composer_burst_syllable);
+    g_test_add_func("/ibus-hangul/composer/burst-word",
+                    test_composer_burst_word);
+    g_test_add_func("/ibus-hangul/composer/merge-commits",
+                    test_composer_merge_commits);
+    g_test_add_func("/ibus-hangul/composer/none-minimal-diff",
+                    test_composer_none_minimal_diff);
+    g_test_add_func("/ibus-hangul/composer/hanja-key-prefix",
+                    test_composer_hanja_key_prefix);
+    g_test_add_func("/ibus-hangul/composer/hanja-key-suffix",
+                    test_composer_hanja_key_suffix);
+    g_test_add_func("/ibus-hangul/composer/hanja-key-exact",
+                    test_composer_hanja_key_exact);
+    g_test_add_func("/ibus-hangul/composer/hanja-key-none",
+                    test_composer_hanja_key_none);
+    g_test_add_func("/ibus-hangul/composer/commit-candidate-prefix",
+                    test_composer_commit_candidate_prefix);
+    g_test_add_func("/ibus-hangul/composer/commit-candidate-suffix",
+                    test_composer_commit_candidate_suffix);
+    g_test_add_func("/ibus-hangul/composer/commit-candidate-exact",
+                    test_composer_commit_candidate_exact);
+    g_test_add_func("/ibus-hangul/composer/commit-candidate-none",
+                    test_composer_commit_candidate_none);
+    g_test_add_func("/ibus-hangul/composer/candidate-keys",
+                    test_composer_candidate_keys);
+    g_test_add_func("/ibus-hangul/composer/hotkeys",
+                    test_composer_hotkeys);
+
+    int result = g_test_run();
+    return result;
+}
@@ -0,0 +1,130 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "hanjafile.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+
+static gchar*
+make_test_file (const char* contents)
+{
+    GError* error = NULL;
+    gchar* path = NULL;
+    int fd;
+
+    fd = g_file_open_tmp ("test-hanjafile-XXXXXX", &path, &error);
+    g_assert_no_error (error);
+    close (fd);
+    g_assert_true (g_file_set_contents (path, contents, -1, NULL));
+
+    return path;
+}
+
+static void
+test_hanjafile_match (void)
+{
+    gchar* path = make_test_file ("# comment\n"
+                                  "나:那:어찌 나\n"
+                                  "가:家:집 가\n"
+                                  "가:可:옳을 가\n"
+                                  "가나:假名\r\n"
+                                  "broken line\n"
+                                  ":empty key:\n");
+    HanjaFile* file = hanja_file_load (path);
+    guint first, n;
+
+    g_assert_nonnull (file);
+
+    g_assert_true (hanja_file_match_exact (file, "가", &first, &n));
+    g_assert_cmpuint (n, ==, 2);
+    // the order of the file is kept within a key
+    g_assert_cmpstr (hanja_file_get_value (file, first), ==, "家");
+    g_assert_cmpstr (hanja_file_get_value (file, first + 1), ==, "可");
+
+    g_assert_true (hanja_file_match_exact (file, "가나", &first, &n));
+    g_assert_cmpuint (n, ==, 1);
+    g_assert_cmpstr (hanja_file_get_key (file, first), ==, "가나");
+    g_assert_cmpstr (hanja_file_get_value (file, first), ==, "假名");
+
+    g_assert_false (hanja_file_match_exact (file, "다", &first, &n));
+    g_assert_false (hanja_file_match_exact (file, "broken line", &first, &n));
+
+    hanja_file_unref (file);
+    g_unlink (path);
+    g_free (path);
+
+    g_assert_null (hanja_file_load ("/nonexistent/hanja.txt"));
+}
+
+static void
+test_hanjafile_comment (void)
+{
+    gchar* path = make_test_file ("가:家:집 가\n"
+                                  "가나:假名\n"
+                                  "나:那:어찌 나\r\n");
+    HanjaFile* file = hanja_file_load (path);
+    gchar* comment;
+    guint first, n;
+
+    g_assert_nonnull (file);
+
+    g_assert_true (hanja_file_match_exact (file, "가", &first, &n));
+    comment = hanja_file_get_comment (file, first);
+    g_assert_cmpstr (comment, ==, "집 가");
+    g_free (comment);
+
+    g_assert_true (hanja_file_match_exact (file, "가나", &first, &n));
+    g_assert_null (hanja_file_get_comment (file, first));
+
+    // The comments come from the file which was loaded, even after it is
+    // replaced.
+    g_unlink (path);
+    g_assert_true (g_file_set_contents (path, "나:奈:어찌 내\n", -1, NULL));
+
+    g_assert_true (hanja_file_match_exact (file, "나", &first, &n));
+    comment = hanja_file_get_comment (file, first);
+    g_assert_cmpstr (comment, ==, "어찌 나");
+    g_free (comment);
+
+    // and a cached one as well
+    g_assert_true (hanja_file_match_exact (file, "가", &first, &n));
+    comment = hanja_file_get_comment (file, first);
+    g_assert_cmpstr (comment, ==, "집 가");
+    g_free (comment);
+
+    hanja_file_unref (file);
+    g_unlink (path);
+    g_free (path);
+}
+
+int
+main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/ibus-hangul/hanjafile/match", test_hanjafile_match);
+    g_test_add_func("/ibus-hangul/hanjafile/comment", test_hanjafile_comment);
+
+    return g_test_run();
+}
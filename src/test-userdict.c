@@ -0,0 +1,277 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "userdict.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+
+static void
+count_value (const char* key, const char* value, guint count,
+             gpointer user_data)
+{
+    GHashTable* counts = user_data;
+    guint n = GPOINTER_TO_UINT (g_hash_table_lookup (counts, value));
+    g_hash_table_replace (counts, g_strdup (value),
+                          GUINT_TO_POINTER (n + count));
+}
+
+static guint
+lookup_count (UserDict* dict, const char* key, const char* value)
+{
+    GHashTable* counts;
+    guint n;
+
+    counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    user_dict_match_exact (dict, key, count_value, counts);
+    n = GPOINTER_TO_UINT (g_hash_table_lookup (counts, value));
+    g_hash_table_destroy (counts);
+
+    return n;
+}
+
+static void
+append_value (const char* key, const char* value, guint count,
+              gpointer user_data)
+{
+    GString* values = user_data;
+    if (values->len > 0)
+        g_string_append_c (values, ',');
+    g_string_append (values, value);
+}
+
+static gchar*
+lookup_values (UserDict* dict, const char* key)
+{
+    GString* values = g_string_new (NULL);
+    user_dict_match_exact (dict, key, append_value, values);
+    return g_string_free (values, FALSE);
+}
+
+static gchar*
+make_test_dir (void)
+{
+    gchar* dir = g_build_filename (g_get_tmp_dir (),
+                                   "test-userdict-XXXXXX", NULL);
+    g_assert_nonnull (g_mkdtemp (dir));
+    return dir;
+}
+
+static void
+remove_test_dir (gchar* dir)
+{
+    gchar* path;
+
+    path = g_build_filename (dir, "userdict", NULL);
+    g_unlink (path);
+    g_free (path);
+    path = g_build_filename (dir, "userdict.log", NULL);
+    g_unlink (path);
+    g_free (path);
+    g_rmdir (dir);
+    g_free (dir);
+}
+
+static void
+test_userdict_add(void)
+{
+    gchar* dir = make_test_dir ();
+    UserDict* dict = user_dict_new (dir);
+
+    user_dict_add (dict, "한자", "漢字");
+    user_dict_add (dict, "한자", "漢字");
+    user_dict_add (dict, "한", "韓");
+    // the separators are not allowed in a key
+    user_dict_add (dict, "a:b", "c");
+
+    g_assert_cmpuint (lookup_count (dict, "한자", "漢字"), ==, 2);
+    g_assert_cmpuint (lookup_count (dict, "한", "韓"), ==, 1);
+    g_assert_cmpuint (lookup_count (dict, "한", "漢字"), ==, 0);
+    g_assert_cmpuint (lookup_count (dict, "a:b", "c"), ==, 0);
+
+    user_dict_free (dict);
+
+    // the log is replayed on load
+    dict = user_dict_new (dir);
+    g_assert_cmpuint (lookup_count (dict, "한자", "漢字"), ==, 2);
+    g_assert_cmpuint (lookup_count (dict, "한", "韓"), ==, 1);
+    user_dict_free (dict);
+
+    remove_test_dir (dir);
+}
+
+static void
+test_userdict_compact(void)
+{
+    gchar* dir = make_test_dir ();
+    UserDict* dict = user_dict_new (dir);
+    gchar* path;
+    gchar* contents;
+
+    user_dict_add (dict, "가", "可");
+    user_dict_add (dict, "가나", "假:名");
+    user_dict_add (dict, "가", "可");
+    user_dict_compact (dict);
+
+    // lookups see the entries while they are being merged
+    g_assert_cmpuint (lookup_count (dict, "가", "可"), ==, 2);
+
+    user_dict_add (dict, "가", "家");
+    while (g_main_context_iteration (NULL, FALSE))
+        continue;
+    user_dict_free (dict);
+
+    dict = user_dict_new (dir);
+    g_assert_cmpuint (lookup_count (dict, "가", "可"), ==, 2);
+    g_assert_cmpuint (lookup_count (dict, "가", "家"), ==, 1);
+    g_assert_cmpuint (lookup_count (dict, "가나", "假:名"), ==, 1);
+    g_assert_cmpuint (lookup_count (dict, "나", "假:名"), ==, 0);
+    user_dict_free (dict);
+
+    // a log older than the snapshot has been merged already
+    path = g_build_filename (dir, "userdict.log", NULL);
+    g_file_set_contents (path, "# ibus-hangul userdict 0\n가:可\n", -1, NULL);
+    dict = user_dict_new (dir);
+    g_assert_cmpuint (lookup_count (dict, "가", "可"), ==, 2);
+    user_dict_free (dict);
+
+    // a line torn by a crash is dropped
+    g_file_set_contents (path, "# ibus-hangul userdict 1\n가:可\n가:家", -1,
+                         NULL);
+    dict = user_dict_new (dir);
+    g_assert_cmpuint (lookup_count (dict, "가", "可"), ==, 3);
+    g_assert_cmpuint (lookup_count (dict, "가", "家"), ==, 0);
+    user_dict_free (dict);
+
+    g_file_get_contents (path, &contents, NULL, NULL);
+    g_assert_cmpstr (contents, ==, "# ibus-hangul userdict 1\n가:可\n");
+    g_free (contents);
+    g_free (path);
+
+    remove_test_dir (dir);
+}
+
+static void
+test_userdict_rank(void)
+{
+    gchar* dir = make_test_dir ();
+    UserDict* dict = user_dict_new (dir);
+    gchar* values;
+
+    user_dict_add (dict, "수", "水");
+    user_dict_add (dict, "수", "手");
+    user_dict_add (dict, "수", "手");
+    user_dict_add (dict, "수", "數");
+
+    values = lookup_values (dict, "수");
+    g_assert_cmpstr (values, ==, "手,水,數");
+    g_free (values);
+
+    // the snapshot keeps the order and the counts are merged
+    user_dict_compact (dict);
+    user_dict_free (dict);
+
+    dict = user_dict_new (dir);
+    user_dict_add (dict, "수", "數");
+    user_dict_add (dict, "수", "數");
+    values = lookup_values (dict, "수");
+    g_assert_cmpstr (values, ==, "數,手,水");
+    g_free (values);
+    user_dict_free (dict);
+
+    remove_test_dir (dir);
+}
+
+static void
+test_userdict_compact_fail(void)
+{
+    gchar* dir = make_test_dir ();
+    UserDict* dict = user_dict_new (dir);
+    gchar* snapshot_path;
+    gchar* log_path;
+    gchar* snapshot;
+    gchar* log;
+    gchar* contents;
+
+    // root can write a read only file
+    if (geteuid () == 0) {
+        user_dict_free (dict);
+        remove_test_dir (dir);
+        g_test_skip ("The log can't be made read only for root");
+        return;
+    }
+
+    snapshot_path = g_build_filename (dir, "userdict", NULL);
+    log_path = g_build_filename (dir, "userdict.log", NULL);
+
+    user_dict_add (dict, "가", "可");
+    user_dict_compact (dict);
+    user_dict_add (dict, "가", "家");
+    user_dict_free (dict);
+
+    g_file_get_contents (snapshot_path, &snapshot, NULL, NULL);
+    g_file_get_contents (log_path, &log, NULL, NULL);
+
+    // The snapshot is written, but the log can't be emptied.
+    g_assert_cmpint (g_chmod (log_path, 0400), ==, 0);
+    g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Can't reset*");
+    dict = user_dict_new (dir);
+    user_dict_compact (dict);
+    user_dict_free (dict);
+    g_test_assert_expected_messages ();
+
+    // The old snapshot is back, and the log is still valid.
+    g_file_get_contents (snapshot_path, &contents, NULL, NULL);
+    g_assert_cmpstr (contents, ==, snapshot);
+    g_free (contents);
+    g_file_get_contents (log_path, &contents, NULL, NULL);
+    g_assert_cmpstr (contents, ==, log);
+    g_free (contents);
+
+    dict = user_dict_new (dir);
+    g_assert_cmpuint (lookup_count (dict, "가", "可"), ==, 1);
+    g_assert_cmpuint (lookup_count (dict, "가", "家"), ==, 1);
+    user_dict_free (dict);
+
+    g_chmod (log_path, 0600);
+    g_free (snapshot);
+    g_free (log);
+    g_free (snapshot_path);
+    g_free (log_path);
+
+    remove_test_dir (dir);
+}
+
+int
+main(int argc, char* argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/ibus-hangul/userdict/add", test_userdict_add);
+    g_test_add_func("/ibus-hangul/userdict/compact", test_userdict_compact);
+    g_test_add_func("/ibus-hangul/userdict/compact-fail",
+                    test_userdict_compact_fail);
+    g_test_add_func("/ibus-hangul/userdict/rank", test_userdict_rank);
+
+    int result = g_test_run();
+    return result;
+}
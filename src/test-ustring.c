@@ -50,12 +50,41 @@ test_ustring_compare(void)
     ustring_delete(s2);
 }
 
+static void
+test_ustring_common_prefix(void)
+{
+    UString* s1 = ustring_new();
+    UString* s2 = ustring_new();
+
+    g_assert_cmpuint(ustring_common_prefix(s1, s2), ==, 0);
+
+    ustring_append_utf8(s1, "abc");
+    g_assert_cmpuint(ustring_common_prefix(s1, s2), ==, 0);
+
+    ustring_append_utf8(s2, "abd");
+    g_assert_cmpuint(ustring_common_prefix(s1, s2), ==, 2);
+
+    ustring_clear(s2);
+    ustring_append_utf8(s2, "ab");
+    g_assert_cmpuint(ustring_common_prefix(s1, s2), ==, 2);
+    g_assert_cmpuint(ustring_common_prefix(s2, s1), ==, 2);
+
+    ustring_clear(s2);
+    ustring_append_utf8(s2, "abc");
+    g_assert_cmpuint(ustring_common_prefix(s1, s2), ==, 3);
+
+    ustring_delete(s1);
+    ustring_delete(s2);
+}
+
 int
 main(int argc, char* argv[])
 {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/ibus-hangul/ustring/compare", test_ustring_compare);
+    g_test_add_func("/ibus-hangul/ustring/common-prefix",
+                    test_ustring_common_prefix);
 
     int result = g_test_run();
     return result;
@@ -0,0 +1,67 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/**
+ * Static tracepoints of the provider "ibus_hangul", built with
+ * --enable-sdt. A probe is a nop until a tracer attaches to it, e.g.
+ *
+ *   bpftrace -e 'usdt:/usr/libexec/ibus-engine-hangul:ibus_hangul:commit
+ *                { @[arg0] = count(); }'
+ *
+ * Without --enable-sdt the macros expand to nothing and the arguments
+ * are not evaluated.
+ *
+ * Probes and their arguments:
+ *   key_event_entry      keyval, keycode, modifiers
+ *   key_event_path       path taken, a string
+ *   key_event_exit       keyval, whether the key was used
+ *   hotkey               hotkey list name, keyval
+ *   hangul_ic_process    keyval, whether libhangul used the key
+ *   preedit_update       length, composed length
+ *   commit               length
+ *   delete_surrounding   length
+ *   lookup_start         key length in bytes, method
+ *   lookup_end           key length in bytes, method, candidates
+ *   lookup_table_show    candidates
+ *   lookup_table_hide
+ *   settings_changed     schema id, key
+ */
+
+#ifdef ENABLE_SDT
+#include <sys/sdt.h>
+
+#define TRACE(name) \
+    DTRACE_PROBE (ibus_hangul, name)
+#define TRACE1(name, a1) \
+    DTRACE_PROBE1 (ibus_hangul, name, a1)
+#define TRACE2(name, a1, a2) \
+    DTRACE_PROBE2 (ibus_hangul, name, a1, a2)
+#define TRACE3(name, a1, a2, a3) \
+    DTRACE_PROBE3 (ibus_hangul, name, a1, a2, a3)
+#else
+#define TRACE(name)
+#define TRACE1(name, a1)
+#define TRACE2(name, a1, a2)
+#define TRACE3(name, a1, a2, a3)
+#endif
+
+#endif
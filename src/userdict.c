@@ -0,0 +1,982 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include "userdict.h"
+
+/*
+ * Files in the user dictionary directory:
+ *
+ *  userdict      the snapshot: "key:value:count" lines sorted by key, and
+ *                by count in descending order within a key. It is searched
+ *                in place through a read only mapping, and the entries of
+ *                a key come out already ranked.
+ *  userdict.log  "key:value" lines appended since the snapshot was written.
+ *
+ * Both files start with a header line carrying a generation number.
+ * Compaction writes a snapshot with the next generation through an atomic
+ * rename, and then empties the log in place and writes the new generation
+ * in it. A log whose generation doesn't match the snapshot has already
+ * been merged, so it is discarded on load. This way a crash at any point
+ * neither loses the snapshot nor counts a selection twice.
+ * If the log can't be emptied, the old snapshot is put back, so the log
+ * stays valid and the next selections are not appended to a dead log.
+ */
+
+#define USER_DICT_HEADER             "# ibus-hangul userdict "
+#define USER_DICT_SNAPSHOT_NAME      "userdict"
+#define USER_DICT_LOG_NAME           "userdict.log"
+#define USER_DICT_COMPACT_THRESHOLD  256
+
+typedef struct {
+    gchar *value;
+    guint  count;
+} UserDictEntry;
+
+typedef enum {
+    USER_DICT_JOB_APPEND,
+    USER_DICT_JOB_COMPACT,
+    USER_DICT_JOB_QUIT,
+} UserDictJobType;
+
+typedef struct {
+    UserDictJobType  type;
+    gchar           *line;
+} UserDictJob;
+
+struct _UserDict {
+    gchar       *snapshot_path;
+    gchar       *log_path;
+
+    /* changed by the main thread only, and read by lookups on other
+     * threads with the lock held */
+    GMutex       lock;
+    GMappedFile *snapshot;
+    const gchar *snapshot_begin;    /* first entry, after the header */
+    const gchar *snapshot_end;
+    GHashTable  *recent;            /* key -> GPtrArray of UserDictEntry */
+    GHashTable  *compacting;        /* recent entries being merged */
+    guint        n_logged;
+    guint        max_key_length;    /* in characters */
+
+    /* used by the writer thread only, after it has started */
+    guint        generation;
+    int          log_fd;
+    /* the log is older than the snapshot and must be emptied first */
+    gboolean     log_stale;
+
+    GThread     *writer;
+    GAsyncQueue *jobs;
+    gint         compact_succeeded;
+};
+
+static void
+user_dict_entry_free (gpointer data)
+{
+    UserDictEntry *entry = data;
+    g_free (entry->value);
+    g_free (entry);
+}
+
+/**
+ * Moves the nth entry up past the entries with a smaller count, so that
+ * the values of a key stay ordered by count without sorting them again.
+ * Entries with the same count keep their order.
+ */
+static void
+user_dict_entries_promote (GPtrArray *values, guint n)
+{
+    gpointer entry = g_ptr_array_index (values, n);
+    guint count = ((UserDictEntry*) entry)->count;
+
+    while (n > 0) {
+        UserDictEntry *prev = g_ptr_array_index (values, n - 1);
+        if (prev->count >= count)
+            break;
+        g_ptr_array_index (values, n) = prev;
+        n--;
+    }
+
+    g_ptr_array_index (values, n) = entry;
+}
+
+static GHashTable*
+user_dict_entries_new (void)
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+user_dict_entries_add (GHashTable *entries,
+                       const char *key,
+                       const char *value,
+                       guint       count)
+{
+    GPtrArray *values;
+    UserDictEntry *entry;
+    guint i;
+
+    values = g_hash_table_lookup (entries, key);
+    if (values == NULL) {
+        values = g_ptr_array_new_with_free_func (user_dict_entry_free);
+        g_hash_table_insert (entries, g_strdup (key), values);
+    }
+
+    for (i = 0; i < values->len; i++) {
+        entry = g_ptr_array_index (values, i);
+        if (strcmp (entry->value, value) == 0)
+            break;
+    }
+
+    if (i == values->len) {
+        entry = g_new (UserDictEntry, 1);
+        entry->value = g_strdup (value);
+        entry->count = 0;
+        g_ptr_array_add (values, entry);
+    }
+
+    entry->count += count;
+    user_dict_entries_promote (values, i);
+}
+
+/**
+ * Checks the header line and returns the beginning of the entries,
+ * or NULL if the data is not a user dictionary file.
+ */
+static const gchar*
+user_dict_parse_header (const gchar *begin,
+                        const gchar *end,
+                        guint       *generation)
+{
+    const gchar *p;
+    gsize len = strlen (USER_DICT_HEADER);
+
+    if (begin == NULL || end - begin < (gssize) len ||
+        memcmp (begin, USER_DICT_HEADER, len) != 0)
+        return NULL;
+
+    *generation = 0;
+    for (p = begin + len; p < end && *p >= '0' && *p <= '9'; p++)
+        *generation = *generation * 10 + (*p - '0');
+
+    if (p >= end || *p != '\n')
+        return NULL;
+
+    return p + 1;
+}
+
+static const gchar*
+user_dict_line_end (const gchar *line, const gchar *end)
+{
+    const gchar *p = memchr (line, '\n', end - line);
+    return p != NULL ? p : end;
+}
+
+/**
+ * Compares the key of an entry line with key, in the same order as
+ * strcmp() sorts the snapshot.
+ */
+static int
+user_dict_compare_key (const gchar *line,
+                       const gchar *end,
+                       const char  *key,
+                       gsize        len)
+{
+    gsize i = 0;
+
+    while (line < end && *line != ':' && *line != '\n' && i < len) {
+        if (*line != key[i])
+            return (guchar) *line - (guchar) key[i];
+        line++;
+        i++;
+    }
+
+    if (line < end && *line != ':' && *line != '\n')
+        return 1;
+    if (i < len)
+        return -1;
+    return 0;
+}
+
+/**
+ * Returns the first line of the snapshot whose key is not less than key,
+ * like look(1) does: the range is halved at the beginning of the line
+ * containing the middle byte.
+ */
+static const gchar*
+user_dict_snapshot_lower_bound (const gchar *begin,
+                                const gchar *end,
+                                const char  *key,
+                                gsize        len)
+{
+    const gchar *lo = begin;
+    const gchar *hi = end;
+
+    while (lo < hi) {
+        const gchar *line = lo + (hi - lo) / 2;
+
+        while (line > lo && line[-1] != '\n')
+            line--;
+
+        if (user_dict_compare_key (line, end, key, len) < 0) {
+            line = user_dict_line_end (line, end);
+            lo = line < end ? line + 1 : end;
+        } else {
+            hi = line;
+        }
+    }
+
+    return lo;
+}
+
+static void
+user_dict_ranked_add (GPtrArray *ranked, const char *value, guint count)
+{
+    UserDictEntry *entry;
+    guint i;
+
+    for (i = 0; i < ranked->len; i++) {
+        entry = g_ptr_array_index (ranked, i);
+        if (strcmp (entry->value, value) == 0) {
+            entry->count += count;
+            user_dict_entries_promote (ranked, i);
+            return;
+        }
+    }
+
+    entry = g_new (UserDictEntry, 1);
+    entry->value = g_strdup (value);
+    entry->count = count;
+    g_ptr_array_add (ranked, entry);
+    user_dict_entries_promote (ranked, ranked->len - 1);
+}
+
+/**
+ * Calls func for the values of key, the most selected first.
+ * The snapshot and the in memory entries are each in that order already,
+ * so only the few values of this key have to be merged.
+ */
+void
+user_dict_match_exact (UserDict     *dict,
+                       const char   *key,
+                       UserDictFunc  func,
+                       gpointer      user_data)
+{
+    GHashTable *tables[2];
+    GPtrArray *ranked;
+    gsize len;
+    guint i;
+
+    if (dict == NULL || key == NULL || key[0] == '\0')
+        return;
+
+    len = strlen (key);
+    ranked = g_ptr_array_new_with_free_func (user_dict_entry_free);
+
+    g_mutex_lock (&dict->lock);
+
+    if (dict->snapshot_begin != NULL) {
+        const gchar *end = dict->snapshot_end;
+        const gchar *line;
+        GString *value = g_string_new (NULL);
+
+        line = user_dict_snapshot_lower_bound (dict->snapshot_begin, end,
+                                               key, len);
+        while (line < end &&
+               user_dict_compare_key (line, end, key, len) == 0) {
+            const gchar *line_end = user_dict_line_end (line, end);
+            const gchar *sep = line_end;
+
+            while (sep > line + len + 1 && sep[-1] != ':')
+                sep--;
+
+            if (sep > line + len + 1) {
+                g_string_assign (value, "");
+                g_string_append_len (value, line + len + 1,
+                                     sep - 1 - (line + len + 1));
+                user_dict_ranked_add (ranked, value->str,
+                                      strtoul (sep, NULL, 10));
+            }
+
+            line = line_end < end ? line_end + 1 : end;
+        }
+
+        g_string_free (value, TRUE);
+    }
+
+    tables[0] = dict->compacting;
+    tables[1] = dict->recent;
+    for (i = 0; i < G_N_ELEMENTS (tables); i++) {
+        GPtrArray *values;
+        guint j;
+
+        if (tables[i] == NULL)
+            continue;
+
+        values = g_hash_table_lookup (tables[i], key);
+        if (values == NULL)
+            continue;
+
+        for (j = 0; j < values->len; j++) {
+            UserDictEntry *entry = g_ptr_array_index (values, j);
+            user_dict_ranked_add (ranked, entry->value, entry->count);
+        }
+    }
+
+    g_mutex_unlock (&dict->lock);
+
+    for (i = 0; i < ranked->len; i++) {
+        UserDictEntry *entry = g_ptr_array_index (ranked, i);
+        func (key, entry->value, entry->count, user_data);
+    }
+
+    g_ptr_array_free (ranked, TRUE);
+}
+
+static void
+user_dict_update_max_key_length (UserDict *dict, const gchar *key, gssize len)
+{
+    guint n = g_utf8_strlen (key, len);
+    if (n > dict->max_key_length)
+        dict->max_key_length = n;
+}
+
+static guint
+user_dict_map_snapshot (UserDict *dict)
+{
+    GMappedFile *file;
+    const gchar *begin;
+    const gchar *end;
+    const gchar *body;
+    guint generation = 0;
+
+    if (dict->snapshot != NULL) {
+        g_mapped_file_unref (dict->snapshot);
+        dict->snapshot = NULL;
+    }
+    dict->snapshot_begin = NULL;
+    dict->snapshot_end = NULL;
+
+    file = g_mapped_file_new (dict->snapshot_path, FALSE, NULL);
+    if (file == NULL)
+        return 0;
+
+    begin = g_mapped_file_get_contents (file);
+    end = begin + g_mapped_file_get_length (file);
+    body = user_dict_parse_header (begin, end, &generation);
+    if (body == NULL) {
+        g_warning ("%s is not a user dictionary", dict->snapshot_path);
+        g_mapped_file_unref (file);
+        return 0;
+    }
+
+    dict->snapshot = file;
+    dict->snapshot_begin = body;
+    dict->snapshot_end = end;
+
+    while (body < end) {
+        const gchar *line_end = user_dict_line_end (body, end);
+        const gchar *sep = memchr (body, ':', line_end - body);
+
+        if (sep != NULL)
+            user_dict_update_max_key_length (dict, body, sep - body);
+
+        body = line_end < end ? line_end + 1 : end;
+    }
+
+    return generation;
+}
+
+/**
+ * Loads the entries logged after the snapshot. A line torn by a crash
+ * is cut off, so that next appends start on a new line.
+ */
+static void
+user_dict_replay_log (UserDict *dict, guint generation)
+{
+    gchar *contents = NULL;
+    gsize length = 0;
+    const gchar *end;
+    const gchar *line;
+    guint log_generation = 0;
+
+    if (!g_file_get_contents (dict->log_path, &contents, &length, NULL))
+        return;
+
+    end = contents + length;
+    line = user_dict_parse_header (contents, end, &log_generation);
+    if (line == NULL || log_generation != generation) {
+        g_unlink (dict->log_path);
+        g_free (contents);
+        return;
+    }
+
+    while (line < end) {
+        const gchar *line_end = memchr (line, '\n', end - line);
+        const gchar *sep;
+
+        if (line_end == NULL) {
+            if (truncate (dict->log_path, line - contents) != 0)
+                g_unlink (dict->log_path);
+            break;
+        }
+
+        sep = memchr (line, ':', line_end - line);
+        if (sep != NULL && sep > line && sep + 1 < line_end) {
+            gchar *key = g_strndup (line, sep - line);
+            gchar *value = g_strndup (sep + 1, line_end - sep - 1);
+            user_dict_entries_add (dict->recent, key, value, 1);
+            user_dict_update_max_key_length (dict, key, -1);
+            dict->n_logged++;
+            g_free (key);
+            g_free (value);
+        }
+
+        line = line_end + 1;
+    }
+
+    g_free (contents);
+}
+
+static gboolean
+user_dict_write_all (int fd, const gchar *data, gsize len)
+{
+    while (len > 0) {
+        gssize n = write (fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return FALSE;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Empties the log and writes the header of the current generation in it.
+ * The log is kept open for the next appends.
+ */
+static gboolean
+user_dict_reset_log (UserDict *dict)
+{
+    gchar *header;
+    gboolean res;
+
+    if (dict->log_fd >= 0) {
+        close (dict->log_fd);
+        dict->log_fd = -1;
+    }
+
+    dict->log_fd = g_open (dict->log_path,
+                           O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                           0600);
+    if (dict->log_fd < 0)
+        return FALSE;
+
+    header = g_strdup_printf (USER_DICT_HEADER "%u\n", dict->generation);
+    res = user_dict_write_all (dict->log_fd, header, strlen (header));
+    g_free (header);
+
+    if (!res) {
+        int saved_errno = errno;
+        close (dict->log_fd);
+        dict->log_fd = -1;
+        errno = saved_errno;
+    }
+
+    return res;
+}
+
+static void
+user_dict_write_log (UserDict *dict, const gchar *line)
+{
+    // The entries of the log are in the snapshot. Appending to it would
+    // lose the selection on the next load.
+    if (dict->log_stale) {
+        if (!user_dict_reset_log (dict)) {
+            g_warning ("Can't reset %s, a selection is lost: %s",
+                       dict->log_path, g_strerror (errno));
+            return;
+        }
+        dict->log_stale = FALSE;
+    }
+
+    if (dict->log_fd < 0) {
+        struct stat st;
+
+        dict->log_fd = g_open (dict->log_path,
+                               O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                               0600);
+        if (dict->log_fd < 0) {
+            g_warning ("Can't open %s: %s", dict->log_path,
+                       g_strerror (errno));
+            return;
+        }
+
+        if (fstat (dict->log_fd, &st) == 0 && st.st_size == 0) {
+            gchar *header = g_strdup_printf (USER_DICT_HEADER "%u\n",
+                                             dict->generation);
+            user_dict_write_all (dict->log_fd, header, strlen (header));
+            g_free (header);
+        }
+    }
+
+    // Don't fsync. A crash loses the last selections at worst, and a torn
+    // line is dropped when the log is loaded next time.
+    if (!user_dict_write_all (dict->log_fd, line, strlen (line)))
+        g_warning ("Can't write %s: %s", dict->log_path, g_strerror (errno));
+}
+
+typedef struct {
+    const gchar *key;
+    gsize        key_len;
+    const gchar *value;
+    gsize        value_len;
+    guint        count;
+} UserDictRecord;
+
+static gint
+user_dict_record_compare_key (const UserDictRecord *r1,
+                              const UserDictRecord *r2)
+{
+    int res;
+
+    res = memcmp (r1->key, r2->key, MIN (r1->key_len, r2->key_len));
+    if (res == 0 && r1->key_len != r2->key_len)
+        return r1->key_len < r2->key_len ? -1 : 1;
+    return res;
+}
+
+static gint
+user_dict_record_compare (gconstpointer a, gconstpointer b)
+{
+    const UserDictRecord *r1 = a;
+    const UserDictRecord *r2 = b;
+    int res;
+
+    res = user_dict_record_compare_key (r1, r2);
+    if (res != 0)
+        return res;
+
+    res = memcmp (r1->value, r2->value, MIN (r1->value_len, r2->value_len));
+    if (res == 0 && r1->value_len != r2->value_len)
+        return r1->value_len < r2->value_len ? -1 : 1;
+    return res;
+}
+
+/**
+ * The order of the snapshot: by key, then the most selected first.
+ */
+static gint
+user_dict_record_compare_rank (gconstpointer a, gconstpointer b)
+{
+    const UserDictRecord *r1 = a;
+    const UserDictRecord *r2 = b;
+    int res;
+
+    res = user_dict_record_compare_key (r1, r2);
+    if (res != 0)
+        return res;
+
+    if (r1->count != r2->count)
+        return r1->count > r2->count ? -1 : 1;
+
+    return user_dict_record_compare (a, b);
+}
+
+/**
+ * Parses "key:value" lines, or "key:value:count" lines if with_count.
+ */
+static void
+user_dict_parse_records (GArray      *records,
+                         const gchar *line,
+                         const gchar *end,
+                         gboolean     with_count)
+{
+    while (line < end) {
+        const gchar *line_end = user_dict_line_end (line, end);
+        const gchar *value_end = line_end;
+        const gchar *sep = memchr (line, ':', line_end - line);
+        UserDictRecord r;
+
+        r.count = 1;
+        if (with_count && sep != NULL) {
+            while (value_end > sep + 1 && value_end[-1] != ':')
+                value_end--;
+            if (value_end > sep + 1) {
+                r.count = strtoul (value_end, NULL, 10);
+                value_end--;
+            }
+        }
+
+        if (sep != NULL && sep > line && sep + 1 < value_end) {
+            r.key = line;
+            r.key_len = sep - line;
+            r.value = sep + 1;
+            r.value_len = value_end - sep - 1;
+            g_array_append_val (records, r);
+        }
+
+        line = line_end < end ? line_end + 1 : end;
+    }
+}
+
+/**
+ * Puts back the snapshot which was replaced, or removes the new one if
+ * there was none.
+ */
+static gboolean
+user_dict_restore_snapshot (UserDict *dict, GMappedFile *snapshot)
+{
+    if (snapshot == NULL)
+        return g_unlink (dict->snapshot_path) == 0;
+
+    return g_file_set_contents (dict->snapshot_path,
+                                g_mapped_file_get_contents (snapshot),
+                                g_mapped_file_get_length (snapshot), NULL);
+}
+
+/**
+ * Merges the log into the snapshot. Runs on the writer thread, and all the
+ * appends queued before the compaction have been written to the log.
+ */
+static gboolean
+user_dict_write_snapshot (UserDict *dict)
+{
+    GMappedFile *snapshot;
+    gchar *log = NULL;
+    gsize log_len = 0;
+    const gchar *body;
+    guint generation;
+    guint log_generation;
+    guint generation_before;
+    GArray *records;
+    GArray *merged;
+    GString *out;
+    gboolean res;
+    guint i;
+
+    if (!g_file_get_contents (dict->log_path, &log, &log_len, NULL))
+        return FALSE;
+
+    generation_before = dict->generation;
+
+    records = g_array_new (FALSE, FALSE, sizeof (UserDictRecord));
+
+    snapshot = g_mapped_file_new (dict->snapshot_path, FALSE, NULL);
+    if (snapshot != NULL) {
+        const gchar *begin = g_mapped_file_get_contents (snapshot);
+        const gchar *end = begin + g_mapped_file_get_length (snapshot);
+
+        body = user_dict_parse_header (begin, end, &generation);
+        if (body != NULL)
+            user_dict_parse_records (records, body, end, TRUE);
+    }
+
+    // A stale log has been merged already.
+    body = user_dict_parse_header (log, log + log_len, &log_generation);
+    if (body != NULL && log_generation == dict->generation)
+        user_dict_parse_records (records, body, log + log_len, FALSE);
+
+    g_array_sort (records, user_dict_record_compare);
+
+    merged = g_array_sized_new (FALSE, FALSE, sizeof (UserDictRecord),
+                                records->len);
+    for (i = 0; i < records->len; i++) {
+        UserDictRecord r = g_array_index (records, UserDictRecord, i);
+
+        while (i + 1 < records->len &&
+               user_dict_record_compare (&r, &g_array_index (records,
+                       UserDictRecord, i + 1)) == 0) {
+            r.count += g_array_index (records, UserDictRecord, i + 1).count;
+            i++;
+        }
+
+        g_array_append_val (merged, r);
+    }
+
+    // Rank the values of each key here, on the writer thread, so that
+    // lookups never have to sort them.
+    g_array_sort (merged, user_dict_record_compare_rank);
+
+    out = g_string_sized_new (log_len + 4096);
+    g_string_append_printf (out, USER_DICT_HEADER "%u\n",
+                            dict->generation + 1);
+    for (i = 0; i < merged->len; i++) {
+        UserDictRecord *r = &g_array_index (merged, UserDictRecord, i);
+
+        g_string_append_len (out, r->key, r->key_len);
+        g_string_append_c (out, ':');
+        g_string_append_len (out, r->value, r->value_len);
+        g_string_append_printf (out, ":%u\n", r->count);
+    }
+
+    res = g_file_set_contents (dict->snapshot_path, out->str, out->len, NULL);
+    if (res) {
+        // Until the log is emptied it is ignored on load, because its
+        // generation is older than the snapshot's.
+        dict->generation++;
+        res = user_dict_reset_log (dict);
+    }
+
+    if (res) {
+        dict->log_stale = FALSE;
+    } else if (dict->generation != generation_before) {
+        g_warning ("Can't reset %s: %s", dict->log_path, g_strerror (errno));
+
+        // The old snapshot still maps the old file, which was renamed over.
+        if (user_dict_restore_snapshot (dict, snapshot)) {
+            dict->generation = generation_before;
+        } else {
+            g_warning ("Can't restore %s", dict->snapshot_path);
+            // The entries are in the new snapshot, but the next ones must
+            // not go to the old log.
+            dict->log_stale = TRUE;
+            res = TRUE;
+        }
+    }
+
+    g_string_free (out, TRUE);
+    g_array_free (merged, TRUE);
+    g_array_free (records, TRUE);
+    if (snapshot != NULL)
+        g_mapped_file_unref (snapshot);
+    g_free (log);
+
+    return res;
+}
+
+static gboolean
+user_dict_on_compacted (gpointer user_data)
+{
+    UserDict *dict = user_data;
+
+    g_mutex_lock (&dict->lock);
+
+    if (g_atomic_int_get (&dict->compact_succeeded)) {
+        user_dict_map_snapshot (dict);
+    } else {
+        // The log still has the entries, keep them in memory.
+        GHashTableIter iter;
+        gpointer key;
+        gpointer values;
+
+        g_hash_table_iter_init (&iter, dict->compacting);
+        while (g_hash_table_iter_next (&iter, &key, &values)) {
+            GPtrArray *array = values;
+            guint i;
+            for (i = 0; i < array->len; i++) {
+                UserDictEntry *entry = g_ptr_array_index (array, i);
+                user_dict_entries_add (dict->recent, key, entry->value,
+                                       entry->count);
+                dict->n_logged++;
+            }
+        }
+    }
+
+    g_hash_table_unref (dict->compacting);
+    dict->compacting = NULL;
+
+    g_mutex_unlock (&dict->lock);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer
+user_dict_writer_thread (gpointer data)
+{
+    UserDict *dict = data;
+    gboolean quit = FALSE;
+
+    while (!quit) {
+        UserDictJob *job = g_async_queue_pop (dict->jobs);
+
+        switch (job->type) {
+        case USER_DICT_JOB_APPEND:
+            user_dict_write_log (dict, job->line);
+            break;
+        case USER_DICT_JOB_COMPACT:
+            g_atomic_int_set (&dict->compact_succeeded,
+                              user_dict_write_snapshot (dict));
+            g_idle_add (user_dict_on_compacted, dict);
+            break;
+        case USER_DICT_JOB_QUIT:
+            quit = TRUE;
+            break;
+        }
+
+        g_free (job->line);
+        g_free (job);
+    }
+
+    if (dict->log_fd >= 0) {
+        close (dict->log_fd);
+        dict->log_fd = -1;
+    }
+
+    return NULL;
+}
+
+static void
+user_dict_push_job (UserDict *dict, UserDictJobType type, gchar *line)
+{
+    UserDictJob *job = g_new (UserDictJob, 1);
+
+    job->type = type;
+    job->line = line;
+    g_async_queue_push (dict->jobs, job);
+}
+
+UserDict*
+user_dict_new (const char *dirname)
+{
+    UserDict *dict;
+
+    if (g_mkdir_with_parents (dirname, 0700) != 0) {
+        g_warning ("Can't create %s: %s", dirname, g_strerror (errno));
+        return NULL;
+    }
+
+    dict = g_new0 (UserDict, 1);
+    g_mutex_init (&dict->lock);
+    dict->snapshot_path = g_build_filename (dirname,
+                                            USER_DICT_SNAPSHOT_NAME, NULL);
+    dict->log_path = g_build_filename (dirname, USER_DICT_LOG_NAME, NULL);
+    dict->recent = user_dict_entries_new ();
+    dict->log_fd = -1;
+
+    dict->generation = user_dict_map_snapshot (dict);
+    user_dict_replay_log (dict, dict->generation);
+
+    dict->jobs = g_async_queue_new ();
+    dict->writer = g_thread_new ("ibus-hangul-userdict",
+                                 user_dict_writer_thread, dict);
+
+    if (dict->n_logged >= USER_DICT_COMPACT_THRESHOLD)
+        user_dict_compact (dict);
+
+    return dict;
+}
+
+void
+user_dict_free (UserDict *dict)
+{
+    if (dict == NULL)
+        return;
+
+    user_dict_push_job (dict, USER_DICT_JOB_QUIT, NULL);
+    g_thread_join (dict->writer);
+    g_async_queue_unref (dict->jobs);
+
+    // The notification of the last compaction may be still pending.
+    while (g_source_remove_by_user_data (dict))
+        continue;
+
+    if (dict->compacting != NULL)
+        g_hash_table_unref (dict->compacting);
+    g_hash_table_unref (dict->recent);
+    if (dict->snapshot != NULL)
+        g_mapped_file_unref (dict->snapshot);
+    g_free (dict->snapshot_path);
+    g_free (dict->log_path);
+    g_mutex_clear (&dict->lock);
+    g_free (dict);
+}
+
+/**
+ * Records that value was selected for key. The entry is visible to the
+ * lookups at once and written to the log on the writer thread.
+ */
+void
+user_dict_add (UserDict *dict, const char *key, const char *value)
+{
+    if (dict == NULL || key == NULL || value == NULL)
+        return;
+
+    // The separators can't be a part of an entry.
+    if (key[0] == '\0' || value[0] == '\0' ||
+        strpbrk (key, ":\n") != NULL || strchr (value, '\n') != NULL)
+        return;
+
+    g_mutex_lock (&dict->lock);
+    user_dict_entries_add (dict->recent, key, value, 1);
+    user_dict_update_max_key_length (dict, key, -1);
+    g_mutex_unlock (&dict->lock);
+
+    user_dict_push_job (dict, USER_DICT_JOB_APPEND,
+                        g_strconcat (key, ":", value, "\n", NULL));
+
+    dict->n_logged++;
+    if (dict->n_logged >= USER_DICT_COMPACT_THRESHOLD)
+        user_dict_compact (dict);
+}
+
+/**
+ * Starts merging the log into the snapshot on the writer thread.
+ * Until it is done, the entries logged so far are looked up from
+ * dict->compacting.
+ */
+void
+user_dict_compact (UserDict *dict)
+{
+    if (dict == NULL || dict->compacting != NULL || dict->n_logged == 0)
+        return;
+
+    g_mutex_lock (&dict->lock);
+    dict->compacting = dict->recent;
+    dict->recent = user_dict_entries_new ();
+    g_mutex_unlock (&dict->lock);
+    dict->n_logged = 0;
+
+    user_dict_push_job (dict, USER_DICT_JOB_COMPACT, NULL);
+}
+
+/**
+ * Returns the length of the longest key in characters.
+ */
+guint
+user_dict_get_max_key_length (UserDict *dict)
+{
+    guint n;
+
+    if (dict == NULL)
+        return 0;
+
+    g_mutex_lock (&dict->lock);
+    n = dict->max_key_length;
+    g_mutex_unlock (&dict->lock);
+
+    return n;
+}
@@ -0,0 +1,55 @@
+/* vim:set et sts=4: */
+/* ibus-hangul - The Hangul Engine For IBus
+ * Copyright (C) 2020 Choe Hwanjin <choe.hwanjin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __USERDICT_H__
+#define __USERDICT_H__
+
+#include <glib.h>
+
+/**
+ * The per user dictionary.
+ * It keeps the hanja and symbols the user selected, and the entries the
+ * user added. New entries are appended to a log file, which is merged
+ * into a sorted snapshot file from time to time. Both files are written
+ * by a background thread, so adding an entry never waits for the disk.
+ * user_dict_match_exact() and user_dict_get_max_key_length() may be called
+ * from any thread, the other functions from the main thread only.
+ */
+typedef struct _UserDict UserDict;
+
+typedef void (*UserDictFunc) (const char *key,
+                              const char *value,
+                              guint       count,
+                              gpointer    user_data);
+
+UserDict*   user_dict_new           (const char   *dirname);
+void        user_dict_free          (UserDict     *dict);
+
+void        user_dict_add           (UserDict     *dict,
+                                     const char   *key,
+                                     const char   *value);
+/* values are passed in the order of their selection counts */
+void        user_dict_match_exact   (UserDict     *dict,
+                                     const char   *key,
+                                     UserDictFunc  func,
+                                     gpointer      user_data);
+void        user_dict_compact       (UserDict     *dict);
+guint       user_dict_get_max_key_length (UserDict *dict);
+
+#endif
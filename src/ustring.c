@@ -130,3 +130,19 @@ ustring_compare(const UString* str, const UString* other)
 
     return *p1 - *p2;
 }
+
+guint
+ustring_common_prefix(const UString* str, const UString* other)
+{
+    const ucschar* p1 = (const ucschar*)str->data;
+    const ucschar* p2 = (const ucschar*)other->data;
+    guint len = MIN(str->len, other->len);
+    guint i;
+
+    for (i = 0; i < len; ++i) {
+        if (p1[i] != p2[i])
+            break;
+    }
+
+    return i;
+}